@@ -0,0 +1,30 @@
+#include "arguments.h"
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+
+using namespace std;
+
+bool ParseInt(const char *text, int *value) {
+  char *end;
+  errno = 0;
+  const auto parsed = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || errno != 0 || parsed < INT_MIN ||
+      parsed > INT_MAX) {
+    return false;
+  }
+  *value = static_cast<int>(parsed);
+  return true;
+}
+
+bool ParseUnsigned(const char *text, unsigned long *value) {
+  if (!isdigit(static_cast<unsigned char>(text[0]))) {
+    return false;
+  }
+  char *end;
+  errno = 0;
+  *value = strtoul(text, &end, 10);
+  return *end == '\0' && errno == 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Strict parsing of numeric command line arguments for the viewer and tools.
+// Only whole decimal numbers in range are accepted, anything else returns
+// false so the caller can print its usage.
+bool ParseInt(const char *text, int *value);
+// Rejects a leading minus sign, which strtoul would wrap around
+bool ParseUnsigned(const char *text, unsigned long *value);
@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "arguments.h"
+#include "constants.h"
+#include "erosion.h"
+#include "grid.h"
+#include "light_clusters.h"
+#include "noise_engine.h"
+#include "noise_field.h"
+#include "terrain_mesh.h"
+#include "terrain_sampler.h"
+
+using namespace std;
+
+// Terrain generation benchmark, runs without a window or GL context.
+// Usage: perlin-shadows-benchmark [seed]
+
+// Generates the fixed world one tile at a time on a single thread
+static double Generate(const NoiseField &field, vector<float> *height,
+                       vector<float> *slope_x, vector<float> *slope_y) {
+  const auto start = chrono::high_resolution_clock::now();
+  for (size_t x = 0; x < kGeographyCountShort; ++x) {
+    for (size_t y = 0; y < kGeographyCountLong; ++y) {
+      const auto offset = (x * kGeographyCountLong + y) * kTotalVertices;
+      field.Evaluate(static_cast<int64_t>(x * (kGeographyShort - 1)),
+                     static_cast<int64_t>(y * (kGeographyLong - 1)), 1,
+                     kGeographyShort, kGeographyLong, height->data() + offset,
+                     slope_x->data() + offset, slope_y->data() + offset);
+    }
+  }
+  return chrono::duration<double>(chrono::high_resolution_clock::now() - start)
+      .count();
+}
+
+static void BenchmarkEngines(const mt19937::result_type seed) {
+  const auto samples =
+      kGeographyCountShort * kGeographyCountLong * kTotalVertices;
+  cout << "Noise engines, " << samples << " samples per run:\n";
+  cout << "  engine   simd  Msamples/s      mean    stddev       min"
+          "       max  |slope|  max diff\n";
+  for (size_t type = 0; type < kNoiseTypeCount; ++type) {
+    const auto noise = static_cast<NoiseType>(type);
+    vector<float> scalar(samples);
+    for (const auto simd : {false, true}) {
+      vector<float> height(samples);
+      vector<float> slope_x(samples);
+      vector<float> slope_y(samples);
+      const NoiseField field(seed, noise, simd);
+      // Best of three, the first run also pays for faulting in the buffers
+      auto seconds = Generate(field, &height, &slope_x, &slope_y);
+      for (auto run = 0; run < 2; ++run) {
+        seconds =
+            std::min(seconds, Generate(field, &height, &slope_x, &slope_y));
+      }
+
+      double sum = 0;
+      double squares = 0;
+      double slope = 0;
+      float difference = 0;
+      for (size_t i = 0; i < samples; ++i) {
+        sum += height[i];
+        squares += static_cast<double>(height[i]) * height[i];
+        slope += hypot(slope_x[i], slope_y[i]);
+        if (simd) {
+          difference = std::max(difference, abs(height[i] - scalar[i]));
+        }
+      }
+      if (!simd) {
+        scalar = height;
+      }
+      const auto mean = sum / samples;
+      cout << "  " << left << setw(8) << NoiseName(noise) << " " << setw(4)
+           << (simd ? "yes" : "no") << right << fixed << setprecision(2)
+           << setw(12) << samples / seconds / 1e6 << setw(10) << mean
+           << setw(10) << sqrt(squares / samples - mean * mean) << setw(10)
+           << *min_element(height.begin(), height.end()) << setw(10)
+           << *max_element(height.begin(), height.end()) << setprecision(4)
+           << setw(9) << slope / samples;
+      if (simd) {
+        cout << scientific << setprecision(1) << setw(10) << difference;
+      }
+      cout << defaultfloat << "\n";
+    }
+  }
+}
+
+// Time to add one Perlin octave to every tile of the fixed world, best of three
+static double AddOctave(const NoiseEngine &engine, mt19937::result_type seed,
+                        const vector<OctaveLattice> &lattices,
+                        vector<float> *height, vector<float> *slope_x,
+                        vector<float> *slope_y) {
+  auto best = 0.0;
+  for (auto run = 0; run < 3; ++run) {
+    fill(height->begin(), height->end(), 0.0f);
+    fill(slope_x->begin(), slope_x->end(), 0.0f);
+    fill(slope_y->begin(), slope_y->end(), 0.0f);
+    const auto start = chrono::high_resolution_clock::now();
+    for (size_t tile = 0; tile < lattices.size(); ++tile) {
+      const auto offset = tile * kTotalVertices;
+      engine.AddOctave(seed, lattices[tile], 1, height->data() + offset,
+                       slope_x->data() + offset, slope_y->data() + offset);
+    }
+    const auto seconds =
+        chrono::duration<double>(chrono::high_resolution_clock::now() - start)
+            .count();
+    best = run == 0 ? seconds : std::min(best, seconds);
+  }
+  return best;
+}
+
+// Compares the generic Perlin kernel against the one specialised for the
+// period of each octave
+static void BenchmarkOctaves(const mt19937::result_type seed) {
+  const auto samples =
+      kGeographyCountShort * kGeographyCountLong * kTotalVertices;
+  cout << "Perlin octaves, " << samples << " samples per run (ms):\n";
+  cout << "  detail  simd   generic  specialised  speedup  max diff\n";
+  vector<float> height(samples);
+  vector<float> slope_x(samples);
+  vector<float> slope_y(samples);
+  vector<float> generic(samples);
+  for (size_t detail = kDetail; detail > kMinDetail; detail >>= 1) {
+    vector<OctaveLattice> lattices(kGeographyCountShort * kGeographyCountLong);
+    for (size_t x = 0; x < kGeographyCountShort; ++x) {
+      for (size_t y = 0; y < kGeographyCountLong; ++y) {
+        auto &lattice = lattices[x * kGeographyCountLong + y];
+        lattice.detail = detail;
+        NoiseField::Place(static_cast<int64_t>(x * (kGeographyShort - 1)),
+                          static_cast<int64_t>(y * (kGeographyLong - 1)), 1,
+                          kGeographyShort, kGeographyLong, &lattice);
+      }
+    }
+    for (const auto simd : {false, true}) {
+      const PerlinEngine engine(simd);
+      // The same octave without the flag falls back on the generic kernel
+      for (auto &lattice : lattices) {
+        lattice.aligned = false;
+      }
+      const auto before =
+          AddOctave(engine, seed, lattices, &generic, &slope_x, &slope_y);
+      for (auto &lattice : lattices) {
+        lattice.aligned = true;
+      }
+      const auto after =
+          AddOctave(engine, seed, lattices, &height, &slope_x, &slope_y);
+      float difference = 0;
+      for (size_t i = 0; i < samples; ++i) {
+        difference = std::max(difference, abs(height[i] - generic[i]));
+      }
+      cout << "  " << setw(6) << detail << "  " << left << setw(4)
+           << (simd ? "yes" : "no") << right << fixed << setprecision(2)
+           << setw(10) << before * 1e3 << setw(13) << after * 1e3 << setw(8)
+           << before / after << "x" << scientific << setprecision(1)
+           << setw(10) << difference << defaultfloat << "\n";
+    }
+  }
+}
+
+// Vertices transformed per triangle by a FIFO post-transform cache of the
+// given size, 0.5 is the best a regular grid can do and 3 the worst
+static double AverageCacheMissRatio(const vector<unsigned int> &indices,
+                                    const size_t cache_size) {
+  deque<unsigned int> cache;
+  size_t misses = 0;
+  for (const auto index : indices) {
+    if (find(cache.begin(), cache.end(), index) == cache.end()) {
+      ++misses;
+      cache.push_back(index);
+      if (cache.size() > cache_size) {
+        cache.pop_front();
+      }
+    }
+  }
+  return static_cast<double>(misses) / (indices.size() / 3);
+}
+
+static void BenchmarkIndexOrder() {
+  cout << "Index order, average cache miss ratio per FIFO cache size:\n";
+  cout << "  stripe      16      24      32      64\n";
+  vector<unsigned int> indices(kTotalIndices);
+  const Grid flat;
+  for (const auto stripe :
+       {kGeographyShort - 1, kIndexStripe, size_t{8}, size_t{16}}) {
+    flat.WriteIndices(indices.data(), 0, kGeographyLong - 1, stripe);
+    cout << "  " << setw(6) << stripe << fixed << setprecision(3);
+    for (const auto cache_size : {16, 24, 32, 64}) {
+      cout << setw(8) << AverageCacheMissRatio(indices, cache_size);
+    }
+    cout << defaultfloat << (stripe == kIndexStripe ? "  (in use)" : "")
+         << "\n";
+  }
+}
+
+// Meshes every tile of the world at each error threshold, with one thread and
+// then with the tiles spread over kMaxThreads threads as on startup
+static void BenchmarkMesh(const mt19937::result_type seed) {
+  const auto tiles = kGeographyCountShort * kGeographyCountLong;
+  vector<float> height(tiles * kTotalVertices);
+  vector<float> slope_x(height.size());
+  vector<float> slope_y(height.size());
+  Generate(NoiseField(seed), &height, &slope_x, &slope_y);
+  const auto full = (kGeographyShort - 1) * (kGeographyLong - 1) * 2;
+
+  cout << "Adaptive mesh, " << tiles << " tiles of " << full
+       << " triangles at full resolution:\n";
+  cout << "   error  triangles/tile  of full  1 thread ms  " << kMaxThreads
+       << " threads ms\n";
+  for (const auto error : {0.0f, 0.05f, 0.1f, 0.25f, 0.5f, 1.0f, 2.0f}) {
+    vector<vector<unsigned int>> meshes(tiles);
+    const auto mesh = [&](const size_t first, const size_t step) {
+      for (auto tile = first; tile < tiles; tile += step) {
+        meshes[tile].clear();
+        TerrainMesh(height.data() + tile * kTotalVertices)
+            .Triangulate(error, &meshes[tile]);
+      }
+    };
+    auto start = chrono::high_resolution_clock::now();
+    mesh(0, 1);
+    const auto single = chrono::duration<double>(
+                            chrono::high_resolution_clock::now() - start)
+                            .count();
+    start = chrono::high_resolution_clock::now();
+    vector<thread> threads;
+    for (size_t first = 0; first < kMaxThreads; ++first) {
+      threads.emplace_back(mesh, first, kMaxThreads);
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    const auto parallel = chrono::duration<double>(
+                              chrono::high_resolution_clock::now() - start)
+                              .count();
+
+    size_t triangles = 0;
+    for (const auto &indices : meshes) {
+      triangles += indices.size() / 3;
+    }
+    cout << fixed << setprecision(2) << setw(8) << error << setw(16)
+         << triangles / tiles << setprecision(1) << setw(8)
+         << 100.0 * triangles / (tiles * full) << "%" << setprecision(2)
+         << setw(13) << single * 1e3 << setw(13) << parallel * 1e3
+         << defaultfloat << (error == kMeshError ? "  (in use)" : "") << "\n";
+  }
+}
+
+// Erodes a single tile and its halo with every power of two thread count up to
+// the number of hardware threads (at least kMaxThreads), counting each cell
+// once per iteration
+static void BenchmarkErosion(const mt19937::result_type seed) {
+  const auto halo = Erosion::Halo(kThermalIterations, kHydraulicIterations);
+  const auto width = kGeographyShort + 2 * halo;
+  const auto length = kGeographyLong + 2 * halo;
+  const auto cells =
+      width * length * (kHydraulicIterations + kThermalIterations);
+  vector<float> noise(width * length);
+  NoiseField(seed).Evaluate(-static_cast<int64_t>(halo),
+                            -static_cast<int64_t>(halo), 1, width, length,
+                            noise.data());
+  cout << "Erosion, " << width << "x" << length << " cells, "
+       << kHydraulicIterations << " hydraulic and " << kThermalIterations
+       << " thermal iterations:\n";
+  cout << "  threads  simd  Mcells/s  speedup  max diff\n";
+
+  vector<float> reference;
+  double single = 0;
+  const auto most =
+      std::max<size_t>(thread::hardware_concurrency(), kMaxThreads);
+  for (size_t threads = 1; threads <= most; threads *= 2) {
+    for (const auto simd : {false, true}) {
+      // Scalar only as a baseline
+      if (!simd && threads > 1) {
+        continue;
+      }
+      Erosion erosion(width, length, threads, simd);
+      vector<float> height;
+      auto best = 0.0;
+      for (auto run = 0; run < 3; ++run) {
+        height = noise;
+        const auto start = chrono::high_resolution_clock::now();
+        erosion.Run(height.data(), kThermalIterations, kHydraulicIterations);
+        const auto seconds = chrono::duration<double>(
+                                 chrono::high_resolution_clock::now() - start)
+                                 .count();
+        best = run == 0 ? seconds : std::min(best, seconds);
+      }
+      if (reference.empty()) {
+        reference = height;
+        single = best;
+      }
+      float difference = 0;
+      for (size_t i = 0; i < height.size(); ++i) {
+        difference = std::max(difference, abs(height[i] - reference[i]));
+      }
+      cout << "  " << setw(7) << threads << "  " << left << setw(4)
+           << (simd ? "yes" : "no") << right << fixed << setprecision(2)
+           << setw(10) << cells / best / 1e6 << setw(8) << single / best
+           << "x" << scientific << setprecision(1) << setw(10) << difference
+           << defaultfloat << "\n";
+    }
+  }
+}
+
+// Scatters lights over the world around a camera in its middle, and assigns
+// them to the clusters of its view
+static void BenchmarkLights(const mt19937::result_type seed) {
+  const auto width = static_cast<float>(kGeographyShort * kGeographyCountShort);
+  const auto length = static_cast<float>(kGeographyLong * kGeographyCountLong);
+  const glm::vec3 eye(width / 2, length / 2, 80);
+  const auto view = glm::lookAt(eye, eye + glm::vec3(0.7f, 0.7f, -0.2f),
+                                glm::vec3(0, 0, 1));
+  const auto projection = glm::perspective(glm::radians(kFOV), 16.0f / 9.0f,
+                                           kNearPlane, kFarPlane);
+
+  cout << "Clustered lights, " << kClustersX << "x" << kClustersY << "x"
+       << kClustersZ << " clusters:\n";
+  cout << "  lights  visible  assign ms  lights/cluster  shadowed\n";
+  mt19937 random(seed);
+  uniform_real_distribution<float> unit(0, 1);
+  for (const auto count : {size_t{16}, size_t{64}, size_t{256}, kMaxLights}) {
+    vector<Light> lights;
+    for (size_t i = 0; i < count; ++i) {
+      lights.push_back({{unit(random) * width, unit(random) * length,
+                         20 + unit(random) * 40},
+                        {1, 1, 1},
+                        16 + unit(random) * 32,
+                        true});
+    }
+    LightClusters clusters;
+    constexpr auto kRepeats = 20;
+    const auto start = chrono::high_resolution_clock::now();
+    for (auto repeat = 0; repeat < kRepeats; ++repeat) {
+      clusters.Assign(lights, view, projection);
+    }
+    const auto seconds = chrono::duration<double>(
+                             chrono::high_resolution_clock::now() - start)
+                             .count();
+    vector<ShadowSlot> slots;
+    clusters.AllocateShadows(lights, eye, &slots);
+
+    size_t occupied = 0;
+    for (size_t i = 1; i < clusters.clusters().size(); i += 2) {
+      occupied += clusters.clusters()[i] != 0;
+    }
+    const auto visible = count_if(clusters.visible().begin(),
+                                  clusters.visible().end(),
+                                  [](bool visible) { return visible; });
+    cout << setw(8) << count << setw(9) << visible << fixed << setprecision(3)
+         << setw(11) << seconds / kRepeats * 1e3 << setprecision(2)
+         << setw(16)
+         << (occupied == 0 ? 0.0
+                           : static_cast<double>(clusters.indices().size()) /
+                                 occupied)
+         << setw(10) << slots.size() << defaultfloat << "\n";
+  }
+}
+
+// Samples random positions over the fixed world with each filter, scalar and
+// SIMD, on every power of two thread count up to the number of hardware
+// threads (at least kMaxThreads)
+static void BenchmarkSampler(const mt19937::result_type seed) {
+  const auto tiles = kGeographyCountShort * kGeographyCountLong;
+  vector<float> height(tiles * kTotalVertices);
+  vector<float> slope_x(height.size()), slope_y(height.size());
+  Generate(NoiseField(seed), &height, &slope_x, &slope_y);
+
+  constexpr size_t kSamples{1 << 20};
+  const auto width = static_cast<float>((kGeographyShort - 1) *
+                                        kGeographyCountShort);
+  const auto length = static_cast<float>((kGeographyLong - 1) *
+                                         kGeographyCountLong);
+  mt19937 random(seed);
+  uniform_real_distribution<float> unit(0, 1);
+  vector<glm::vec2> positions(kSamples);
+  for (auto &position : positions) {
+    position = {unit(random) * width, unit(random) * length};
+  }
+  cout << "Terrain sampling, " << kSamples << " random positions over "
+       << kGeographyCountShort << "x" << kGeographyCountLong << " tiles:\n";
+  cout << "  filter       threads  simd  Msamples/s  speedup  max diff\n";
+
+  const auto most =
+      std::max<size_t>(thread::hardware_concurrency(), kMaxThreads);
+  for (const auto filter :
+       {SampleFilter::kBilinear, SampleFilter::kCatmullRom}) {
+    vector<float> reference_heights;
+    vector<glm::vec3> reference_normals;
+    double single = 0;
+    for (size_t threads = 1; threads <= most; threads *= 2) {
+      for (const auto simd : {false, true}) {
+        // Scalar only as a baseline
+        if (!simd && threads > 1) {
+          continue;
+        }
+        TerrainSampler sampler(threads, simd);
+        for (size_t x = 0; x < kGeographyCountShort; ++x) {
+          for (size_t y = 0; y < kGeographyCountLong; ++y) {
+            sampler.SetTile(static_cast<int>(x), static_cast<int>(y),
+                            height.data() +
+                                (x * kGeographyCountLong + y) * kTotalVertices);
+          }
+        }
+        vector<float> heights(kSamples);
+        vector<glm::vec3> normals(kSamples);
+        auto best = 0.0;
+        for (auto run = 0; run < 3; ++run) {
+          const auto start = chrono::high_resolution_clock::now();
+          sampler.Sample(positions.data(), kSamples, filter, heights.data(),
+                         normals.data());
+          const auto seconds = chrono::duration<double>(
+                                   chrono::high_resolution_clock::now() -
+                                   start)
+                                   .count();
+          best = run == 0 ? seconds : std::min(best, seconds);
+        }
+        if (reference_heights.empty()) {
+          reference_heights = heights;
+          reference_normals = normals;
+          single = best;
+        }
+        float difference = 0;
+        for (size_t i = 0; i < kSamples; ++i) {
+          difference = std::max(
+              {difference, abs(heights[i] - reference_heights[i]),
+               glm::length(normals[i] - reference_normals[i])});
+        }
+        cout << "  " << left << setw(11)
+             << (filter == SampleFilter::kBilinear ? "bilinear"
+                                                   : "catmull-rom")
+             << right << setw(9) << threads << "  " << left << setw(4)
+             << (simd ? "yes" : "no") << right << fixed << setprecision(2)
+             << setw(12) << kSamples / best / 1e6 << setw(8) << single / best
+             << "x" << scientific << setprecision(1) << setw(10)
+             << difference << defaultfloat << "\n";
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long seed = 0;
+  if (argc > 2 || (argc == 2 && !ParseUnsigned(argv[1], &seed))) {
+    cerr << "Usage: " << argv[0] << " [seed]\n";
+    return 1;
+  }
+  cout << "Seed: " << seed << "\n\n";
+  BenchmarkEngines(seed);
+  cout << "\n";
+  BenchmarkOctaves(seed);
+  cout << "\n";
+  BenchmarkIndexOrder();
+  cout << "\n";
+  BenchmarkMesh(seed);
+  cout << "\n";
+  BenchmarkErosion(seed);
+  cout << "\n";
+  BenchmarkLights(seed);
+  cout << "\n";
+  BenchmarkSampler(seed);
+  return 0;
+}
@@ -6,15 +6,11 @@
 using namespace std;
 
 void Camera::LoadMatrices(Shader *shader) const {
-  const auto viewMatrix =
-      glm::lookAt(position_, position_ + look_vector(), up_vector());
-  if (!shader->CopyDataToUniform(viewMatrix, "view")) {
+  if (!shader->CopyDataToUniform(view(), "view")) {
     cerr << "View matrix not in shader" << endl;
   }
 
-  const auto perspectiveMatrix =
-      glm::perspective(glm::radians(kFOV), aspect_, kNearPlane, kFarPlane);
-  if (!shader->CopyDataToUniform(perspectiveMatrix, "projection")) {
+  if (!shader->CopyDataToUniform(projection(), "projection")) {
     cerr << "Projection matrix not in shader" << endl;
   }
 
@@ -24,3 +20,11 @@ void Camera::LoadMatrices(Shader *shader) const {
 
   shader->CopyDataToUniform(kFarPlane, "farPlane");
 }
+
+glm::mat4 Camera::view() const {
+  return glm::lookAt(position_, position_ + look_vector(), up_vector());
+}
+
+glm::mat4 Camera::projection() const {
+  return glm::perspective(glm::radians(kFOV), aspect_, kNearPlane, kFarPlane);
+}
@@ -15,6 +15,8 @@ class Camera {
   }
 
   void LoadMatrices(Shader *shader) const;
+  glm::mat4 view() const;
+  glm::mat4 projection() const;
 
   inline void RelativeRotate(const glm::vec3 amount) { rotation_ += amount; }
   inline void RelativeMove(const glm::vec3 amount) {
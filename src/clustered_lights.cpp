@@ -0,0 +1,199 @@
+#include "clustered_lights.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+
+#include "constants.h"
+#include "geography.h"
+
+using namespace std;
+
+// Texels of lightData per light: position and radius, colour and shadow face
+// size (zero without a shadow), then the atlas corners of two faces each
+constexpr int kLightTexels{5};
+
+// Rotations into each cube face, in the same order and orientation as the
+// faces of PointLight's depth cube
+static const array<glm::mat4, 6> &FaceViews() {
+  static const array<glm::mat4, 6> views = {
+      glm::lookAt(glm::vec3(0), glm::vec3(1, 0, 0), glm::vec3(0, -1, 0)),
+      glm::lookAt(glm::vec3(0), glm::vec3(-1, 0, 0), glm::vec3(0, -1, 0)),
+      glm::lookAt(glm::vec3(0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1)),
+      glm::lookAt(glm::vec3(0), glm::vec3(0, -1, 0), glm::vec3(0, 0, -1)),
+      glm::lookAt(glm::vec3(0), glm::vec3(0, 0, 1), glm::vec3(0, -1, 0)),
+      glm::lookAt(glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0))};
+  return views;
+}
+
+static bool operator==(const ShadowSlot &a, const ShadowSlot &b) {
+  return a.light == b.light && a.size == b.size &&
+         equal(begin(a.x), end(a.x), begin(b.x)) &&
+         equal(begin(a.y), end(a.y), begin(b.y));
+}
+
+// Replaces the contents of a buffer, never leaving it empty, and returns its
+// new size
+template <typename T>
+static GLsizeiptr Upload(const GLuint buffer, const vector<T> &data) {
+  const auto size =
+      static_cast<GLsizeiptr>(std::max<size_t>(data.size(), 1) * sizeof(T));
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, size, data.empty() ? nullptr : data.data(),
+               GL_STREAM_DRAW);
+  return size;
+}
+
+ClusteredLights::ClusteredLights() {
+  glGenTextures(1, &atlas_);
+  glBindTexture(GL_TEXTURE_2D, atlas_);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, kShadowAtlasSize,
+               kShadowAtlasSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  atlasCharge_.Set(static_cast<int64_t>(kShadowAtlasSize) * kShadowAtlasSize *
+                   sizeof(float));
+
+  glGenFramebuffers(1, &fbo_);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, atlas_, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  const GLenum formats[] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+  glGenBuffers(3, buffers_);
+  glGenTextures(3, textures_);
+  for (auto i = 0; i < 3; ++i) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers_[i]);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, textures_[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers_[i]);
+  }
+  bufferCharge_.Set(3 * 16);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+ClusteredLights::~ClusteredLights() {
+  glDeleteTextures(3, textures_);
+  glDeleteBuffers(3, buffers_);
+  glDeleteFramebuffers(1, &fbo_);
+  glDeleteTextures(1, &atlas_);
+}
+
+void ClusteredLights::Add(const Light &light) {
+  if (lights_.size() < kMaxLights) {
+    lights_.push_back(light);
+    changed_ = true;
+  }
+}
+
+void ClusteredLights::Clear() {
+  lights_.clear();
+  slots_.clear();
+  changed_ = true;
+}
+
+void ClusteredLights::Update(const Camera &camera, const int width,
+                             const int height,
+                             const vector<Renderable *> &objects,
+                             const bool terrain_changed) {
+  width_ = width;
+  height_ = height;
+  clusters_.Assign(lights_, camera.view(), camera.projection());
+
+  // Slots that stayed where they were keep their shadows
+  vector<ShadowSlot> slots;
+  clusters_.AllocateShadows(lights_, camera.getPosition(), &slots);
+  const auto redraw_all = terrain_changed || changed_;
+  for (const auto &slot : slots) {
+    if (redraw_all ||
+        find(slots_.begin(), slots_.end(), slot) == slots_.end()) {
+      DrawShadows(slot, objects);
+    }
+  }
+  slots_ = move(slots);
+  changed_ = false;
+
+  vector<glm::vec4> data(lights_.size() * kLightTexels, glm::vec4(0));
+  for (size_t i = 0; i < lights_.size(); ++i) {
+    data[i * kLightTexels] = glm::vec4(lights_[i].position, lights_[i].radius);
+    data[i * kLightTexels + 1] = glm::vec4(lights_[i].color, 0);
+  }
+  for (const auto &slot : slots_) {
+    const auto texels = data.begin() + slot.light * kLightTexels;
+    texels[1].w = static_cast<float>(slot.size);
+    for (size_t face = 0; face < 6; face += 2) {
+      texels[2 + face / 2] = {slot.x[face], slot.y[face], slot.x[face + 1],
+                              slot.y[face + 1]};
+    }
+  }
+  bufferCharge_.Set(Upload(buffers_[0], data) +
+                    Upload(buffers_[1], clusters_.clusters()) +
+                    Upload(buffers_[2], clusters_.indices()));
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Only tiles within the light's reach are drawn into its faces
+void ClusteredLights::DrawShadows(const ShadowSlot &slot,
+                                  const vector<Renderable *> &objects) {
+  const auto &light = lights_[slot.light];
+  const auto projection = glm::perspective(glm::half_pi<float>(), 1.0f,
+                                           kNearPlane, light.radius);
+  const auto toLight =
+      glm::translate(glm::identity<glm::mat4>(), -light.position);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  glEnable(GL_SCISSOR_TEST);
+  glUseProgram(shadow_.id());
+  shadow_.CopyDataToUniform(light.position, "lightPos");
+  shadow_.CopyDataToUniform(light.radius, "radius");
+  for (size_t face = 0; face < 6; ++face) {
+    glViewport(slot.x[face], slot.y[face], slot.size, slot.size);
+    glScissor(slot.x[face], slot.y[face], slot.size, slot.size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    shadow_.CopyDataToUniform(projection * FaceViews()[face] * toLight,
+                              "lightMatrix");
+    for (const auto object : objects) {
+      const auto geo = dynamic_cast<Geography *>(object);
+      if (geo == nullptr) {
+        continue;
+      }
+      const auto nearest =
+          glm::clamp(light.position, geo->low(), geo->high());
+      if (glm::distance(nearest, light.position) < light.radius) {
+        geo->Render(&shadow_);
+      }
+    }
+  }
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ClusteredLights::LoadData(Shader *shader) const {
+  const GLenum targets[] = {GL_TEXTURE_BUFFER, GL_TEXTURE_BUFFER,
+                            GL_TEXTURE_BUFFER, GL_TEXTURE_2D};
+  const GLuint textures[] = {textures_[0], textures_[1], textures_[2], atlas_};
+  const char *names[] = {"lightData", "lightClusters", "lightIndices",
+                         "shadowAtlas"};
+  for (auto i = 0; i < 4; ++i) {
+    glActiveTexture(GL_TEXTURE1 + i);
+    glBindTexture(targets[i], textures[i]);
+    shader->CopyDataToUniform(1 + i, names[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  shader->CopyDataToUniform(6, FaceViews().data(), "cubeFaces");
+  shader->CopyDataToUniform(
+      glm::vec4(static_cast<float>(kClustersX) / static_cast<float>(width_),
+                static_cast<float>(kClustersY) / static_cast<float>(height_),
+                kClustersZ / log(kFarPlane / kNearPlane), kNearPlane),
+      "clusterGrid");
+  shader->CopyDataToUniform(
+      glm::vec3(kClustersX, kClustersY, kClustersZ), "clusterCounts");
+}
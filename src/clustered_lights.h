@@ -0,0 +1,56 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "camera.h"
+#include "light_clusters.h"
+#include "memory_accounting.h"
+#include "renderable.h"
+#include "shader.h"
+
+// Local point lights on top of the main PointLight, up to kMaxLights of them.
+// The lights reaching each cluster of the view are found on the CPU every
+// frame and handed to phong.frag in buffer textures, so a pixel only shades
+// the few lights near it. Shadowed lights share a single depth atlas.
+class ClusteredLights {
+ public:
+  ClusteredLights();
+  ~ClusteredLights();
+
+  void Add(const Light &);
+  void Clear();
+  inline std::size_t size() const { return lights_.size(); }
+  inline std::size_t shadowed() const { return slots_.size(); }
+
+  // Culls the lights for the camera and viewport, and redraws the shadows of
+  // every light that moved in the atlas (all of them if the terrain changed)
+  void Update(const Camera &, int, int, const std::vector<Renderable *> &,
+              bool);
+  // Binds the lights to texture units 1 to 4, the main light has unit 0
+  void LoadData(Shader *) const;
+
+ private:
+  void DrawShadows(const ShadowSlot &, const std::vector<Renderable *> &);
+
+  std::vector<Light> lights_;
+  LightClusters clusters_;
+  std::vector<ShadowSlot> slots_;
+  // Lights were added or removed since the atlas was drawn
+  bool changed_{true};
+  int width_{1};
+  int height_{1};
+
+  Shader shadow_{"shadow_atlas.vert", "shadow_atlas.frag"};
+  GLuint atlas_{0};
+  GLuint fbo_{0};
+  // Buffer textures and the buffers behind them, for the lights, the range of
+  // light indices of each cluster and the indices themselves
+  GLuint textures_[3]{};
+  GLuint buffers_[3]{};
+  MemoryCharge atlasCharge_{MemoryPool::kShadowMaps};
+  MemoryCharge bufferCharge_{MemoryPool::kTextures};
+};
@@ -1,39 +1,129 @@
 #pragma once
 
-#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
 
 // How many Geography grids are created
 constexpr unsigned int kGeographyCountShort{1 << 2};
 constexpr unsigned int kGeographyCountLong{kGeographyCountShort << 0};
 
-// Size of each Geography grid
-constexpr std::size_t kGeographyShort{1 << 8};
-constexpr std::size_t kGeographyLong{kGeographyShort << 0};
-constexpr float kHeightMultiplier{kGeographyShort * 0.25};
+// Size of each Geography grid in vertices, a power of two cells plus one
+// (which the adaptive mesh needs)
+constexpr std::size_t kGeographyShort{(1 << 8) + 1};
+constexpr std::size_t kGeographyLong{((kGeographyShort - 1) << 0) + 1};
+constexpr float kHeightMultiplier{(kGeographyShort - 1) * 0.25};
+// Octave amplitudes add up to less than 2, so heights stay within this far of
+// zero. Exported 16-bit heightmaps map the whole range.
+constexpr float kExportHeightRange{2 * kHeightMultiplier};
 
-// Controls the generated layers of Perlin noise
-constexpr auto kDetail{kGeographyShort >> 0};
-constexpr std::size_t kMinDetail{1 << 3};
+// Controls the generated layers of Perlin noise, periods (in world units)
+// kDetail, kDetail / 2, ... down to but not including kMinDetail
+constexpr auto kDetail{(kGeographyShort - 1) >> 0};
+constexpr std::size_t kMinDetail{1};
+// Shifts the noise by half a unit so vertices don't fall on lattice corners
+constexpr double kNoiseOffset{0.5};
 
 // The maximum number of threads to use
 constexpr size_t kMaxThreads{4};
+// Smallest batch of terrain samples split over threads
+constexpr size_t kParallelSamples{1 << 14};
+
+// Erodes every tile after generating its noise, which looks less synthetic but
+// means generating and eroding a margin of Erosion::Halo cells around the tile
+// as well so that neighbouring tiles still match. The iteration counts are the
+// budget of each stage.
+constexpr bool kErosion{false};
+constexpr size_t kHydraulicIterations{16};
+constexpr size_t kThermalIterations{8};
+
+// Generated tiles are saved here (relative to the CWD) and mapped back in
+// instead of being regenerated when the seed and parameters match
+constexpr bool kUseTileCache{true};
+constexpr auto kTileCacheDirectory{"tile_cache"};
+// Keeps linked shader programs in kProgramCacheDirectory (relative to the
+// CWD) when the driver supports program binaries, startup then skips
+// compiling them
+constexpr bool kProgramCache{true};
+constexpr auto kProgramCacheDirectory{"program_cache"};
+
+// Instead of the fixed kGeographyCountShort x kGeographyCountLong world, keep
+// the tiles within kStreamRadius tiles of the camera resident
+constexpr bool kStreamWorld{false};
+constexpr int kStreamRadius{4};
+
+// Background threads generating streamed or regenerated tiles (each also uses
+// kMaxThreads while generating)
+constexpr size_t kBackgroundThreads{2};
+// Bytes of background generated tiles uploaded to the GPU per tick, at least
+// one tile is always uploaded
+constexpr std::ptrdiff_t kUploadBudget{8 << 20};
 
 // Detail of the shadow maps generated by point lights
-constexpr GLsizei kShadowMapSize{1 << 13};
+constexpr int kShadowMapSize{1 << 13};
+
+// Most bytes the GPU may hold for tile vertex and index buffers and for shadow
+// maps, 0 for no limit (see MemoryAccounting). Streaming refuses tiles past
+// kGeometryBudget, making room by dropping farther tiles first, and the shadow
+// map of the point light is halved until it fits kShadowMapBudget, though not
+// below kMinShadowMapSize.
+constexpr std::int64_t kGeometryBudget{0};
+constexpr std::int64_t kShadowMapBudget{0};
+constexpr int kMinShadowMapSize{1 << 8};
+
+// Local point lights are culled into a kClustersX x kClustersY grid over the
+// screen, sliced kClustersZ times exponentially between the near and far
+// planes, so each pixel only shades the lights that reach its cluster
+constexpr std::size_t kMaxLights{1024};
+constexpr std::size_t kClustersX{16};
+constexpr std::size_t kClustersY{9};
+constexpr std::size_t kClustersZ{24};
+// Lights added at once with 'j'
+constexpr std::size_t kLightBatch{32};
+// Shadows of local lights share one kShadowAtlasSize square depth texture, the
+// cube faces of each light get between kShadowFaceMin and kShadowFaceMax
+// pixels a side by how close and large the light is, for at most
+// kMaxShadowLights lights
+constexpr int kShadowAtlasSize{1 << 12};
+constexpr int kShadowFaceMax{1 << 9};
+constexpr int kShadowFaceMin{1 << 6};
+constexpr std::size_t kMaxShadowLights{32};
 
 // Camera properties
 constexpr float kNearPlane{0.1};
 constexpr float kFarPlane{kGeographyLong * kGeographyCountLong << 2};
 constexpr float kFOV{45};
 
+// Skips tiles hidden behind nearer terrain, as far as a kOcclusionWidth x
+// kOcclusionHeight depth buffer of the solid boxes under kOcclusionBlocks^2
+// blocks of each tile can tell
+constexpr bool kOcclusionCulling{true};
+constexpr std::size_t kOcclusionWidth{128};
+constexpr std::size_t kOcclusionHeight{64};
+constexpr std::size_t kOcclusionBlocks{16};
+
+// Draws the visible tiles depth-only first, so phong.frag only shades the
+// nearest fragment of each pixel instead of every overdrawn one. The GPU time
+// of both passes is shown averaged over kTimerFrames frames
+constexpr bool kDepthPrepass{true};
+constexpr int kTimerFrames{30};
+
 // Ideal program FPS
 constexpr auto kFPS{60};
 
+// Lowers rendering quality while frames take longer than 1000 / kFPS ms on
+// average, and raises it again once there is room (see QualityGovernor)
+constexpr bool kQualityGovernor{true};
+constexpr int kGovernorFrames{30};
+constexpr int kGovernorCalmWindows{4};
+constexpr double kGovernorHeadroom{0.7};
+
 // Mouse sensitivity
 constexpr auto kRotateDelta{.0025f};
 
 // Move speed
 constexpr auto kMoveDelta{kGeographyShort * 0.01f};
+// How close the camera may get to the terrain below it
+constexpr float kCameraClearance{2};
 
 // Calculate the total number of vertices_ needed for the entire grid
 constexpr std::size_t kTotalVertices{kGeographyShort * kGeographyLong};
@@ -44,3 +134,41 @@ constexpr std::size_t kVerticesPerCell{6};
 constexpr std::size_t kTotalCells{(kGeographyShort - 1) * (kGeographyLong - 1)};
 // Total number of EBO indices
 constexpr std::size_t kTotalIndices{kTotalCells * kVerticesPerCell};
+
+// Width in cells of the columns the index buffer walks the grid in, two rows
+// of a column (2 * (kIndexStripe + 1) vertices) should fit in the GPU's
+// post-transform vertex cache, even a small one of 16 entries
+constexpr std::size_t kIndexStripe{4};
+
+// Meshes each tile with only as many triangles as keep the surface within
+// roughly kMeshError (in world units) of its heights, rather than two per cell
+constexpr bool kAdaptiveMesh{true};
+constexpr float kMeshError{0.25f};
+
+// Bakes the full resolution normals of each tile into a compressed texture
+// while it is generated, and draws it with a regular mesh of only every
+// kNormalMapStride-th vertex each way (instead of the adaptive mesh) that
+// phong.frag shades with the baked normals. kBakeOcclusion also bakes how
+// much of the sky each vertex sees within kHorizonDistance cells, which
+// darkens the ambient light in hollows.
+constexpr bool kNormalMaps{false};
+constexpr std::size_t kNormalMapStride{4};
+constexpr bool kBakeOcclusion{true};
+constexpr std::size_t kHorizonDistance{16};
+constexpr std::size_t kCoarseShort{(kGeographyShort - 1) / kNormalMapStride +
+                                   1};
+constexpr std::size_t kCoarseLong{(kGeographyLong - 1) / kNormalMapStride + 1};
+// Vertices uploaded for each tile
+constexpr std::size_t kTileVertices{kNormalMaps ? kCoarseShort * kCoarseLong
+                                                : kTotalVertices};
+
+// Keeps the heights of each tile that has been uploaded only as 16-bit levels
+// between its lowest and highest point, losslessly compressed (see
+// CompressedHeights), and decodes them on use into the kHotTiles most
+// recently used tiles. The renderer samples the 3 x 3 tiles around the camera.
+constexpr bool kColdHeights{false};
+constexpr std::size_t kHotTiles{16};
+
+// Rows of vertices built at a time while writing a mesh into its VBO, small
+// enough for the block to stay in cache
+constexpr std::size_t kMeshBlockRows{16};
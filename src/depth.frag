@@ -0,0 +1,6 @@
+#version 330 core
+
+
+// Depth only, drawn with phong.vert for the depth pre-pass
+void main() {
+}
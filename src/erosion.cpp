@@ -0,0 +1,424 @@
+#include "erosion.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using namespace std;
+
+// Steepest height difference between neighbouring cells that loose material
+// rests at, and the share of the excess moved per iteration
+constexpr float kTalus{0.7f};
+constexpr float kThermalRate{0.25f};
+
+// Shallow water model after "Fast Hydraulic Erosion Simulation and
+// Visualization on GPU" by Mei, Decaudin and Hu, with a time step of 1 and
+// cells 1 world unit wide
+constexpr float kRain{0.01f};
+// Gravity times pipe cross section over pipe length
+constexpr float kPipe{0.2f};
+constexpr float kCapacity{2.0f};
+constexpr float kDissolve{0.3f};
+constexpr float kDeposit{0.3f};
+constexpr float kEvaporation{0.05f};
+// Keeps flat ground carrying some sediment
+constexpr float kMinTilt{0.05f};
+// Sediment is advected from at most one cell away, which bounds the halo
+constexpr float kMaxVelocity{0.99f};
+constexpr float kEpsilon{1e-6f};
+
+// Same results as _mm_max_ps and _mm_min_ps, including for signed zeros
+static inline float Max(const float a, const float b) { return a > b ? a : b; }
+static inline float Min(const float a, const float b) { return a < b ? a : b; }
+
+Erosion::Erosion(const size_t width, const size_t length, const size_t threads,
+                 const bool simd)
+    : width_(width),
+      length_(length),
+      threads_(std::max<size_t>(threads, 1)),
+      simd_(simd),
+      barrier_(threads_) {
+  const auto cells = width * length;
+  water_.resize(cells);
+  for (auto &sediment : sediment_) {
+    sediment.resize(cells);
+  }
+  for (auto &flux : flux_) {
+    flux.resize(cells);
+  }
+  velocityX_.resize(cells);
+  velocityY_.resize(cells);
+  tilt_.resize(cells);
+}
+
+// Runs the given number of hydraulic and then thermal iterations over the
+// heights in place
+void Erosion::Run(float *height, const size_t thermal,
+                  const size_t hydraulic) {
+  height_ = height;
+  fill(water_.begin(), water_.end(), kRain);
+  for (auto &sediment : sediment_) {
+    fill(sediment.begin(), sediment.end(), 0.0f);
+  }
+  for (auto &flux : flux_) {
+    fill(flux.begin(), flux.end(), 0.0f);
+  }
+
+  vector<thread> threads;
+  for (size_t i = 1; i < threads_; ++i) {
+    threads.emplace_back(&Erosion::Work, this, i, thermal, hydraulic);
+  }
+  Work(0, thermal, hydraulic);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  height_ = nullptr;
+}
+
+// Every thread runs the same passes over its own band of rows, waiting for the
+// others between passes since each pass reads its neighbours' rows
+void Erosion::Work(const size_t band, const size_t thermal,
+                   const size_t hydraulic) {
+  const auto rows = (length_ - 2 + threads_ - 1) / threads_;
+  const auto first = std::min(1 + band * rows, length_ - 1);
+  const auto last = std::min(first + rows, length_ - 1);
+
+  for (size_t i = 0; i < hydraulic; ++i) {
+    for (auto y = first; y < last; ++y) {
+      Flux(y);
+    }
+    barrier_.Wait();
+    for (auto y = first; y < last; ++y) {
+      Water(y, sediment_[i % 2].data());
+    }
+    barrier_.Wait();
+    for (auto y = first; y < last; ++y) {
+      Advect(y, sediment_[i % 2].data(), sediment_[(i + 1) % 2].data());
+    }
+    barrier_.Wait();
+  }
+
+  // Whatever is still suspended settles where it is
+  const auto &sediment = sediment_[hydraulic % 2];
+  for (auto i = first * width_; i < last * width_; ++i) {
+    height_[i] += sediment[i];
+  }
+  barrier_.Wait();
+
+  // Then slopes left too steep by the water collapse, reusing the pipes
+  for (size_t i = 0; i < thermal; ++i) {
+    for (auto y = first; y < last; ++y) {
+      ThermalOutflow(y);
+    }
+    barrier_.Wait();
+    for (auto y = first; y < last; ++y) {
+      ThermalApply(y);
+    }
+    barrier_.Wait();
+  }
+}
+
+// Material above the talus slope from each neighbour slides towards it, in
+// proportion to how far over the slope it is
+void Erosion::ThermalOutflow(const size_t y) {
+  const auto h = height_ + y * width_;
+  const auto up = h - width_;
+  const auto down = h + width_;
+  const auto offset = y * width_;
+  float *out[4];
+  for (size_t i = 0; i < 4; ++i) {
+    out[i] = flux_[i].data() + offset;
+  }
+  size_t x = 1;
+
+#ifdef __SSE2__
+  if (simd_) {
+    const auto talus = _mm_set1_ps(kTalus);
+    const auto rate = _mm_set1_ps(kThermalRate);
+    const auto zero = _mm_setzero_ps();
+    const auto epsilon = _mm_set1_ps(kEpsilon);
+    for (; x + 4 <= width_ - 1; x += 4) {
+      const auto c = _mm_loadu_ps(h + x);
+      __m128 e[4];
+      e[0] = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(c, _mm_loadu_ps(h + x - 1)),
+                                   talus),
+                        zero);
+      e[1] = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(c, _mm_loadu_ps(h + x + 1)),
+                                   talus),
+                        zero);
+      e[2] = _mm_max_ps(
+          _mm_sub_ps(_mm_sub_ps(c, _mm_loadu_ps(up + x)), talus), zero);
+      e[3] = _mm_max_ps(
+          _mm_sub_ps(_mm_sub_ps(c, _mm_loadu_ps(down + x)), talus), zero);
+      const auto sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(e[0], e[1]), e[2]),
+                                  e[3]);
+      const auto most =
+          _mm_max_ps(_mm_max_ps(e[0], e[1]), _mm_max_ps(e[2], e[3]));
+      const auto scale = _mm_div_ps(_mm_mul_ps(rate, most),
+                                    _mm_max_ps(sum, epsilon));
+      for (size_t i = 0; i < 4; ++i) {
+        _mm_storeu_ps(out[i] + x, _mm_mul_ps(e[i], scale));
+      }
+    }
+  }
+#endif
+
+  for (; x < width_ - 1; ++x) {
+    const auto c = h[x];
+    float e[4];
+    e[0] = Max(c - h[x - 1] - kTalus, 0);
+    e[1] = Max(c - h[x + 1] - kTalus, 0);
+    e[2] = Max(c - up[x] - kTalus, 0);
+    e[3] = Max(c - down[x] - kTalus, 0);
+    const auto sum = e[0] + e[1] + e[2] + e[3];
+    const auto most = Max(Max(e[0], e[1]), Max(e[2], e[3]));
+    const auto scale = kThermalRate * most / Max(sum, kEpsilon);
+    for (size_t i = 0; i < 4; ++i) {
+      out[i][x] = e[i] * scale;
+    }
+  }
+}
+
+void Erosion::ThermalApply(const size_t y) {
+  const auto h = height_ + y * width_;
+  const auto offset = y * width_;
+  const auto to_x0 = flux_[0].data() + offset;
+  const auto to_x1 = flux_[1].data() + offset;
+  const auto to_y0 = flux_[2].data() + offset;
+  const auto to_y1 = flux_[3].data() + offset;
+  // Flows into this row from the rows above and below
+  const auto from_y0 = to_y1 - width_;
+  const auto from_y1 = to_y0 + width_;
+  size_t x = 1;
+
+#ifdef __SSE2__
+  if (simd_) {
+    for (; x + 4 <= width_ - 1; x += 4) {
+      const auto in = _mm_add_ps(
+          _mm_add_ps(_mm_loadu_ps(to_x1 + x - 1), _mm_loadu_ps(to_x0 + x + 1)),
+          _mm_add_ps(_mm_loadu_ps(from_y0 + x), _mm_loadu_ps(from_y1 + x)));
+      const auto out = _mm_add_ps(
+          _mm_add_ps(_mm_loadu_ps(to_x0 + x), _mm_loadu_ps(to_x1 + x)),
+          _mm_add_ps(_mm_loadu_ps(to_y0 + x), _mm_loadu_ps(to_y1 + x)));
+      _mm_storeu_ps(h + x,
+                    _mm_add_ps(_mm_loadu_ps(h + x), _mm_sub_ps(in, out)));
+    }
+  }
+#endif
+
+  for (; x < width_ - 1; ++x) {
+    const auto in = (to_x1[x - 1] + to_x0[x + 1]) + (from_y0[x] + from_y1[x]);
+    const auto out = (to_x0[x] + to_x1[x]) + (to_y0[x] + to_y1[x]);
+    h[x] += in - out;
+  }
+}
+
+// Accelerates the water in each pipe by the difference in surface height, then
+// scales every outflow down so no cell loses more water than it has. Also
+// records the tilt of the ground while the neighbouring heights are at hand.
+void Erosion::Flux(const size_t y) {
+  const auto offset = y * width_;
+  const auto h = height_ + offset;
+  const auto w = water_.data() + offset;
+  const float *neighbour_h[4]{h - 1, h + 1, h - width_, h + width_};
+  const float *neighbour_w[4]{w - 1, w + 1, w - width_, w + width_};
+  float *out[4];
+  for (size_t i = 0; i < 4; ++i) {
+    out[i] = flux_[i].data() + offset;
+  }
+  const auto tilt = tilt_.data() + offset;
+  size_t x = 1;
+
+#ifdef __SSE2__
+  if (simd_) {
+    const auto pipe = _mm_set1_ps(kPipe);
+    const auto zero = _mm_setzero_ps();
+    const auto one = _mm_set1_ps(1);
+    const auto half = _mm_set1_ps(0.5f);
+    const auto epsilon = _mm_set1_ps(kEpsilon);
+    for (; x + 4 <= width_ - 1; x += 4) {
+      const auto water = _mm_loadu_ps(w + x);
+      const auto surface = _mm_add_ps(_mm_loadu_ps(h + x), water);
+      __m128 f[4];
+      for (size_t i = 0; i < 4; ++i) {
+        const auto neighbour = _mm_add_ps(_mm_loadu_ps(neighbour_h[i] + x),
+                                          _mm_loadu_ps(neighbour_w[i] + x));
+        f[i] = _mm_max_ps(
+            _mm_add_ps(_mm_loadu_ps(out[i] + x),
+                       _mm_mul_ps(pipe, _mm_sub_ps(surface, neighbour))),
+            zero);
+      }
+      const auto sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(f[0], f[1]), f[2]),
+                                  f[3]);
+      const auto scale =
+          _mm_min_ps(_mm_div_ps(water, _mm_max_ps(sum, epsilon)), one);
+      for (size_t i = 0; i < 4; ++i) {
+        _mm_storeu_ps(out[i] + x, _mm_mul_ps(f[i], scale));
+      }
+
+      const auto gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(neighbour_h[1] + x),
+                                            _mm_loadu_ps(neighbour_h[0] + x)),
+                                 half);
+      const auto gy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(neighbour_h[3] + x),
+                                            _mm_loadu_ps(neighbour_h[2] + x)),
+                                 half);
+      const auto g2 = _mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy));
+      _mm_storeu_ps(tilt + x,
+                    _mm_sqrt_ps(_mm_div_ps(g2, _mm_add_ps(one, g2))));
+    }
+  }
+#endif
+
+  for (; x < width_ - 1; ++x) {
+    const auto surface = h[x] + w[x];
+    float f[4];
+    for (size_t i = 0; i < 4; ++i) {
+      const auto neighbour = neighbour_h[i][x] + neighbour_w[i][x];
+      f[i] = Max(out[i][x] + kPipe * (surface - neighbour), 0);
+    }
+    const auto sum = f[0] + f[1] + f[2] + f[3];
+    const auto scale = Min(w[x] / Max(sum, kEpsilon), 1);
+    for (size_t i = 0; i < 4; ++i) {
+      out[i][x] = f[i] * scale;
+    }
+
+    const auto gx = (neighbour_h[1][x] - neighbour_h[0][x]) * 0.5f;
+    const auto gy = (neighbour_h[3][x] - neighbour_h[2][x]) * 0.5f;
+    const auto g2 = gx * gx + gy * gy;
+    // Sine of the angle of the ground
+    tilt[x] = sqrt(g2 / (1 + g2));
+  }
+}
+
+// Moves the water through the pipes, then dissolves or deposits sediment
+// depending on how much the water flowing through the cell can carry
+void Erosion::Water(const size_t y, float *sediment) {
+  const auto offset = y * width_;
+  const auto h = height_ + offset;
+  const auto w = water_.data() + offset;
+  const auto s = sediment + offset;
+  const auto to_x0 = flux_[0].data() + offset;
+  const auto to_x1 = flux_[1].data() + offset;
+  const auto to_y0 = flux_[2].data() + offset;
+  const auto to_y1 = flux_[3].data() + offset;
+  const auto from_y0 = to_y1 - width_;
+  const auto from_y1 = to_y0 + width_;
+  const auto tilt = tilt_.data() + offset;
+  const auto u = velocityX_.data() + offset;
+  const auto v = velocityY_.data() + offset;
+  constexpr auto kRetained = 1 - kEvaporation;
+  size_t x = 1;
+
+#ifdef __SSE2__
+  if (simd_) {
+    const auto zero = _mm_setzero_ps();
+    const auto half = _mm_set1_ps(0.5f);
+    const auto epsilon = _mm_set1_ps(kEpsilon);
+    const auto max_velocity = _mm_set1_ps(kMaxVelocity);
+    const auto min_velocity = _mm_set1_ps(-kMaxVelocity);
+    const auto capacity_scale = _mm_set1_ps(kCapacity);
+    const auto min_tilt = _mm_set1_ps(kMinTilt);
+    const auto dissolve = _mm_set1_ps(kDissolve);
+    const auto deposit = _mm_set1_ps(kDeposit);
+    const auto retained = _mm_set1_ps(kRetained);
+    const auto rain = _mm_set1_ps(kRain);
+    for (; x + 4 <= width_ - 1; x += 4) {
+      const auto in_x0 = _mm_loadu_ps(to_x1 + x - 1);
+      const auto in_x1 = _mm_loadu_ps(to_x0 + x + 1);
+      const auto in_y0 = _mm_loadu_ps(from_y0 + x);
+      const auto in_y1 = _mm_loadu_ps(from_y1 + x);
+      const auto out_x0 = _mm_loadu_ps(to_x0 + x);
+      const auto out_x1 = _mm_loadu_ps(to_x1 + x);
+      const auto out_y0 = _mm_loadu_ps(to_y0 + x);
+      const auto out_y1 = _mm_loadu_ps(to_y1 + x);
+      const auto in =
+          _mm_add_ps(_mm_add_ps(in_x0, in_x1), _mm_add_ps(in_y0, in_y1));
+      const auto out =
+          _mm_add_ps(_mm_add_ps(out_x0, out_x1), _mm_add_ps(out_y0, out_y1));
+      const auto w0 = _mm_loadu_ps(w + x);
+      const auto w1 = _mm_max_ps(_mm_add_ps(w0, _mm_sub_ps(in, out)), zero);
+      const auto depth =
+          _mm_max_ps(_mm_mul_ps(_mm_add_ps(w0, w1), half), epsilon);
+      const auto du = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(in_x0, out_x0),
+                                            _mm_sub_ps(out_x1, in_x1)),
+                                 half);
+      const auto dv = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(in_y0, out_y0),
+                                            _mm_sub_ps(out_y1, in_y1)),
+                                 half);
+      const auto uu = _mm_min_ps(
+          _mm_max_ps(_mm_div_ps(du, depth), min_velocity), max_velocity);
+      const auto vv = _mm_min_ps(
+          _mm_max_ps(_mm_div_ps(dv, depth), min_velocity), max_velocity);
+      _mm_storeu_ps(u + x, uu);
+      _mm_storeu_ps(v + x, vv);
+
+      const auto speed =
+          _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(uu, uu), _mm_mul_ps(vv, vv)));
+      const auto capacity = _mm_mul_ps(
+          _mm_mul_ps(capacity_scale,
+                     _mm_max_ps(_mm_loadu_ps(tilt + x), min_tilt)),
+          speed);
+      const auto carried = _mm_loadu_ps(s + x);
+      const auto eroding = _mm_cmpgt_ps(capacity, carried);
+      const auto rate = _mm_or_ps(_mm_and_ps(eroding, dissolve),
+                                  _mm_andnot_ps(eroding, deposit));
+      const auto delta = _mm_mul_ps(_mm_sub_ps(capacity, carried), rate);
+      _mm_storeu_ps(h + x, _mm_sub_ps(_mm_loadu_ps(h + x), delta));
+      _mm_storeu_ps(s + x, _mm_add_ps(carried, delta));
+      _mm_storeu_ps(w + x, _mm_add_ps(_mm_mul_ps(w1, retained), rain));
+    }
+  }
+#endif
+
+  for (; x < width_ - 1; ++x) {
+    const auto in_x0 = to_x1[x - 1];
+    const auto in_x1 = to_x0[x + 1];
+    const auto in_y0 = from_y0[x];
+    const auto in_y1 = from_y1[x];
+    const auto in = (in_x0 + in_x1) + (in_y0 + in_y1);
+    const auto out = (to_x0[x] + to_x1[x]) + (to_y0[x] + to_y1[x]);
+    const auto w0 = w[x];
+    const auto w1 = Max(w0 + (in - out), 0);
+    const auto depth = Max((w0 + w1) * 0.5f, kEpsilon);
+    // Average flow through the cell along each axis
+    const auto du = ((in_x0 - to_x0[x]) + (to_x1[x] - in_x1)) * 0.5f;
+    const auto dv = ((in_y0 - to_y0[x]) + (to_y1[x] - in_y1)) * 0.5f;
+    u[x] = Min(Max(du / depth, -kMaxVelocity), kMaxVelocity);
+    v[x] = Min(Max(dv / depth, -kMaxVelocity), kMaxVelocity);
+
+    const auto speed = sqrt(u[x] * u[x] + v[x] * v[x]);
+    const auto capacity = kCapacity * Max(tilt[x], kMinTilt) * speed;
+    const auto carried = s[x];
+    const auto delta =
+        (capacity - carried) * (capacity > carried ? kDissolve : kDeposit);
+    h[x] -= delta;
+    s[x] = carried + delta;
+    w[x] = w1 * kRetained + kRain;
+  }
+}
+
+// Carries the sediment along with the water, taking it from wherever the
+// water in each cell came from this step
+void Erosion::Advect(const size_t y, const float *source, float *destination) {
+  const auto offset = y * width_;
+  const auto u = velocityX_.data() + offset;
+  const auto v = velocityY_.data() + offset;
+  for (size_t x = 1; x < width_ - 1; ++x) {
+    // The cell the water came from and the blend towards the next one only
+    // depend on the velocity, never on where the rectangle starts, so every
+    // tile rounds the same way
+    const auto cell_x = u[x] > 0 ? x - 1 : x;
+    const auto cell_y = v[x] > 0 ? y - 1 : y;
+    const auto blend_x = u[x] > 0 ? 1 - u[x] : -u[x];
+    const auto blend_y = v[x] > 0 ? 1 - v[x] : -v[x];
+    const auto low = source + cell_x + cell_y * width_;
+    const auto high = low + width_;
+    const auto top = low[0] + blend_x * (low[1] - low[0]);
+    const auto bottom = high[0] + blend_x * (high[1] - high[0]);
+    destination[offset + x] = top + blend_y * (bottom - top);
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Thermal and grid based hydraulic erosion of a rectangle of row-major
+// heights. Every pass is a stencil that reads the previous pass and writes its
+// own rows only, split into bands of rows over a number of threads, so the
+// result is the same for any thread count and with or without SIMD.
+//
+// Cells on the edge of the rectangle have no outside neighbours, so what they
+// hold becomes wrong, and that spreads inwards by up to Halo(thermal,
+// hydraulic) cells. A tile eroded with a halo that wide around it matches the
+// tiles next to it exactly.
+class Erosion {
+ public:
+  Erosion(std::size_t width, std::size_t length, std::size_t threads,
+          bool simd = true);
+
+  static constexpr std::size_t Halo(std::size_t thermal,
+                                    std::size_t hydraulic) {
+    return 2 * thermal + 3 * hydraulic;
+  }
+
+  void Run(float *, std::size_t, std::size_t);
+
+ private:
+  void Work(std::size_t, std::size_t, std::size_t);
+
+  // Each pass over a single row
+  void ThermalOutflow(std::size_t);
+  void ThermalApply(std::size_t);
+  void Flux(std::size_t);
+  void Water(std::size_t, float *);
+  void Advect(std::size_t, const float *, float *);
+
+  std::size_t width_;
+  std::size_t length_;
+  std::size_t threads_;
+  bool simd_;
+
+  float *height_{nullptr};
+  std::vector<float> water_;
+  std::vector<float> sediment_[2];
+  // Outflow towards the neighbour at x - 1, x + 1, y - 1 and y + 1, the
+  // thermal stage moves material through the same pipes as the water
+  std::vector<float> flux_[4];
+  std::vector<float> velocityX_;
+  std::vector<float> velocityY_;
+  std::vector<float> tilt_;
+  Barrier barrier_;
+};
@@ -0,0 +1,72 @@
+#include <sys/resource.h>
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "arguments.h"
+#include "constants.h"
+#include "noise_engine.h"
+#include "terrain_exporter.h"
+
+using namespace std;
+
+// Terrain exporter, runs without a window or GL context.
+// Usage: perlin-shadows-export raw|png|obj|gltf path [seed [tiles_x tiles_y
+//        [perlin|simplex|value]]]
+
+static void PrintUsage(const char *program) {
+  cerr << "Usage: " << program
+       << " raw|png|obj|gltf path [seed [tiles_x tiles_y "
+          "[perlin|simplex|value]]]\n";
+}
+
+int main(int argc, char *argv[]) {
+  ExportFormat format;
+  auto noise = NoiseType::kPerlin;
+  unsigned long seed = 0;
+  auto tiles_x = static_cast<int>(kGeographyCountShort);
+  auto tiles_y = static_cast<int>(kGeographyCountLong);
+  if (argc < 3 || argc == 5 || argc > 7 ||
+      !ParseExportFormat(argv[1], &format) ||
+      (argc > 3 && !ParseUnsigned(argv[3], &seed)) ||
+      (argc > 4 && (!ParseInt(argv[4], &tiles_x) ||
+                    !ParseInt(argv[5], &tiles_y))) ||
+      (argc == 7 && !ParseNoise(argv[6], &noise)) || tiles_x <= 0 ||
+      tiles_y <= 0) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  try {
+    const auto threads = max<size_t>(thread::hardware_concurrency(), 1);
+    cout << "Seed: " << seed << ", " << NoiseName(noise) << " noise, "
+         << tiles_x << "x" << tiles_y << " tiles on " << threads
+         << " threads\n";
+    const auto stats = TerrainExporter(seed, noise, tiles_x, tiles_y, threads)
+                           .Export(format, argv[2]);
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    cout << "       vertices: " << stats.width << "x" << stats.length << "\n";
+    cout << "        heights: " << stats.min << " to " << stats.max << "\n";
+    if (strcmp(argv[1], "raw") == 0 || strcmp(argv[1], "png") == 0) {
+      cout << "   16-bit range: " << -kExportHeightRange << " to "
+           << kExportHeightRange << (strcmp(argv[1], "raw") == 0
+                                         ? ", little-endian\n"
+                                         : "\n");
+    }
+    cout << fixed << setprecision(1) << "        written: "
+         << stats.bytes / 1e6 << "MB in " << setprecision(2) << stats.seconds
+         << "s, " << setprecision(1) << stats.bytes / 1e6 / stats.seconds
+         << "MB/s\n";
+    // Reported in KiB on Linux
+    cout << "       peak RSS: " << usage.ru_maxrss / 1024 << "MiB\n";
+  } catch (const exception &error) {
+    cerr << error.what() << endl;
+    return 1;
+  }
+  return 0;
+}
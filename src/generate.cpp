@@ -0,0 +1,389 @@
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "arguments.h"
+#include "constants.h"
+#include "grid.h"
+#include "noise_engine.h"
+#include "noise_field.h"
+#include "thread_pool.h"
+#include "tile_cache.h"
+#include "tile_generator.h"
+#include "tile_store.h"
+
+using namespace std;
+
+// Batch tile generator, runs without a window or GL context. Fills the tile
+// cache for tiles [x0, x1) x [y0, y1) so the renderer maps them instead of
+// generating them.
+// Usage: perlin-shadows-generate [-p processes] [-r command]... x0 y0 x1 y1
+//        [seed [perlin|simplex|value]]
+//
+// Without options tiles are generated on threads and written as separate
+// files. With -p and -r a coordinator hands tiles out to worker processes
+// instead, -p local ones and one per -r command (e.g. "ssh node1"), which all
+// write into the region's TileStore. Remote workers need the binary and the
+// store at the same paths, on a shared filesystem.
+
+// Tiles handed to each worker ahead of its results, so it never waits on the
+// coordinator
+constexpr size_t kWorkerQueue{2};
+
+struct Worker {
+  pid_t pid;
+  int socket;
+  std::string received;
+  // Tiles sent and not reported back yet
+  std::deque<std::pair<int, int>> pending;
+};
+
+// Each tile is generated on a single thread, tiles run side by side instead,
+// which scales better than splitting one tile over every thread
+static bool GenerateAndStore(const mt19937::result_type seed,
+                             const NoiseType noise, const NoiseField &field,
+                             const int x, const int y) {
+  Grid height, slope_x, slope_y;
+  GenerateTile(field, x, y, 1, height.data(), slope_x.data(), slope_y.data());
+
+  TileCache cache(x, y);
+  if (!cache.BeginStore(seed, noise, height.min(), height.max())) {
+    return false;
+  }
+  vector<Vertex> block(kGeographyShort * kMeshBlockRows);
+  for (size_t row = 0; row < kGeographyLong; row += kMeshBlockRows) {
+    const auto rows = std::min(kMeshBlockRows, kGeographyLong - row);
+    height.WriteVertices(slope_x, slope_y, block.data(), row, rows);
+    cache.StoreVertices(block.data(), rows * kGeographyShort);
+  }
+  return cache.EndStore();
+}
+
+// Generates the tiles of the store named on the command line as they arrive
+// on stdin, one "x y" per line, and reports each back on stdout as "x y ok" or
+// "x y failed". Every tile depends only on the seed, noise and its position,
+// so the store ends up the same however the tiles are split between workers.
+static int RunWorker(const string &path) {
+  TileStore store;
+  if (!store.Open(path)) {
+    cerr << "Could not open tile store " << path << endl;
+    return 1;
+  }
+  const NoiseField field(store.seed(), store.noise());
+  int x, y;
+  while (cin >> x >> y) {
+    cout << x << " " << y << (store.Generate(field, x, y) ? " ok" : " failed")
+         << endl;
+  }
+  return 0;
+}
+
+// Runs a worker on a socket standing in for its stdin and stdout, locally when
+// the command is empty and through the shell after the command otherwise
+static bool Spawn(const string &command, const string &self,
+                  const string &store, Worker *worker) {
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) {
+    return false;
+  }
+  const auto line = command + " '" + self + "' --worker '" + store + "'";
+  const auto pid = fork();
+  if (pid == 0) {
+    dup2(sockets[1], STDIN_FILENO);
+    dup2(sockets[1], STDOUT_FILENO);
+    close(sockets[0]);
+    close(sockets[1]);
+    if (command.empty()) {
+      execl("/proc/self/exe", self.c_str(), "--worker", store.c_str(),
+            nullptr);
+    } else {
+      execl("/bin/sh", "sh", "-c", line.c_str(), nullptr);
+    }
+    _exit(127);
+  }
+  close(sockets[1]);
+  if (pid == -1) {
+    close(sockets[0]);
+    return false;
+  }
+  worker->pid = pid;
+  worker->socket = sockets[0];
+  return true;
+}
+
+static bool Send(Worker *worker, const pair<int, int> &tile) {
+  const auto line =
+      to_string(tile.first) + " " + to_string(tile.second) + "\n";
+  if (send(worker->socket, line.data(), line.size(), MSG_NOSIGNAL) !=
+      static_cast<ssize_t>(line.size())) {
+    return false;
+  }
+  worker->pending.push_back(tile);
+  return true;
+}
+
+// Hands the tiles out a few at a time to whichever workers report back, and
+// hands the tiles of any worker that exits early to the others. Returns how
+// many tiles were not generated.
+static size_t Coordinate(const vector<pair<int, int>> &tiles,
+                         vector<Worker> *workers) {
+  deque<pair<int, int>> queue(tiles.begin(), tiles.end());
+  size_t failed = 0;
+  const auto retire = [&](Worker *worker) {
+    queue.insert(queue.begin(), worker->pending.begin(),
+                 worker->pending.end());
+    worker->pending.clear();
+    close(worker->socket);
+    worker->socket = -1;
+  };
+  const auto top_up = [&] {
+    for (auto &worker : *workers) {
+      while (worker.socket != -1 && !queue.empty() &&
+             worker.pending.size() < kWorkerQueue) {
+        const auto tile = queue.front();
+        queue.pop_front();
+        if (!Send(&worker, tile)) {
+          queue.push_front(tile);
+          retire(&worker);
+        }
+      }
+    }
+  };
+
+  top_up();
+  for (;;) {
+    vector<pollfd> polls;
+    vector<Worker *> polled;
+    for (auto &worker : *workers) {
+      if (worker.socket != -1 && !worker.pending.empty()) {
+        polls.push_back({worker.socket, POLLIN, 0});
+        polled.push_back(&worker);
+      }
+    }
+    if (polls.empty()) {
+      break;
+    }
+    if (poll(polls.data(), polls.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    for (size_t i = 0; i < polls.size(); ++i) {
+      if (polls[i].revents == 0) {
+        continue;
+      }
+      const auto worker = polled[i];
+      char buffer[4096];
+      const auto count = read(worker->socket, buffer, sizeof(buffer));
+      if (count <= 0) {
+        cerr << "Worker " << worker->pid << " stopped with "
+             << worker->pending.size() << " tiles outstanding" << endl;
+        retire(worker);
+        continue;
+      }
+      worker->received.append(buffer, static_cast<size_t>(count));
+      size_t end;
+      while ((end = worker->received.find('\n')) != string::npos) {
+        int x, y;
+        char status[8] = {};
+        if (sscanf(worker->received.c_str(), "%d %d %7s", &x, &y, status) !=
+            3) {
+          x = y = INT_MIN;
+        }
+        worker->received.erase(0, end + 1);
+        const auto tile = find(worker->pending.begin(), worker->pending.end(),
+                               make_pair(x, y));
+        if (tile != worker->pending.end()) {
+          worker->pending.erase(tile);
+          failed += strcmp(status, "ok") != 0;
+        }
+      }
+    }
+    top_up();
+  }
+
+  for (auto &worker : *workers) {
+    if (worker.socket != -1) {
+      close(worker.socket);
+    }
+    waitpid(worker.pid, nullptr, 0);
+  }
+  return failed + queue.size();
+}
+
+static void PrintStats(const size_t written, const double seconds,
+                       const string &destination) {
+  const auto vertices = static_cast<double>(written) * kTotalVertices;
+  const auto bytes =
+      written * (sizeof(TileHeader) + kTotalVertices * sizeof(Vertex));
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  cout << fixed << setprecision(2) << "        written: " << written
+       << " tiles to " << destination << " in " << seconds << "s\n";
+  if (seconds > 0) {
+    cout << setprecision(1) << "     throughput: " << written / seconds
+         << " tiles/s, " << vertices / 1e6 / seconds << "M vertices/s, "
+         << bytes / 1e6 / seconds << "MB/s\n";
+  }
+  // Reported in KiB on Linux, and only covers this process
+  cout << "       peak RSS: " << usage.ru_maxrss / 1024 << "MiB\n";
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 3 && strcmp(argv[1], "--worker") == 0) {
+    return RunWorker(argv[2]);
+  }
+
+  unsigned long processes = 0;
+  vector<string> remotes;
+  auto valid = true;
+  auto arg = 1;
+  for (; arg + 1 < argc; arg += 2) {
+    if (strcmp(argv[arg], "-p") == 0) {
+      valid = valid && ParseUnsigned(argv[arg + 1], &processes);
+    } else if (strcmp(argv[arg], "-r") == 0) {
+      remotes.push_back(argv[arg + 1]);
+    } else {
+      break;
+    }
+  }
+  auto noise = NoiseType::kPerlin;
+  int x0, y0, x1, y1;
+  unsigned long seed = 0;
+  if (!valid || argc - arg < 4 || argc - arg > 6 ||
+      !ParseInt(argv[arg], &x0) || !ParseInt(argv[arg + 1], &y0) ||
+      !ParseInt(argv[arg + 2], &x1) || !ParseInt(argv[arg + 3], &y1) ||
+      (argc - arg > 4 && !ParseUnsigned(argv[arg + 4], &seed)) ||
+      (argc - arg == 6 && !ParseNoise(argv[arg + 5], &noise))) {
+    cerr << "Usage: " << argv[0]
+         << " [-p processes] [-r command]... x0 y0 x1 y1 "
+            "[seed [perlin|simplex|value]]\n";
+    return 1;
+  }
+  if (x1 <= x0 || y1 <= y0) {
+    cerr << "Empty region\n";
+    return 1;
+  }
+
+  if (processes != 0 || !remotes.empty()) {
+    TileStore store;
+    if (!store.Open(seed, noise, x0, y0, x1, y1)) {
+      return 1;
+    }
+    vector<pair<int, int>> tiles;
+    for (auto y = y0; y < y1; ++y) {
+      for (auto x = x0; x < x1; ++x) {
+        if (!store.Complete(x, y)) {
+          tiles.emplace_back(x, y);
+        }
+      }
+    }
+    const auto cached =
+        static_cast<size_t>(x1 - x0) * static_cast<size_t>(y1 - y0) -
+        tiles.size();
+    store.Close();
+
+    const auto relative = TileCache::StorePath(seed, noise);
+    char *absolute = realpath(relative.c_str(), nullptr);
+    const string path = absolute != nullptr ? absolute : relative;
+    free(absolute);
+    vector<string> commands(processes);
+    commands.insert(commands.end(), remotes.begin(), remotes.end());
+    vector<Worker> workers;
+    for (const auto &command : tiles.empty() ? vector<string>() : commands) {
+      Worker worker{};
+      if (Spawn(command, argv[0], path, &worker)) {
+        workers.push_back(move(worker));
+      } else {
+        cerr << "Could not start worker " << command << endl;
+      }
+    }
+    cout << "Seed: " << seed << ", " << NoiseName(noise) << " noise, "
+         << tiles.size() << " tiles to generate (" << cached
+         << " already stored) on " << workers.size() << " processes\n";
+
+    const auto start = chrono::steady_clock::now();
+    const auto failed = Coordinate(tiles, &workers);
+    const auto seconds =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    PrintStats(tiles.size() - failed, seconds, relative);
+    if (failed != 0) {
+      cerr << failed << " tiles could not be generated\n";
+      return 1;
+    }
+    return 0;
+  }
+
+  const NoiseField field(seed, noise);
+  vector<pair<int, int>> tiles;
+  size_t cached = 0;
+  for (auto y = y0; y < y1; ++y) {
+    for (auto x = x0; x < x1; ++x) {
+      if (TileCache(x, y).Load(seed, noise)) {
+        ++cached;
+      } else {
+        tiles.emplace_back(x, y);
+      }
+    }
+  }
+  const auto threads =
+      std::min(max<size_t>(thread::hardware_concurrency(), 1),
+               max<size_t>(tiles.size(), 1));
+  cout << "Seed: " << seed << ", " << NoiseName(noise) << " noise, "
+       << tiles.size() << " tiles to generate (" << cached
+       << " already cached) on " << threads << " threads\n";
+
+  const auto start = chrono::steady_clock::now();
+  atomic<size_t> failed{0};
+  size_t remaining = tiles.size();
+  mutex done_mutex;
+  condition_variable done;
+  {
+    ThreadPool pool(threads);
+    for (const auto &tile : tiles) {
+      pool.Submit([&, tile] {
+        if (!GenerateAndStore(seed, noise, field, tile.first, tile.second)) {
+          ++failed;
+        }
+        lock_guard<mutex> lock(done_mutex);
+        if (--remaining == 0) {
+          done.notify_one();
+        }
+      });
+    }
+    unique_lock<mutex> lock(done_mutex);
+    done.wait(lock, [&] { return remaining == 0; });
+  }
+  const auto seconds =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  PrintStats(tiles.size() - failed, seconds,
+             string(kTileCacheDirectory) + "/");
+  if (failed != 0) {
+    cerr << failed << " tiles could not be written\n";
+    return 1;
+  }
+  return 0;
+}
@@ -1,80 +1,472 @@
 #include "geography.h"
 
-#include <queue>
-#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <list>
+#include <mutex>
 #include <vector>
 
 #include "constants.h"
 #include "grid.h"
+#include "noise_field.h"
+#include "normal_map.h"
+#include "terrain_mesh.h"
+#include "tile_generator.h"
 
 using namespace std;
 
-Geography::Geography(int x, int y) : Renderable(true), x_(x), y_(y) {
-  Randomize(false);
+atomic<float> Geography::meshError_{kMeshError};
+atomic<uint64_t> Geography::serials_{0};
+list<Geography *> Geography::hot_;
+mutex Geography::hotMutex_;
+
+Geography::Geography(int x, int y, mt19937::result_type seed,
+                     NoiseType noise)
+    : Renderable(true), cache_(x, y), x_(x), y_(y), serial_(serials_++) {
+  Randomize(seed, noise);
   model_ = glm::translate(
       glm::identity<glm::mat4>(),
-      glm::vec3(x * (kGeographyShort - 1), y * (kGeographyLong - 1), 0));
+      glm::vec3(static_cast<float>(x) * (kGeographyShort - 1),
+                static_cast<float>(y) * (kGeographyLong - 1), 0));
+}
+
+Geography::~Geography() {
+  // Prepared data may never have been uploaded if the tile was streamed out
+  FreeData();
+  CleanUp();
+  if (normalMap_ != 0) {
+    glDeleteTextures(1, &normalMap_);
+  }
+  if (occlusionMap_ != 0) {
+    glDeleteTextures(1, &occlusionMap_);
+  }
 }
 
-Geography::~Geography() { CleanUp(); }
+void Geography::Randomize(mt19937::result_type seed, NoiseType noise) {
+  // A cache hit skips generation entirely, the heights are recovered from the
+  // mapped vertices and the vertices themselves are uploaded in SetData
+  seed_ = seed;
+  noise_ = noise;
+  if (kUseTileCache && cache_.Load(seed, noise)) {
+    const auto vertices = cache_.vertices();
+    for (size_t i = 0; i < kTotalVertices; ++i) {
+      height_->data()[i] = vertices[i].position.z;
+    }
+    min_ = cache_.min();
+    max_ = cache_.max();
+    // The maps are baked from slopes, which the cached normals give back
+    if (kNormalMaps) {
+      slopeX_.reset(new Grid());
+      slopeY_.reset(new Grid());
+      for (size_t i = 0; i < kTotalVertices; ++i) {
+        const auto &normal = vertices[i].normal;
+        slopeX_->data()[i] = -normal.x / normal.z;
+        slopeY_->data()[i] = -normal.y / normal.z;
+      }
+      BakeMaps();
+    }
+    return;
+  }
 
-// Sums Perlin noise on a variety of factors, then stores the result in results
-// Note: Frees factors
-void CalculatePerlinNoise(queue<Grid *> *results, int x, int y,
-                          vector<size_t> *factors) {
-  auto grid = new Grid();
-  for (const auto factor : *factors) {
-    const auto noise = Grid::PerlinNoise(x, y, kDetail >> factor);
-    (*grid) += (*noise) / static_cast<float>(1 << factor);
-    delete noise;
+  slopeX_.reset(new Grid());
+  slopeY_.reset(new Grid());
+  GenerateTile(NoiseField(seed, noise), x_, y_, kMaxThreads, height_->data(),
+               slopeX_->data(), slopeY_->data());
+
+  min_ = height_->min();
+  max_ = height_->max();
+  if (kNormalMaps) {
+    BakeMaps();
   }
-  results->push(grid);
-  delete factors;
 }
 
-void Geography::Randomize(bool load) {
-  if (load) {
-    CleanUp();
+// Runs on whichever thread prepares the tile, splitting each map over
+// kMaxThreads like generation
+void Geography::BakeMaps() {
+  normalTexels_.resize(kNormalMapBytes);
+  BakeNormalMap(slopeX_->data(), slopeY_->data(), kMaxThreads,
+                normalTexels_.data());
+  if (kBakeOcclusion) {
+    occlusionTexels_.resize(kOcclusionMapBytes);
+    BakeOcclusionMap(height_->data(), kMaxThreads, occlusionTexels_.data());
   }
-  height_ = Grid();
+}
 
-  queue<Grid *> results;
-  queue<thread *> threads;
-  // Set up one thread for each noise scale
-  for (size_t i = 0; i < kMaxThreads; ++i) {
-    auto factors = new vector<size_t>();
-    for (size_t factor = 0; (kDetail >> factor) > kMinDetail;
-         factor += kMaxThreads) {
-      factors->push_back(factor + i);
+static_assert(!kAdaptiveMesh || kNormalMaps || TerrainMesh::Supported(),
+              "The adaptive mesh needs square tiles of 2^n + 1 vertices");
+static_assert((kGeographyShort - 1) % kNormalMapStride == 0 &&
+                  (kGeographyLong - 1) % kNormalMapStride == 0,
+              "The coarse mesh has to end on the edges of the tile");
+
+static_assert((kGeographyShort - 1) % kOcclusionBlocks == 0 &&
+                  (kGeographyLong - 1) % kOcclusionBlocks == 0,
+              "Occluder blocks have to divide the tile evenly");
+static_assert((kGeographyShort - 1) / kOcclusionBlocks % kNormalMapStride ==
+                      0 &&
+                  (kGeographyLong - 1) / kOcclusionBlocks % kNormalMapStride ==
+                      0,
+              "Cells of the coarse mesh have to lie within one block");
+
+// Goes by the triangles actually drawn, a large triangle of the adaptive mesh
+// can pass over a block lower or higher than any of the heights inside it. The
+// coarse mesh only interpolates heights of the block it lies in, so the cells
+// underneath bound it as well. Decoded cold heights may be off by up to
+// CompressedHeights::Error from the uploaded ones, error widens the bounds by
+// that much.
+static void FindBlockBounds(const Grid &height,
+                            const vector<unsigned int> &mesh, const float error,
+                            vector<float> *block_low,
+                            vector<float> *block_high) {
+  constexpr auto block_short = (kGeographyShort - 1) / kOcclusionBlocks;
+  constexpr auto block_long = (kGeographyLong - 1) / kOcclusionBlocks;
+  block_low->assign(kOcclusionBlocks * kOcclusionBlocks,
+                    numeric_limits<float>::max());
+  block_high->assign(kOcclusionBlocks * kOcclusionBlocks,
+                     numeric_limits<float>::lowest());
+  // Widens every block touching cells [x0, x1) x [y0, y1) to [low, high]
+  const auto widen = [block_low, block_high, error](size_t x0, size_t y0,
+                                                    size_t x1, size_t y1,
+                                                    float low, float high) {
+    for (auto y = y0 / block_long; y <= (y1 - 1) / block_long; ++y) {
+      for (auto x = x0 / block_short; x <= (x1 - 1) / block_short; ++x) {
+        const auto block = x + y * kOcclusionBlocks;
+        (*block_low)[block] = std::min((*block_low)[block], low - error);
+        (*block_high)[block] = std::max((*block_high)[block], high + error);
+      }
+    }
+  };
+
+  if (kAdaptiveMesh && !kNormalMaps) {
+    for (size_t i = 0; i < mesh.size(); i += 3) {
+      size_t x0 = kGeographyShort, y0 = kGeographyLong, x1 = 0, y1 = 0;
+      auto low = numeric_limits<float>::max();
+      auto high = numeric_limits<float>::lowest();
+      for (size_t corner = i; corner < i + 3; ++corner) {
+        const auto x = mesh[corner] % kGeographyShort;
+        const auto y = mesh[corner] / kGeographyShort;
+        x0 = std::min(x0, x);
+        y0 = std::min(y0, y);
+        x1 = std::max(x1, x);
+        y1 = std::max(y1, y);
+        low = std::min(low, height.get(x, y));
+        high = std::max(high, height.get(x, y));
+      }
+      widen(x0, y0, x1, y1, low, high);
+    }
+  } else {
+    for (size_t y = 0; y < kGeographyLong - 1; ++y) {
+      for (size_t x = 0; x < kGeographyShort - 1; ++x) {
+        const auto corners = {height.get(x, y), height.get(x + 1, y),
+                              height.get(x, y + 1), height.get(x + 1, y + 1)};
+        widen(x, y, x + 1, y + 1, std::min(corners), std::max(corners));
+      }
     }
-    threads.push(new thread(CalculatePerlinNoise, &results, x_, y_, factors));
   }
+}
 
-  // Wait for thread completion
-  while (!threads.empty()) {
-    threads.front()->join();
-    threads.pop();
+// Runs on the thread preparing the tile, which also writes the tile cache so
+// upload never touches the disk. Unless the tile was mapped from the cache,
+// no vertex array is materialized and the mesh is instead written straight
+// into the mapped buffers on upload. The adaptive mesh only drops triangles,
+// every vertex is still uploaded.
+void Geography::SetData() {
+  vertexCount_ = kTileVertices;
+  vertices_ = cache_.loaded() && !kNormalMaps ? cache_.vertices() : nullptr;
+  if (kUseTileCache && !cache_.loaded()) {
+    StoreVertices();
   }
 
-  // Add up all noise levels
-  while (!results.empty()) {
-    auto grid = results.front();
-    height_ += *grid;
-    delete grid;
-    results.pop();
+  if (kNormalMaps) {
+    indexCount_ = (kCoarseShort - 1) * (kCoarseLong - 1) * kVerticesPerCell;
+  } else if (kAdaptiveMesh) {
+    meshedError_ = meshError_;
+    mesh_.clear();
+    TerrainMesh(height_->data()).Triangulate(meshedError_, &mesh_);
+    indexCount_ = static_cast<GLsizei>(mesh_.size());
+  } else {
+    indexCount_ = kTotalIndices;
+  }
+  indices_ = nullptr;
+  FindBlockBounds(*height_, mesh_, 0, &blockLow_, &blockHigh_);
+  if (kColdHeights && cold_->empty()) {
+    cold_->Encode(height_->data(), min_, max_);
   }
+}
 
-  height_ *= kHeightMultiplier;
+// Decoded tiles are only ever dropped here, on the thread using them, so a
+// tile still being prepared or uploaded keeps its heights until it is cooled
+const Grid &Geography::Decoded() {
+  if (!kColdHeights) {
+    return *height_;
+  }
+  lock_guard<mutex> lock(hotMutex_);
+  if (!cooled_) {
+    return *height_;
+  }
+  if (height_ == nullptr) {
+    height_.reset(new Grid());
+    cold_->Decode(height_->data());
+  }
+  hot_.remove(this);
+  hot_.push_front(this);
+  while (hot_.size() > kHotTiles) {
+    hot_.back()->height_.reset();
+    hot_.pop_back();
+  }
+  return *height_;
+}
 
-  if (load) {
-    InitGeom();
+// Drops the heights once the tile has been uploaded, Decoded brings them back
+void Geography::Cool() {
+  lock_guard<mutex> lock(hotMutex_);
+  hot_.remove(this);
+  if (!cold_->empty()) {
+    cooled_ = true;
+    height_.reset();
   }
 }
 
-void Geography::SetData() {
-  vertexCount_ = kTotalVertices;
-  vertices_ = height_.vertices()->data();
+// Cold heights that aren't hot are decoded by the job itself. The tile keeps
+// its heights and cold heights as they are once it has been prepared, so the
+// job can share them.
+function<void(Geography::Mesh *)> Geography::MeshJob(const float error) {
+  shared_ptr<const Grid> height;
+  {
+    lock_guard<mutex> lock(hotMutex_);
+    height = height_;
+  }
+  shared_ptr<const CompressedHeights> cold = cold_;
+  const auto widen = kColdHeights ? CompressedHeights::Error(min_, max_) : 0;
+  return [height, cold, error, widen](Mesh *mesh) {
+    auto decoded = height;
+    if (decoded == nullptr) {
+      const auto grid = make_shared<Grid>();
+      cold->Decode(grid->data());
+      decoded = grid;
+    }
+    mesh->error = error;
+    TerrainMesh(decoded->data()).Triangulate(error, &mesh->indices);
+    FindBlockBounds(*decoded, mesh->indices, widen, &mesh->blockLow,
+                    &mesh->blockHigh);
+  };
+}
+
+// Only the indices and the occluder bounds that follow the triangles change
+void Geography::UploadMesh(Mesh *mesh) {
+  mesh_.swap(mesh->indices);
+  indexCount_ = static_cast<GLsizei>(mesh_.size());
+  blockLow_.swap(mesh->blockLow);
+  blockHigh_.swap(mesh->blockHigh);
+  meshedError_ = mesh->error;
+  UploadIndices();
+  vector<unsigned int>().swap(mesh_);
+}
+
+glm::vec3 Geography::low() const {
+  return {static_cast<float>(x_) * (kGeographyShort - 1),
+          static_cast<float>(y_) * (kGeographyLong - 1), min_};
+}
+
+glm::vec3 Geography::high() const {
+  return {static_cast<float>(x_ + 1) * (kGeographyShort - 1),
+          static_cast<float>(y_ + 1) * (kGeographyLong - 1), max_};
+}
+
+// Blocks as they lie in the world
+static glm::vec3 BlockCorner(const glm::vec3 &origin, size_t x, size_t y,
+                             float z) {
+  return origin + glm::vec3(x * ((kGeographyShort - 1) / kOcclusionBlocks),
+                            y * ((kGeographyLong - 1) / kOcclusionBlocks), z);
+}
+
+void Geography::AddOccluders(OcclusionCuller *culler) const {
+  // Not prepared yet
+  if (blockLow_.empty()) {
+    return;
+  }
+  const auto origin = glm::vec3(low().x, low().y, 0);
+  for (size_t y = 0; y < kOcclusionBlocks; ++y) {
+    for (size_t x = 0; x < kOcclusionBlocks; ++x) {
+      culler->AddOccluder(BlockCorner(origin, x, y, min_),
+                          BlockCorner(origin, x + 1, y + 1,
+                                      blockLow_[x + y * kOcclusionBlocks]));
+    }
+  }
+}
+
+OcclusionCuller::Visibility Geography::Test(
+    const OcclusionCuller &culler) const {
+  const auto tile = culler.Test(low(), high());
+  if (tile != OcclusionCuller::Visibility::kVisible || blockLow_.empty()) {
+    return tile;
+  }
+  const auto origin = glm::vec3(low().x, low().y, 0);
+  for (size_t y = 0; y < kOcclusionBlocks; ++y) {
+    for (size_t x = 0; x < kOcclusionBlocks; ++x) {
+      const auto block = x + y * kOcclusionBlocks;
+      if (culler.Test(BlockCorner(origin, x, y, blockLow_[block]),
+                      BlockCorner(origin, x + 1, y + 1, blockHigh_[block])) ==
+          OcclusionCuller::Visibility::kVisible) {
+        return OcclusionCuller::Visibility::kVisible;
+      }
+    }
+  }
+  return OcclusionCuller::Visibility::kOccluded;
+}
+
+// Builds kMeshBlockRows rows at a time into a block that stays in cache and
+// appends it to the tile cache, so no more than the block is ever held
+void Geography::StoreVertices() {
+  if (!cache_.BeginStore(seed_, noise_, min_, max_)) {
+    return;
+  }
+  vector<Vertex> block(kGeographyShort * kMeshBlockRows);
+  for (size_t row = 0; row < kGeographyLong; row += kMeshBlockRows) {
+    const auto rows = std::min(kMeshBlockRows, kGeographyLong - row);
+    height_->WriteVertices(*slopeX_, *slopeY_, block.data(), row, rows);
+    cache_.StoreVertices(block.data(), rows * kGeographyShort);
+  }
+  cache_.EndStore();
+}
+
+// Builds the same blocks again, so the mapped (often write-combined) memory
+// only ever sees whole sequential writes. With kNormalMaps only the coarse
+// mesh is written, a vertex at a time.
+void Geography::WriteVertices(Vertex *vertices) {
+  if (!kNormalMaps) {
+    vector<Vertex> block(kGeographyShort * kMeshBlockRows);
+    for (size_t row = 0; row < kGeographyLong; row += kMeshBlockRows) {
+      const auto rows = std::min(kMeshBlockRows, kGeographyLong - row);
+      height_->WriteVertices(*slopeX_, *slopeY_, block.data(), row, rows);
+      memcpy(vertices + index(0, row), block.data(),
+             rows * kGeographyShort * sizeof(Vertex));
+    }
+    return;
+  }
+  for (size_t y = 0; y < kGeographyLong; y += kNormalMapStride) {
+    for (size_t x = 0; x < kGeographyShort; x += kNormalMapStride) {
+      const auto normal = glm::normalize(
+          glm::vec3(-slopeX_->get(x, y), -slopeY_->get(x, y), 1));
+      *vertices++ = {{x, y, height_->get(x, y)}, normal};
+    }
+  }
+}
 
-  indexCount_ = kTotalIndices;
-  indices_ = Grid::indices()->data();
+// Cells of the coarse mesh, split along the closer pair of heights like Grid
+// does
+static void WriteCoarseIndices(const Grid &height, unsigned int *indices) {
+  const auto coarse = [](size_t x, size_t y) {
+    return static_cast<unsigned int>(x + y * kCoarseShort);
+  };
+  for (size_t y = 0; y < kCoarseLong - 1; ++y) {
+    for (size_t x = 0; x < kCoarseShort - 1; ++x) {
+      const auto h00 = height.get(x * kNormalMapStride, y * kNormalMapStride);
+      const auto h01 =
+          height.get(x * kNormalMapStride, (y + 1) * kNormalMapStride);
+      const auto h10 =
+          height.get((x + 1) * kNormalMapStride, y * kNormalMapStride);
+      const auto h11 =
+          height.get((x + 1) * kNormalMapStride, (y + 1) * kNormalMapStride);
+      const auto i00 = coarse(x, y);
+      const auto i01 = coarse(x, y + 1);
+      const auto i10 = coarse(x + 1, y);
+      const auto i11 = coarse(x + 1, y + 1);
+      if (abs(h00 - h11) < abs(h01 - h10)) {
+        indices[0] = i00;
+        indices[1] = i01;
+        indices[2] = i11;
+        indices[3] = i00;
+        indices[4] = i11;
+        indices[5] = i10;
+      } else {
+        indices[0] = i00;
+        indices[1] = i01;
+        indices[2] = i10;
+        indices[3] = i10;
+        indices[4] = i01;
+        indices[5] = i11;
+      }
+      indices += kVerticesPerCell;
+    }
+  }
+}
+
+void Geography::WriteIndices(unsigned int *indices) {
+  if (kNormalMaps) {
+    WriteCoarseIndices(*height_, indices);
+  } else if (kAdaptiveMesh) {
+    memcpy(indices, mesh_.data(), mesh_.size() * sizeof(unsigned int));
+  } else {
+    height_->WriteIndices(indices, 0, kGeographyLong - 1);
+  }
+}
+
+void Geography::FreeData() {
+  // Mapped vertices belong to the cache rather than the heap
+  if (cache_.loaded()) {
+    if (vertices_ == cache_.vertices()) {
+      vertices_ = nullptr;
+    }
+    cache_.Unload();
+  }
+  slopeX_.reset();
+  slopeY_.reset();
+  vector<unsigned int>().swap(mesh_);
+  vector<uint8_t>().swap(normalTexels_);
+  vector<uint8_t>().swap(occlusionTexels_);
+  if (kColdHeights) {
+    Cool();
+  }
+  Renderable::FreeData();
+}
+
+// The heights and slopes are Grids, which count themselves
+size_t Geography::StagingBytes() const {
+  return Renderable::StagingBytes() + mesh_.size() * sizeof(unsigned int) +
+         normalTexels_.size() + occlusionTexels_.size();
+}
+
+static void UploadMap(GLuint *texture, const GLenum format,
+                      const vector<uint8_t> &texels) {
+  if (*texture == 0) {
+    glGenTextures(1, texture);
+  }
+  glBindTexture(GL_TEXTURE_2D, *texture);
+  glCompressedTexImage2D(GL_TEXTURE_2D, 0, format, kGeographyShort,
+                         kGeographyLong, 0, static_cast<GLsizei>(texels.size()),
+                         texels.data());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// The baked texels go with the rest of the staging data in FreeData
+void Geography::UploadGeom() {
+  if (!normalTexels_.empty()) {
+    UploadMap(&normalMap_, GL_COMPRESSED_RG_RGTC2, normalTexels_);
+    if (!occlusionTexels_.empty()) {
+      UploadMap(&occlusionMap_, GL_COMPRESSED_RED_RGTC1, occlusionTexels_);
+    }
+    maps_.Set(static_cast<int64_t>(normalTexels_.size() +
+                                   occlusionTexels_.size()));
+  }
+  Renderable::UploadGeom();
+}
+
+// The depth and shadow shaders have no useNormalMap, nothing is bound for them
+void Geography::Render(const Shader *const shader) const {
+  if (normalMap_ != 0 && shader->CopyDataToUniform(true, "useNormalMap")) {
+    shader->CopyDataToUniform(occlusionMap_ != 0, "useOcclusionMap");
+    glActiveTexture(GL_TEXTURE0 + kNormalMapUnit);
+    glBindTexture(GL_TEXTURE_2D, normalMap_);
+    glActiveTexture(GL_TEXTURE0 + kOcclusionMapUnit);
+    glBindTexture(GL_TEXTURE_2D, occlusionMap_);
+    glActiveTexture(GL_TEXTURE0);
+  }
+  Renderable::Render(shader);
 }
@@ -2,25 +2,133 @@
 
 #include <GL/glew.h>
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
 #include "grid.h"
+#include "height_codec.h"
+#include "memory_accounting.h"
+#include "noise_field.h"
+#include "noise_engine.h"
+#include "occlusion_culler.h"
 #include "renderable.h"
+#include "tile_cache.h"
 
 class Geography : public Renderable {
  public:
-  Geography(int x, int y);
+  // Texture units of the baked maps, after those of ClusteredLights
+  static constexpr GLint kNormalMapUnit{5};
+  static constexpr GLint kOcclusionMapUnit{6};
+
+  Geography(int x, int y, std::mt19937::result_type seed, NoiseType noise);
   ~Geography();
 
-  void Randomize(bool);
+  // Also uploads the baked maps when kNormalMaps is set
+  void UploadGeom() override;
+  // Binds the baked maps for shaders that use them
+  void Render(const Shader *) const override;
+  // Adaptive mesh of a tile at one mesh error, with the occluder bounds that
+  // follow its triangles
+  struct Mesh {
+    float error;
+    std::vector<unsigned int> indices;
+    std::vector<float> blockLow;
+    std::vector<float> blockHigh;
+  };
+  // Returns a job that triangulates the uploaded tile again at error, which
+  // may run on any thread and shares the heights rather than the tile, so it
+  // may outlive the tile. UploadMesh then replaces the drawn mesh with the
+  // job's on the GL thread.
+  std::function<void(Mesh *)> MeshJob(float error);
+  void UploadMesh(Mesh *);
+  // Mesh error the uploaded adaptive mesh was built with
+  inline float meshedError() const { return meshedError_; }
+  // Unique to this tile among every tile created, unlike its address
+  inline std::uint64_t serial() const { return serial_; }
+
+  // Error of the adaptive mesh for tiles meshed from now on, kMeshError by
+  // default. Tiles may be prepared on any thread.
+  static inline void SetMeshError(float error) { meshError_ = error; }
+  static inline float meshError() { return meshError_; }
+
+  inline float min() const { return min_; }
+  inline float max() const { return max_; }
+  // Row-major, as held by Grid. With kColdHeights this decodes the heights if
+  // they are cold, and the pointer is only valid until kHotTiles other tiles
+  // have been decoded.
+  inline const float *heights() { return Decoded().data(); }
+  // Position of the tile in the world, in tiles
+  inline int x() const { return x_; }
+  inline int y() const { return y_; }
 
-  inline float min() const { return height_.min(); }
-  inline float max() const { return height_.max(); }
+  // World space bounding box of the tile
+  glm::vec3 low() const;
+  glm::vec3 high() const;
+  // Adds boxes that the drawn surface covers entirely, one per block of cells
+  // from the bottom of the tile up to the lowest point over the block
+  void AddOccluders(OcclusionCuller *) const;
+  // Tests the whole tile and then, unless that is already hidden, the bounds
+  // of each block of cells
+  OcclusionCuller::Visibility Test(const OcclusionCuller &) const;
 
  protected:
   void SetData() override;
 
  private:
-  Grid height_;
+  void Randomize(std::mt19937::result_type, NoiseType);
+  void BakeMaps();
+  void StoreVertices();
+  const Grid &Decoded();
+  void Cool();
+
+  void FreeData() override;
+  std::size_t StagingBytes() const override;
+  void WriteVertices(Vertex *) override;
+  void WriteIndices(unsigned int *) override;
+
+  // With kColdHeights only held while the tile is prepared and uploaded, and
+  // afterwards while it is among the kHotTiles most recently decoded. Mesh
+  // jobs share both.
+  std::shared_ptr<Grid> height_{new Grid()};
+  std::shared_ptr<CompressedHeights> cold_{new CompressedHeights()};
+  bool cooled_{false};
+  // Only kept from generation until the normals have been uploaded
+  std::unique_ptr<Grid> slopeX_;
+  std::unique_ptr<Grid> slopeY_;
+  // Compressed maps of normals and sky occlusion baked with kNormalMaps,
+  // until they have been uploaded
+  std::vector<std::uint8_t> normalTexels_;
+  std::vector<std::uint8_t> occlusionTexels_;
+  GLuint normalMap_{0};
+  GLuint occlusionMap_{0};
+  MemoryCharge maps_{MemoryPool::kTextures};
+  // Triangles of the adaptive mesh, until they have been uploaded
+  std::vector<unsigned int> mesh_;
+  float meshedError_{0};
+  // Lowest and highest point of the drawn surface over each of
+  // kOcclusionBlocks x kOcclusionBlocks blocks of cells
+  std::vector<float> blockLow_;
+  std::vector<float> blockHigh_;
+  TileCache cache_;
+  float min_{0};
+  float max_{0};
+  std::mt19937::result_type seed_{0};
+  NoiseType noise_{NoiseType::kPerlin};
 
   int x_;
   int y_;
+  std::uint64_t serial_;
+
+  static std::atomic<float> meshError_;
+  static std::atomic<std::uint64_t> serials_;
+  // Cooled tiles holding decoded heights, most recently used first
+  static std::list<Geography *> hot_;
+  static std::mutex hotMutex_;
 };
@@ -1,5 +1,7 @@
 #include "grid.h"
 
+#include <cmath>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <iostream>
 #include <vector>
@@ -10,7 +12,29 @@
 using namespace std;
 
 random_device Grid::device_;
-default_random_engine::result_type Grid::base_random_{0};
+mt19937::result_type Grid::seed_{0};
+NoiseType Grid::noise_{NoiseType::kPerlin};
+
+constexpr auto kGridBytes =
+    static_cast<int64_t>(sizeof(float) * kGeographyShort * kGeographyLong);
+
+Grid::Grid() { MemoryAccounting::Add(MemoryPool::kHeightGrids, kGridBytes); }
+
+Grid::~Grid() {
+  if (data_ != nullptr) {
+    MemoryAccounting::Add(MemoryPool::kHeightGrids, -kGridBytes);
+  }
+}
+
+Grid::Grid(Grid &&other) noexcept : data_(std::move(other.data_)) {}
+
+Grid &Grid::operator=(Grid &&other) noexcept {
+  if (data_ != nullptr && this != &other) {
+    MemoryAccounting::Add(MemoryPool::kHeightGrids, -kGridBytes);
+  }
+  data_ = std::move(other.data_);
+  return *this;
+}
 
 Grid Grid::operator+(const Grid &other) const {
   Grid result;
@@ -50,127 +74,55 @@ Grid Grid::operator/(const float val) const { return operator*(1 / val); }
 
 void Grid::operator/=(const float val) { operator*=(1 / val); }
 
-glm::vec3 Grid::normal_at(const size_t x, const size_t y,
-                          const float amplification) const {
-  const auto low_x = x == 0 ? 0 : x - 1;
-  const auto high_x = x == kGeographyShort - 1 ? x : x + 1;
-  const auto low_y = y == 0 ? 0 : y - 1;
-  const auto high_y = y == kGeographyLong - 1 ? y : y + 1;
-
-  const auto x_diff =
-      glm::vec3(static_cast<float>(high_x - low_x), 0,
-                amplification * (get(high_x, y) - get(low_x, y)));
-  const auto y_diff =
-      glm::vec3(0, static_cast<float>(high_y - low_y),
-                amplification * (get(x, high_y) - get(x, low_y)));
-  return glm::normalize(glm::cross(x_diff, y_diff));
-}
-
-// Implementation based on: https://en.wikipedia.org/wiki/Perlin_noise
-// Assumes that kGeographyShort and kGeographyLong are equal to 2^n (doesn't
-// have to be the same n)
-Grid *Grid::PerlinNoise(int globalX, int globalY, std::size_t detail) {
-  auto grid = new Grid();
-
-  // Store the vectors at grid corners as just angles, they're all normalised
-  const size_t major_width = (kGeographyShort / detail) + 1;
-  const size_t major_length = (kGeographyLong / detail) + 1;
-  const size_t grid_nodes = major_width * major_length;
-  vector<float> sin_major_angles(grid_nodes);
-  vector<float> cos_major_angles(grid_nodes);
-
-  auto worldIndexX = (major_width - 1) * globalX;
-  auto worldIndexY = ((major_width - 1) * kGeographyCountShort + 1) *
-                     (major_length - 1) * globalY;
-  auto worldIndex = worldIndexX + worldIndexY;
-  mt19937::result_type gridBaseSeed = base_random_ * detail + worldIndex;
-
-  // Randomly generates corner vector angles [0, 2pi)
-  for (size_t x = 0; x < major_width; ++x) {
-    for (size_t y = 0; y < major_width; ++y) {
-      auto relativeWorldIndex =
-          x + ((major_width - 1) * kGeographyCountShort + 1) * y;
-      grid->AngleSeed(gridBaseSeed + relativeWorldIndex);
-      auto angle = grid->RandomAngle();
-      auto i = x + major_width * y;
-      sin_major_angles[i] = sin(angle);
-      cos_major_angles[i] = cos(angle);
-    }
-  }
-
-  // For each point in space
-  for (size_t x = 0; x < kGeographyShort; ++x) {
-    // Determines the x index of one of the grid vectors around the point
-    const size_t lower_major_x = x / detail;
-    // Determines the offset from the x position of the above grid vector.
-    // Offsets by 0.5 to sample from the middle of the point and avoid
-    // being on grid lines, but I don't think this is technically necessary
-    const float x_offset =
-        (.5f + static_cast<float>(x % detail)) / static_cast<float>(detail);
-
-    for (size_t y = 0; y < kGeographyLong; ++y) {
-      // Determines the y index of one of the grid vectors around the point
-      const size_t lower_major_y = y / detail;
-
-      // Same logic as x_offset
-      const float y_offset =
-          (.5f + static_cast<float>(y % detail)) / static_cast<float>(detail);
-
-      // Lambda to determine the dot product of the offset vector of the current
-      // point with one of the four grid vectors around the current point
-      const auto dot_major = [=, &cos_major_angles, &sin_major_angles](
-                                 bool high_x, bool high_y) -> float {
-        const auto major_x = lower_major_x + (high_x ? 1 : 0);
-        const auto major_y = lower_major_y + (high_y ? 1 : 0);
-        const auto sin_major_angle =
-            sin_major_angles[major_y * major_width + major_x];
-        const auto cos_major_angle =
-            cos_major_angles[major_y * major_width + major_x];
-        const auto x_major_offset = x_offset - (high_x ? 1.0f : 0.0f);
-        const auto y_major_offset = y_offset - (high_y ? 1.0f : 0.0f);
-        return cos_major_angle * x_major_offset +
-               sin_major_angle * y_major_offset;
-      };
-
-      // Interpolates between the dot_major results of the four grid vectors
-      // around the current point
-      const auto val = Interpolate(
-          x_offset,
-          Interpolate(y_offset, dot_major(false, false),
-                      dot_major(false, true)),
-          Interpolate(y_offset, dot_major(true, false), dot_major(true, true)));
-      grid->set(x, y, val);
-    }
-  }
-
-  return grid;
-}
-
-array<Vertex, kTotalVertices> *Grid::vertices() const {
-  auto vertices = new array<Vertex, kTotalVertices>();
-  for (size_t x = 0; x < kGeographyShort; ++x) {
-    for (size_t y = 0; y < kGeographyLong; ++y) {
-      auto ind = index(x, y);
-      glm::vec3 position = {x, y, (*data_)[ind]};
-      glm::vec3 normal = normal_at(x, y);
-      (*vertices)[ind] = {position, normal};
+// Walks each row in order so vertices is written sequentially
+void Grid::WriteVertices(const Grid &slope_x, const Grid &slope_y,
+                         Vertex *vertices, const size_t first_row,
+                         const size_t rows) const {
+  for (size_t y = first_row; y < first_row + rows; ++y) {
+    for (size_t x = 0; x < kGeographyShort; ++x) {
+      glm::vec3 position = {x, y, (*data_)[index(x, y)]};
+      // cross((1, 0, dh/dx), (0, 1, dh/dy))
+      glm::vec3 normal = glm::normalize(
+          glm::vec3(-slope_x.get(x, y), -slope_y.get(x, y), 1));
+      vertices[index(x, y - first_row)] = {position, normal};
     }
   }
-  return vertices;
 }
 
-array<unsigned int, kTotalIndices> *Grid::indices() {
-  auto indices = new array<unsigned int, kTotalIndices>();
-  for (size_t x = 0; x < kGeographyShort - 1; ++x) {
-    for (size_t y = 0; y < kGeographyLong - 1; ++y) {
-      auto indexInd = (x + y * (kGeographyShort - 1)) * 6;
-      (*indices)[indexInd] = static_cast<int>(index(x, y));
-      (*indices)[indexInd + 1] = static_cast<int>(index(x, y + 1));
-      (*indices)[indexInd + 2] = static_cast<int>(index(x + 1, y));
-      (*indices)[indexInd + 3] = static_cast<int>(index(x + 1, y));
-      (*indices)[indexInd + 4] = static_cast<int>(index(x, y + 1));
-      (*indices)[indexInd + 5] = static_cast<int>(index(x + 1, y + 1));
+// Rows here are rows of cells, of which there are kGeographyLong - 1. Cells
+// are emitted in columns stripe cells wide, top to bottom, so the vertices
+// shared with the row above are still in the post-transform cache when they
+// are used again. Whole rows would need a cache larger than a full row.
+void Grid::WriteIndices(unsigned int *indices, const size_t first_row,
+                        const size_t rows, const size_t stripe) const {
+  for (size_t left = 0; left < kGeographyShort - 1; left += stripe) {
+    const auto right = std::min(left + stripe, kGeographyShort - 1);
+    for (size_t y = first_row; y < first_row + rows; ++y) {
+      for (size_t x = left; x < right; ++x) {
+        const auto i00 = static_cast<unsigned int>(index(x, y));
+        const auto i01 = static_cast<unsigned int>(index(x, y + 1));
+        const auto i10 = static_cast<unsigned int>(index(x + 1, y));
+        const auto i11 = static_cast<unsigned int>(index(x + 1, y + 1));
+        // The diagonal between the closest pair of heights follows ridges and
+        // valleys instead of cutting across them
+        if (abs((*data_)[i00] - (*data_)[i11]) <
+            abs((*data_)[i01] - (*data_)[i10])) {
+          indices[0] = i00;
+          indices[1] = i01;
+          indices[2] = i11;
+          indices[3] = i00;
+          indices[4] = i11;
+          indices[5] = i10;
+        } else {
+          indices[0] = i00;
+          indices[1] = i01;
+          indices[2] = i10;
+          indices[3] = i10;
+          indices[4] = i01;
+          indices[5] = i11;
+        }
+        indices += kVerticesPerCell;
+      }
     }
   }
-  return indices;
 }
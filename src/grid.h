@@ -9,8 +9,10 @@
 #include <random>
 
 #include "constants.h"
+#include "memory_accounting.h"
+#include "noise_engine.h"
 #include "noise_math.h"
-#include "shader.h"
+#include "vertex.h"
 
 constexpr std::size_t index(const std::size_t x, const std::size_t y) {
   return x + y * kGeographyShort;
@@ -18,12 +20,21 @@ constexpr std::size_t index(const std::size_t x, const std::size_t y) {
 
 class Grid {
  public:
+  // Counted against MemoryPool::kHeightGrids while they hold data
+  Grid();
+  ~Grid();
+  Grid(Grid &&) noexcept;
+  Grid &operator=(Grid &&) noexcept;
+
   inline float get(const std::size_t x, const std::size_t y) const {
     return (*data_)[index(x, y)];
   }
   inline void set(const std::size_t x, const std::size_t y, float value) {
     (*data_)[index(x, y)] = value;
   }
+  // Row-major, index(x, y) gives the position of each value
+  inline float *data() { return data_->data(); }
+  inline const float *data() const { return data_->data(); }
 
   Grid operator+(const Grid &) const;
   void operator+=(const Grid &);
@@ -35,13 +46,18 @@ class Grid {
   Grid operator/(float) const;
   void operator/=(float);
 
-  glm::vec3 normal_at(std::size_t, std::size_t, float = 1.) const;
-
-  static Grid *PerlinNoise(int, int, std::size_t);
-
-  std::array<Vertex, kTotalVertices> *vertices() const;
-  static std::array<unsigned int, kTotalIndices> *indices();
-  static inline void RandomizeBase() { base_random_ = device_() << 4; }
+  // Both write the data for rows [first_row, first_row + rows) only, starting
+  // at the beginning of the given buffer. Normals come from the slope Grids.
+  void WriteVertices(const Grid &, const Grid &, Vertex *, std::size_t,
+                     std::size_t) const;
+  // Cell diagonals are picked to fit the heights
+  void WriteIndices(unsigned int *, std::size_t, std::size_t,
+                    std::size_t = kIndexStripe) const;
+  static inline void RandomizeBase() { SetBase(device_()); }
+  static inline void SetBase(std::mt19937::result_type seed) { seed_ = seed; }
+  static inline std::mt19937::result_type seed() { return seed_; }
+  static inline void SetNoise(NoiseType noise) { noise_ = noise; }
+  static inline NoiseType noise() { return noise_; }
 
   inline float min() const {
     return *std::min_element(data_->begin(), data_->end());
@@ -55,10 +71,6 @@ class Grid {
       std::make_unique<std::array<float, kGeographyShort * kGeographyLong>>()};
 
   static std::random_device device_;
-  std::mt19937 engine_{device_()};
-  std::uniform_real_distribution<float> dist_{0, glm::two_pi<float>()};
-  static std::mt19937::result_type base_random_;
-
-  inline float RandomAngle() { return dist_(engine_); }
-  inline void AngleSeed(std::mt19937::result_type seed) { engine_.seed(seed); }
+  static std::mt19937::result_type seed_;
+  static NoiseType noise_;
 };
@@ -0,0 +1,157 @@
+#include "height_codec.h"
+
+#include <cmath>
+#include <limits>
+
+#include "constants.h"
+#include "grid.h"
+
+using namespace std;
+
+// Planar prediction from the neighbours already coded, which is exact on any
+// constant slope
+static int32_t Predict(const uint16_t *levels, const size_t x,
+                       const size_t y) {
+  if (y == 0) {
+    return x == 0 ? 0 : levels[index(x - 1, y)];
+  }
+  if (x == 0) {
+    return levels[index(x, y - 1)];
+  }
+  return static_cast<int32_t>(levels[index(x - 1, y)]) +
+         levels[index(x, y - 1)] - levels[index(x - 1, y - 1)];
+}
+
+// Zigzagged residuals at least this many times 2^k take 18 bits after an
+// escape instead of their quotient in unary
+constexpr uint32_t kEscape{24};
+constexpr int kEscapeBits{18};
+constexpr int kParameterBits{5};
+
+// Appends bits to a byte vector, least significant first
+class BitWriter {
+ public:
+  explicit BitWriter(vector<uint8_t> *out) : out_(out) {}
+  inline void Write(const uint32_t value, const int bits) {
+    buffer_ |= static_cast<uint64_t>(value) << count_;
+    count_ += bits;
+    while (count_ >= 8) {
+      out_->push_back(static_cast<uint8_t>(buffer_));
+      buffer_ >>= 8;
+      count_ -= 8;
+    }
+  }
+  inline void Flush() {
+    if (count_ > 0) {
+      out_->push_back(static_cast<uint8_t>(buffer_));
+    }
+  }
+
+ private:
+  vector<uint8_t> *out_;
+  uint64_t buffer_{0};
+  int count_{0};
+};
+
+class BitReader {
+ public:
+  explicit BitReader(const uint8_t *in) : in_(in) {}
+  inline uint32_t Read(const int bits) {
+    while (count_ < bits) {
+      buffer_ |= static_cast<uint64_t>(*in_++) << count_;
+      count_ += 8;
+    }
+    const auto value =
+        static_cast<uint32_t>(buffer_ & ((uint64_t{1} << bits) - 1));
+    buffer_ >>= bits;
+    count_ -= bits;
+    return value;
+  }
+
+ private:
+  const uint8_t *in_;
+  uint64_t buffer_{0};
+  int count_{0};
+};
+
+// Bits taken by value in a Rice code with parameter k
+static uint32_t RiceBits(const uint32_t value, const int k) {
+  const auto quotient = value >> k;
+  return quotient < kEscape ? quotient + 1 + k : kEscape + kEscapeBits;
+}
+
+// Each row is a Rice code with the parameter that suits it best, which follows
+// how rough the terrain is along the row
+void CompressedHeights::Encode(const float *heights, const float min,
+                               const float max) {
+  offset_ = min;
+  step_ = (max - min) / 65535;
+  vector<uint16_t> levels(kTotalVertices);
+  for (size_t i = 0; i < kTotalVertices; ++i) {
+    levels[i] = step_ > 0 ? static_cast<uint16_t>(
+                                lround((heights[i] - offset_) / step_))
+                          : 0;
+  }
+
+  data_.clear();
+  data_.reserve(kTotalVertices * 2);
+  BitWriter writer(&data_);
+  uint32_t row[kGeographyShort];
+  for (size_t y = 0; y < kGeographyLong; ++y) {
+    for (size_t x = 0; x < kGeographyShort; ++x) {
+      const auto residual = levels[index(x, y)] - Predict(levels.data(), x, y);
+      row[x] = (static_cast<uint32_t>(residual) << 1) ^
+               static_cast<uint32_t>(residual >> 31);
+    }
+    auto best = 0;
+    auto fewest = numeric_limits<uint32_t>::max();
+    for (auto k = 0; k < kEscapeBits; ++k) {
+      uint32_t bits = 0;
+      for (const auto value : row) {
+        bits += RiceBits(value, k);
+      }
+      if (bits < fewest) {
+        fewest = bits;
+        best = k;
+      }
+    }
+
+    writer.Write(static_cast<uint32_t>(best), kParameterBits);
+    for (const auto value : row) {
+      const auto quotient = value >> best;
+      if (quotient < kEscape) {
+        // quotient zeros and a one
+        writer.Write(1u << quotient, static_cast<int>(quotient) + 1);
+        writer.Write(value & ((1u << best) - 1), best);
+      } else {
+        writer.Write(0, kEscape);
+        writer.Write(value, kEscapeBits);
+      }
+    }
+  }
+  writer.Flush();
+  data_.shrink_to_fit();
+  charge_.Set(static_cast<int64_t>(data_.capacity()));
+}
+
+void CompressedHeights::Decode(float *heights) const {
+  vector<uint16_t> levels(kTotalVertices);
+  BitReader reader(data_.data());
+  for (size_t y = 0; y < kGeographyLong; ++y) {
+    const auto k = static_cast<int>(reader.Read(kParameterBits));
+    for (size_t x = 0; x < kGeographyShort; ++x) {
+      uint32_t quotient = 0;
+      while (quotient < kEscape && reader.Read(1) == 0) {
+        ++quotient;
+      }
+      const auto zigzag = quotient < kEscape
+                              ? (quotient << k) | reader.Read(k)
+                              : reader.Read(kEscapeBits);
+      const auto residual = static_cast<int32_t>(zigzag >> 1) ^
+                            -static_cast<int32_t>(zigzag & 1);
+      const auto level = Predict(levels.data(), x, y) + residual;
+      levels[index(x, y)] = static_cast<uint16_t>(level);
+      heights[index(x, y)] = offset_ + static_cast<float>(level) * step_;
+    }
+  }
+}
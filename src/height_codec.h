@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "memory_accounting.h"
+
+// Heights of a tile quantized to 16 bits between its lowest and highest point.
+// Each is stored as its difference from a prediction off its left, upper and
+// upper-left neighbours, Rice coded row by row, which takes about a byte a
+// height on the default terrain. Decoded heights are within Error(min, max) of
+// the originals. Counted as MemoryPool::kHeightGrids.
+class CompressedHeights {
+ public:
+  CompressedHeights() = default;
+
+  // kGeographyShort x kGeographyLong heights, row-major as held by Grid, all
+  // within [min, max]
+  void Encode(const float *heights, float min, float max);
+  void Decode(float *heights) const;
+
+  inline bool empty() const { return data_.empty(); }
+  inline std::size_t bytes() const { return data_.size(); }
+
+  // Furthest a decoded height may be from the original, a step of
+  // quantization, which covers rounding to a step and decoding in float
+  static inline float Error(const float min, const float max) {
+    return (max - min) / 65535;
+  }
+
+ private:
+  float offset_{0};
+  float step_{0};
+  std::vector<std::uint8_t> data_;
+  MemoryCharge charge_{MemoryPool::kHeightGrids};
+};
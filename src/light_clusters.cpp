@@ -0,0 +1,168 @@
+#include "light_clusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+static_assert(kMaxLights <= 1 << 16, "Light indices are 16 bit");
+static_assert(kShadowAtlasSize % kShadowFaceMax == 0 &&
+                  (kShadowFaceMax & (kShadowFaceMax - 1)) == 0 &&
+                  (kShadowFaceMin & (kShadowFaceMin - 1)) == 0,
+              "Shadow faces are powers of two that tile the atlas");
+
+static const float kDepthRatio{log(kFarPlane / kNearPlane)};
+
+// Depth slices are exponential, so clusters stay roughly cubic with distance
+static size_t Slice(const float depth) {
+  const auto slice = floor(log(depth / kNearPlane) / kDepthRatio * kClustersZ);
+  return static_cast<size_t>(
+      std::min(std::max(slice, 0.0f), static_cast<float>(kClustersZ - 1)));
+}
+
+static float SliceDepth(const size_t slice) {
+  return kNearPlane * exp(kDepthRatio * slice / kClustersZ);
+}
+
+// Column or row of clusters at a normalized device coordinate
+static uint16_t Cell(const float ndc, const size_t count) {
+  const auto cell = floor((ndc * 0.5f + 0.5f) * count);
+  return static_cast<uint16_t>(
+      std::min(std::max(cell, 0.0f), static_cast<float>(count - 1)));
+}
+
+// Splits the bits of a Morton (Z-order) index into x and y
+static void Deinterleave(size_t index, size_t *x, size_t *y) {
+  *x = *y = 0;
+  for (size_t bit = 0; index != 0; ++bit, index >>= 2) {
+    *x |= (index & 1) << bit;
+    *y |= ((index >> 1) & 1) << bit;
+  }
+}
+
+LightClusters::LightClusters()
+    : clusters_(kClustersX * kClustersY * kClustersZ * 2) {}
+
+// Each light is bounded slice by slice, by the widest cross-section of its
+// sphere within the slice, which is much tighter than the sphere's own bounds
+// wherever the slices are thin
+void LightClusters::Assign(const vector<Light> &lights, const glm::mat4 &view,
+                           const glm::mat4 &projection) {
+  ranges_.clear();
+  visible_.assign(lights.size(), false);
+  const auto scale_x = projection[0][0];
+  const auto scale_y = projection[1][1];
+  for (size_t i = 0; i < lights.size() && i < kMaxLights; ++i) {
+    const auto &light = lights[i];
+    const auto center = view * glm::vec4(light.position, 1);
+    // Distance in front of the camera
+    const auto depth = -center.z;
+    const auto radius = light.radius;
+    if (depth + radius < kNearPlane || depth - radius > kFarPlane) {
+      continue;
+    }
+
+    const auto first = Slice(std::max(depth - radius, kNearPlane));
+    const auto last = Slice(std::min(depth + radius, kFarPlane));
+    for (auto z = first; z <= last; ++z) {
+      const auto front = std::max(SliceDepth(z), depth - radius);
+      const auto back = std::min(SliceDepth(z + 1), depth + radius);
+      const auto closest =
+          depth < front ? front - depth : (depth > back ? depth - back : 0.0f);
+      const auto reach =
+          sqrt(std::max(radius * radius - closest * closest, 0.0f));
+      // Extremes of x / depth over the box around the cross-section
+      const auto low_x = center.x - reach, high_x = center.x + reach;
+      const auto low_y = center.y - reach, high_y = center.y + reach;
+      const auto min_x = scale_x * std::min(low_x / front, low_x / back);
+      const auto max_x = scale_x * std::max(high_x / front, high_x / back);
+      const auto min_y = scale_y * std::min(low_y / front, low_y / back);
+      const auto max_y = scale_y * std::max(high_y / front, high_y / back);
+      if (max_x < -1 || min_x > 1 || max_y < -1 || min_y > 1) {
+        continue;
+      }
+      ranges_.push_back({static_cast<uint16_t>(i), static_cast<uint16_t>(z),
+                         Cell(min_x, kClustersX), Cell(max_x, kClustersX),
+                         Cell(min_y, kClustersY), Cell(max_y, kClustersY)});
+      visible_[i] = true;
+    }
+  }
+
+  // Counted first, so the lights of each cluster can be written contiguously
+  fill(clusters_.begin(), clusters_.end(), 0);
+  for (const auto &range : ranges_) {
+    for (auto y = range.y0; y <= range.y1; ++y) {
+      for (auto x = range.x0; x <= range.x1; ++x) {
+        ++clusters_[Cluster(x, y, range.z) * 2 + 1];
+      }
+    }
+  }
+  uint32_t offset = 0;
+  for (size_t cluster = 0; cluster < clusters_.size(); cluster += 2) {
+    clusters_[cluster] = offset;
+    offset += clusters_[cluster + 1];
+    clusters_[cluster + 1] = 0;
+  }
+  indices_.resize(offset);
+  for (const auto &range : ranges_) {
+    for (auto y = range.y0; y <= range.y1; ++y) {
+      for (auto x = range.x0; x <= range.x1; ++x) {
+        const auto cluster = Cluster(x, y, range.z) * 2;
+        indices_[clusters_[cluster] + clusters_[cluster + 1]++] = range.light;
+      }
+    }
+  }
+}
+
+// Faces are packed in decreasing size along a Z-order curve of kShadowFaceMin
+// squares, which keeps every face aligned to its own size without gaps
+void LightClusters::AllocateShadows(const vector<Light> &lights,
+                                    const glm::vec3 &eye,
+                                    vector<ShadowSlot> *slots) const {
+  vector<pair<float, size_t>> ranked;
+  for (size_t i = 0; i < lights.size() && i < visible_.size(); ++i) {
+    if (lights[i].shadows && visible_[i]) {
+      const auto distance = glm::distance(eye, lights[i].position);
+      ranked.emplace_back(
+          lights[i].radius / std::max(distance, lights[i].radius), i);
+    }
+  }
+  sort(ranked.begin(), ranked.end(),
+       [](const pair<float, size_t> &a, const pair<float, size_t> &b) {
+         return a.first > b.first;
+       });
+
+  constexpr size_t kAtlasCells = (kShadowAtlasSize / kShadowFaceMin) *
+                                 (kShadowAtlasSize / kShadowFaceMin);
+  slots->clear();
+  size_t used = 0;
+  auto largest = kShadowFaceMax;
+  for (const auto &light : ranked) {
+    if (slots->size() == kMaxShadowLights) {
+      break;
+    }
+    auto size = kShadowFaceMin;
+    while (size * 2 <= largest && size * 2 <= light.first * kShadowFaceMax) {
+      size *= 2;
+    }
+    auto cells = static_cast<size_t>((size / kShadowFaceMin) *
+                                     (size / kShadowFaceMin));
+    while (used + cells * 6 > kAtlasCells && size > kShadowFaceMin) {
+      size /= 2;
+      cells /= 4;
+    }
+    if (used + cells * 6 > kAtlasCells) {
+      break;
+    }
+    largest = size;
+
+    ShadowSlot slot{light.second, size, {}, {}};
+    for (size_t face = 0; face < 6; ++face, used += cells) {
+      size_t x, y;
+      Deinterleave(used, &x, &y);
+      slot.x[face] = static_cast<int>(x) * kShadowFaceMin;
+      slot.y[face] = static_cast<int>(y) * kShadowFaceMin;
+    }
+    slots->push_back(slot);
+  }
+}
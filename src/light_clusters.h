@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "constants.h"
+
+// A point light that reaches radius world units
+struct Light {
+  glm::vec3 position;
+  glm::vec3 color;
+  float radius;
+  bool shadows;
+};
+
+// Where the six cube faces of a light's shadow are in the shadow atlas, each
+// size pixels a side
+struct ShadowSlot {
+  std::size_t light;
+  int size;
+  int x[6];
+  int y[6];
+};
+
+// Works out on the CPU which lights reach each cluster of the view frustum,
+// and how to share the shadow atlas between the lights
+class LightClusters {
+ public:
+  LightClusters();
+
+  // For a camera with the given view and (symmetric perspective) projection
+  void Assign(const std::vector<Light> &, const glm::mat4 &,
+              const glm::mat4 &);
+
+  // Shadowed lights that reach a cluster are ranked by their radius over
+  // their distance from the eye, and get the largest faces that still fit
+  void AllocateShadows(const std::vector<Light> &, const glm::vec3 &,
+                       std::vector<ShadowSlot> *) const;
+
+  static constexpr std::size_t Cluster(std::size_t x, std::size_t y,
+                                       std::size_t z) {
+    return x + kClustersX * (y + kClustersY * z);
+  }
+
+  // Per cluster the position of its first light in indices() and how many
+  // lights follow
+  inline const std::vector<std::uint32_t> &clusters() const {
+    return clusters_;
+  }
+  inline const std::vector<std::uint16_t> &indices() const {
+    return indices_;
+  }
+  // Whether each light reaches any cluster at all
+  inline const std::vector<bool> &visible() const { return visible_; }
+
+ private:
+  struct Range {
+    std::uint16_t light;
+    std::uint16_t z;
+    std::uint16_t x0, x1, y0, y1;
+  };
+
+  std::vector<std::uint32_t> clusters_;
+  std::vector<std::uint16_t> indices_;
+  std::vector<bool> visible_;
+  // Reused between frames
+  std::vector<Range> ranges_;
+};
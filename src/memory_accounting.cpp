@@ -0,0 +1,82 @@
+#include "memory_accounting.h"
+
+#include <iomanip>
+
+#include "constants.h"
+
+using namespace std;
+
+atomic<int64_t> MemoryAccounting::live_[kMemoryPoolCount]{};
+atomic<int64_t> MemoryAccounting::peak_[kMemoryPoolCount]{};
+
+// In the order of MemoryPool
+constexpr int64_t kBudgets[kMemoryPoolCount]{0, 0, kGeometryBudget,
+                                             kShadowMapBudget, 0, 0};
+
+void MemoryAccounting::Add(const MemoryPool pool, const int64_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+  const auto index = static_cast<size_t>(pool);
+  const auto live = live_[index].fetch_add(bytes) + bytes;
+  auto peak = peak_[index].load();
+  while (live > peak && !peak_[index].compare_exchange_weak(peak, live)) {
+  }
+}
+
+int64_t MemoryAccounting::budget(const MemoryPool pool) {
+  return kBudgets[static_cast<size_t>(pool)];
+}
+
+bool MemoryAccounting::Fits(const MemoryPool pool, const int64_t bytes) {
+  const auto limit = budget(pool);
+  return limit == 0 || live(pool) + bytes <= limit;
+}
+
+const char *MemoryAccounting::Name(const MemoryPool pool) {
+  switch (pool) {
+    case MemoryPool::kHeightGrids:
+      return "height grids";
+    case MemoryPool::kStaging:
+      return "staging arrays";
+    case MemoryPool::kGeometry:
+      return "vertex/index buffers";
+    case MemoryPool::kShadowMaps:
+      return "shadow maps";
+    case MemoryPool::kTextures:
+      return "other textures";
+    case MemoryPool::kShaderPrograms:
+      return "shader programs";
+  }
+  return "";
+}
+
+static double Mebibytes(const int64_t bytes) {
+  return static_cast<double>(bytes) / (1 << 20);
+}
+
+void MemoryAccounting::Print(ostream &out) {
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  out << fixed << setprecision(1);
+  out << "Memory (MiB)            live      peak    budget\n";
+  int64_t cpu = 0, gpu = 0;
+  for (size_t i = 0; i < kMemoryPoolCount; ++i) {
+    const auto pool = static_cast<MemoryPool>(i);
+    out << "  " << left << setw(20) << Name(pool) << right << setw(10)
+        << Mebibytes(live(pool)) << setw(10) << Mebibytes(peak(pool));
+    if (budget(pool) == 0) {
+      out << setw(10) << "-";
+    } else {
+      out << setw(10) << Mebibytes(budget(pool));
+    }
+    out << "\n";
+    (pool < MemoryPool::kGeometry ? cpu : gpu) += live(pool);
+  }
+  out << "  " << left << setw(20) << "total CPU" << right << setw(10)
+      << Mebibytes(cpu) << "\n";
+  out << "  " << left << setw(20) << "total GPU" << right << setw(10)
+      << Mebibytes(gpu) << endl;
+  out.flags(flags);
+  out.precision(precision);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Subsystems memory is counted against. The first two are held by the CPU,
+// the rest by the GPU (as requested from the driver, which may round up).
+enum class MemoryPool {
+  kHeightGrids,
+  kStaging,
+  kGeometry,
+  kShadowMaps,
+  kTextures,
+  kShaderPrograms,
+};
+constexpr std::size_t kMemoryPoolCount{6};
+
+// Live and peak bytes of each pool, updated from any thread by whatever
+// allocates them. Budgets come from constants.h, subsystems that can shrink or
+// drop what they hold check Fits before allocating.
+class MemoryAccounting {
+ public:
+  // Negative bytes release
+  static void Add(MemoryPool, std::int64_t bytes);
+
+  static inline std::int64_t live(const MemoryPool pool) {
+    return live_[static_cast<std::size_t>(pool)];
+  }
+  static inline std::int64_t peak(const MemoryPool pool) {
+    return peak_[static_cast<std::size_t>(pool)];
+  }
+  // Zero leaves the pool unlimited
+  static std::int64_t budget(MemoryPool);
+  // Whether bytes more stay within the budget of the pool
+  static bool Fits(MemoryPool, std::int64_t bytes);
+
+  static const char *Name(MemoryPool);
+  // Live, peak and budget of every pool in MiB
+  static void Print(std::ostream &);
+
+ private:
+  static std::atomic<std::int64_t> live_[kMemoryPoolCount];
+  static std::atomic<std::int64_t> peak_[kMemoryPoolCount];
+};
+
+// Bytes a single owner holds in a pool, released with the owner
+class MemoryCharge {
+ public:
+  explicit MemoryCharge(MemoryPool pool) : pool_(pool) {}
+  ~MemoryCharge() { Set(0); }
+
+  MemoryCharge(const MemoryCharge &) = delete;
+  MemoryCharge &operator=(const MemoryCharge &) = delete;
+
+  inline void Set(const std::int64_t bytes) {
+    MemoryAccounting::Add(pool_, bytes - bytes_);
+    bytes_ = bytes;
+  }
+  inline std::int64_t bytes() const { return bytes_; }
+
+ private:
+  MemoryPool pool_;
+  std::int64_t bytes_{0};
+};
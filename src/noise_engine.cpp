@@ -0,0 +1,687 @@
+#include "noise_engine.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+#include <glm/glm.hpp>
+
+#include "constants.h"
+#include "noise_math.h"
+
+using namespace std;
+
+// Skews the square lattice onto the triangular one and back, from "Simplex
+// noise demystified" by Stefan Gustavson
+constexpr double kSkew{0.36602540378443865};    // (sqrt(3) - 1) / 2
+constexpr double kUnskew{0.21132486540518713};  // (3 - sqrt(3)) / 6
+// Scales the sum of the three corner contributions to roughly [-1, 1]
+constexpr float kSimplexScale{99.0f};
+
+const char *NoiseName(const NoiseType type) {
+  switch (type) {
+    case NoiseType::kPerlin:
+      return "perlin";
+    case NoiseType::kSimplex:
+      return "simplex";
+    case NoiseType::kValue:
+      return "value";
+  }
+  return "unknown";
+}
+
+bool ParseNoise(const string &name, NoiseType *noise) {
+  for (size_t i = 0; i < kNoiseTypeCount; ++i) {
+    if (name == NoiseName(static_cast<NoiseType>(i))) {
+      *noise = static_cast<NoiseType>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+unique_ptr<NoiseEngine> NoiseEngine::Create(const NoiseType type,
+                                            const bool simd) {
+  switch (type) {
+    case NoiseType::kPerlin:
+      return unique_ptr<NoiseEngine>(new PerlinEngine(simd));
+    case NoiseType::kSimplex:
+      return unique_ptr<NoiseEngine>(new SimplexEngine(simd));
+    case NoiseType::kValue:
+      return unique_ptr<NoiseEngine>(new ValueEngine(simd));
+  }
+  return nullptr;
+}
+
+// Looks up fn(x, y) once for every lattice corner touched by the octave, in a
+// table with rows of lattice.major_x.back() - lattice.major_x[0] + 2 corners
+template <typename T, typename Corner>
+static vector<T> CornerTable(const OctaveLattice &lattice, size_t *row_width,
+                             Corner fn) {
+  const auto &major_x = lattice.major_x;
+  const auto &major_y = lattice.major_y;
+  *row_width = static_cast<size_t>(major_x.back() - major_x[0]) + 2;
+  const auto rows = static_cast<size_t>(major_y.back() - major_y[0]) + 2;
+  vector<T> corners(*row_width * rows);
+  for (size_t y = 0; y < rows; ++y) {
+    for (size_t x = 0; x < *row_width; ++x) {
+      corners[x + y * *row_width] = fn(major_x[0] + static_cast<int64_t>(x),
+                                       major_y[0] + static_cast<int64_t>(y));
+    }
+  }
+  return corners;
+}
+
+// Index of the low corner of every column within a row of a corner table
+static vector<size_t> CornerColumns(const OctaveLattice &lattice) {
+  vector<size_t> columns(lattice.major_x.size());
+  for (size_t x = 0; x < columns.size(); ++x) {
+    columns[x] = static_cast<size_t>(lattice.major_x[x] - lattice.major_x[0]);
+  }
+  return columns;
+}
+
+// Adds amplitude times the noise and its slopes, which the SIMD paths share
+// with the scalar ones so both round identically
+static inline void Accumulate(const size_t i, const float amplitude,
+                              const float slope_amplitude,
+                              const glm::vec3 &noise, float *height,
+                              float *slope_x, float *slope_y) {
+  height[i] += amplitude * noise.z;
+  if (slope_x != nullptr) {
+    slope_x[i] += slope_amplitude * noise.x;
+    slope_y[i] += slope_amplitude * noise.y;
+  }
+}
+
+#ifdef __SSE2__
+static inline void Accumulate4(const size_t i, const __m128 amplitude,
+                               const __m128 slope_amplitude, const __m128 dx,
+                               const __m128 dy, const __m128 val,
+                               float *height, float *slope_x, float *slope_y) {
+  _mm_storeu_ps(height + i, _mm_add_ps(_mm_loadu_ps(height + i),
+                                       _mm_mul_ps(amplitude, val)));
+  if (slope_x != nullptr) {
+    _mm_storeu_ps(slope_x + i, _mm_add_ps(_mm_loadu_ps(slope_x + i),
+                                          _mm_mul_ps(slope_amplitude, dx)));
+    _mm_storeu_ps(slope_y + i, _mm_add_ps(_mm_loadu_ps(slope_y + i),
+                                          _mm_mul_ps(slope_amplitude, dy)));
+  }
+}
+
+// a + b * (c - a), the same rounding as Interpolate once the blend is known
+static inline __m128 Lerp4(const __m128 a, const __m128 c, const __m128 b) {
+  return _mm_add_ps(a, _mm_mul_ps(b, _mm_sub_ps(c, a)));
+}
+#endif
+
+constexpr size_t Log2(const size_t x) { return x > 1 ? Log2(x >> 1) + 1 : 0; }
+
+// Every octave period up to kDetail gets a kernel specialised for it
+constexpr size_t kKernelShifts{Log2(kDetail) + 1};
+
+// Offsets into a cell of 1 << Shift whole positions, and the blends of each,
+// worked out once for the whole run of the program
+template <size_t Shift>
+struct SpanTable {
+  static constexpr size_t kSpan{size_t{1} << Shift};
+
+  SpanTable() {
+    for (size_t k = 0; k < kSpan; ++k) {
+      // Same expression as NoiseField::Locate
+      offsets[k] = static_cast<float>((static_cast<double>(k) + kNoiseOffset) /
+                                      static_cast<double>(kSpan));
+      offsets_1[k] = offsets[k] - 1;
+      blends[k] = SmootherStep(offsets[k]);
+      blend_slopes[k] = SmootherStepSlope(offsets[k]);
+    }
+  }
+
+  static const SpanTable &Get() {
+    static const SpanTable table;
+    return table;
+  }
+
+  float offsets[kSpan];
+  float offsets_1[kSpan];
+  float blends[kSpan];
+  float blend_slopes[kSpan];
+};
+
+// Everything about a run of samples through one cell that does not change
+// along it: the corner vectors and the terms that only depend on y
+struct PerlinSpan {
+  float g00x, g01x, g10x, g11x;
+  float a00, a01, a10, a11;
+  float yb, ybs;
+  float low_dx, high_dx_low_dx;
+  float low_dy, high_dy;
+};
+
+struct PerlinOctave {
+  const OctaveLattice *lattice;
+  const glm::vec2 *majors;
+  size_t row_width;
+  float amplitude;
+  float slope_amplitude;
+  bool simd;
+  float *height;
+  float *slope_x;
+  float *slope_y;
+};
+
+// Samples [begin, end) of a cell, the same operations in the same order as
+// PerlinCell with everything constant along the span hoisted out
+template <size_t Shift>
+static inline void PerlinSpanSamples(const SpanTable<Shift> &table,
+                                     const PerlinSpan &s,
+                                     const PerlinOctave &octave,
+                                     const size_t begin, const size_t end,
+                                     const size_t i) {
+  auto height = octave.height + i;
+  auto slope_x = octave.slope_x == nullptr ? nullptr : octave.slope_x + i;
+  auto slope_y = octave.slope_y == nullptr ? nullptr : octave.slope_y + i;
+  auto k = begin;
+
+#ifdef __SSE2__
+  if (octave.simd) {
+    const auto g00x = _mm_set1_ps(s.g00x);
+    const auto g01x = _mm_set1_ps(s.g01x);
+    const auto g10x = _mm_set1_ps(s.g10x);
+    const auto g11x = _mm_set1_ps(s.g11x);
+    const auto a00 = _mm_set1_ps(s.a00);
+    const auto a01 = _mm_set1_ps(s.a01);
+    const auto a10 = _mm_set1_ps(s.a10);
+    const auto a11 = _mm_set1_ps(s.a11);
+    const auto yb = _mm_set1_ps(s.yb);
+    const auto ybs = _mm_set1_ps(s.ybs);
+    const auto low_dx = _mm_set1_ps(s.low_dx);
+    const auto high_dx_low_dx = _mm_set1_ps(s.high_dx_low_dx);
+    const auto low_dy0 = _mm_set1_ps(s.low_dy);
+    const auto high_dy0 = _mm_set1_ps(s.high_dy);
+    const auto amplitude = _mm_set1_ps(octave.amplitude);
+    const auto slope_amplitude = _mm_set1_ps(octave.slope_amplitude);
+    for (; k + 4 <= end; k += 4) {
+      const auto xo = _mm_loadu_ps(&table.offsets[k]);
+      const auto xo1 = _mm_loadu_ps(&table.offsets_1[k]);
+      const auto xb = _mm_loadu_ps(&table.blends[k]);
+      const auto xbs = _mm_loadu_ps(&table.blend_slopes[k]);
+      const auto dot_00 = _mm_add_ps(_mm_mul_ps(g00x, xo), a00);
+      const auto dot_01 = _mm_add_ps(_mm_mul_ps(g01x, xo), a01);
+      const auto dot_10 = _mm_add_ps(_mm_mul_ps(g10x, xo1), a10);
+      const auto dot_11 = _mm_add_ps(_mm_mul_ps(g11x, xo1), a11);
+      const auto low = Lerp4(dot_00, dot_01, yb);
+      const auto high = Lerp4(dot_10, dot_11, yb);
+      const auto val = Lerp4(low, high, xb);
+      const auto dx =
+          _mm_add_ps(_mm_add_ps(low_dx, _mm_mul_ps(xb, high_dx_low_dx)),
+                     _mm_mul_ps(xbs, _mm_sub_ps(high, low)));
+      const auto low_dy = _mm_add_ps(
+          low_dy0, _mm_mul_ps(ybs, _mm_sub_ps(dot_01, dot_00)));
+      const auto high_dy = _mm_add_ps(
+          high_dy0, _mm_mul_ps(ybs, _mm_sub_ps(dot_11, dot_10)));
+      const auto dy = Lerp4(low_dy, high_dy, xb);
+      Accumulate4(k - begin, amplitude, slope_amplitude, dx, dy, val, height,
+                  slope_x, slope_y);
+    }
+  }
+#endif
+
+  for (; k < end; ++k) {
+    const auto dot_00 = s.g00x * table.offsets[k] + s.a00;
+    const auto dot_01 = s.g01x * table.offsets[k] + s.a01;
+    const auto dot_10 = s.g10x * table.offsets_1[k] + s.a10;
+    const auto dot_11 = s.g11x * table.offsets_1[k] + s.a11;
+    const auto low = dot_00 + s.yb * (dot_01 - dot_00);
+    const auto high = dot_10 + s.yb * (dot_11 - dot_10);
+    const auto xb = table.blends[k];
+    const auto low_dy = s.low_dy + s.ybs * (dot_01 - dot_00);
+    const auto high_dy = s.high_dy + s.ybs * (dot_11 - dot_10);
+    const glm::vec3 noise{
+        s.low_dx + xb * s.high_dx_low_dx + table.blend_slopes[k] * (high - low),
+        low_dy + xb * (high_dy - low_dy), low + xb * (high - low)};
+    Accumulate(k - begin, octave.amplitude, octave.slope_amplitude, noise,
+               height, slope_x, slope_y);
+  }
+}
+
+// An aligned octave with 1 << Shift samples per cell. Samples are walked one
+// cell at a time, so the corners are fetched once per cell rather than once
+// per sample, and whole cells run over a compile-time number of samples.
+template <size_t Shift>
+static void PerlinAlignedOctave(const PerlinOctave &octave) {
+  constexpr auto kSpan = SpanTable<Shift>::kSpan;
+  constexpr auto kMask = static_cast<int64_t>(kSpan) - 1;
+  const auto &table = SpanTable<Shift>::Get();
+  const auto &lattice = *octave.lattice;
+  const auto width = lattice.major_x.size();
+  const auto length = lattice.major_y.size();
+  const auto first_minor = static_cast<size_t>(lattice.first_x & kMask);
+
+  for (size_t y = 0; y < length; ++y) {
+    const auto row = static_cast<size_t>(lattice.major_y[y] -
+                                         lattice.major_y[0]) *
+                     octave.row_width;
+    const auto yo = lattice.y_offsets[y];
+    const auto yo1 = yo - 1;
+    PerlinSpan s;
+    s.yb = SmootherStep(yo);
+    s.ybs = SmootherStepSlope(yo);
+
+    auto minor = first_minor;
+    for (size_t x = 0; x < width; minor = 0) {
+      const auto corners = &octave.majors[row + static_cast<size_t>(
+                                                    lattice.major_x[x] -
+                                                    lattice.major_x[0])];
+      const auto &g00 = corners[0];
+      const auto &g01 = corners[octave.row_width];
+      const auto &g10 = corners[1];
+      const auto &g11 = corners[octave.row_width + 1];
+      s.g00x = g00.x;
+      s.g01x = g01.x;
+      s.g10x = g10.x;
+      s.g11x = g11.x;
+      s.a00 = g00.y * yo;
+      s.a01 = g01.y * yo1;
+      s.a10 = g10.y * yo;
+      s.a11 = g11.y * yo1;
+      s.low_dx = g00.x + s.yb * (g01.x - g00.x);
+      s.high_dx_low_dx = g10.x + s.yb * (g11.x - g10.x) - s.low_dx;
+      s.low_dy = g00.y + s.yb * (g01.y - g00.y);
+      s.high_dy = g10.y + s.yb * (g11.y - g10.y);
+
+      const auto i = x + y * width;
+      if (minor == 0 && x + kSpan <= width) {
+        PerlinSpanSamples<Shift>(table, s, octave, 0, kSpan, i);
+        x += kSpan;
+      } else {
+        const auto end = std::min(kSpan, minor + (width - x));
+        PerlinSpanSamples<Shift>(table, s, octave, minor, end, i);
+        x += end - minor;
+      }
+    }
+  }
+}
+
+using PerlinKernel = void (*)(const PerlinOctave &);
+
+template <size_t... Shifts>
+static std::array<PerlinKernel, sizeof...(Shifts)> PerlinKernels(
+    index_sequence<Shifts...>) {
+  return {{&PerlinAlignedOctave<Shifts>...}};
+}
+
+// Indexed by the shift of the octave
+static const auto kPerlinKernels =
+    PerlinKernels(make_index_sequence<kKernelShifts>());
+
+void PerlinEngine::AddOctave(const mt19937::result_type seed,
+                             const OctaveLattice &lattice,
+                             const float amplitude, float *height,
+                             float *slope_x, float *slope_y) const {
+  const auto octave = static_cast<uint32_t>(lattice.detail);
+  size_t row_width;
+  const auto majors = CornerTable<glm::vec2>(
+      lattice, &row_width, [seed, octave](int64_t x, int64_t y) {
+        return LatticeGradient(seed, octave, x, y);
+      });
+  const auto columns = CornerColumns(lattice);
+  const auto width = lattice.major_x.size();
+  const auto length = lattice.major_y.size();
+
+  // Converts derivatives with respect to an offset into per world unit ones
+  const auto slope_amplitude = amplitude / static_cast<float>(lattice.detail);
+
+  // Spans shorter than a vector gain more from the SIMD gather below
+  if (lattice.aligned && lattice.shift < kKernelShifts &&
+      (!simd_ || lattice.shift >= 2)) {
+    kPerlinKernels[lattice.shift]({&lattice, majors.data(), row_width,
+                                   amplitude, slope_amplitude, simd_, height,
+                                   slope_x, slope_y});
+    return;
+  }
+
+#ifdef __SSE2__
+  // Blends only depend on the column, so are worked out once per octave
+  vector<float> x_blends(width);
+  vector<float> x_blend_slopes(width);
+  for (size_t x = 0; x < width; ++x) {
+    x_blends[x] = SmootherStep(lattice.x_offsets[x]);
+    x_blend_slopes[x] = SmootherStepSlope(lattice.x_offsets[x]);
+  }
+  const auto one = _mm_set1_ps(1);
+  const auto amplitude4 = _mm_set1_ps(amplitude);
+  const auto slope_amplitude4 = _mm_set1_ps(slope_amplitude);
+#endif
+
+  for (size_t y = 0; y < length; ++y) {
+    const auto row = static_cast<size_t>(lattice.major_y[y] -
+                                         lattice.major_y[0]) *
+                     row_width;
+    const auto y_offset = lattice.y_offsets[y];
+    size_t x = 0;
+
+#ifdef __SSE2__
+    if (simd_) {
+      const auto yo = _mm_set1_ps(y_offset);
+      const auto yo1 = _mm_sub_ps(yo, one);
+      const auto yb = _mm_set1_ps(SmootherStep(y_offset));
+      const auto ybs = _mm_set1_ps(SmootherStepSlope(y_offset));
+      for (; x + 4 <= width; x += 4) {
+        // Gathers the corner vectors of four neighbouring samples
+        const glm::vec2 *c[4];
+        for (size_t lane = 0; lane < 4; ++lane) {
+          c[lane] = &majors[row + columns[x + lane]];
+        }
+        const auto w = row_width;
+        const auto g00x = _mm_setr_ps(c[0][0].x, c[1][0].x, c[2][0].x,
+                                      c[3][0].x);
+        const auto g00y = _mm_setr_ps(c[0][0].y, c[1][0].y, c[2][0].y,
+                                      c[3][0].y);
+        const auto g01x = _mm_setr_ps(c[0][w].x, c[1][w].x, c[2][w].x,
+                                      c[3][w].x);
+        const auto g01y = _mm_setr_ps(c[0][w].y, c[1][w].y, c[2][w].y,
+                                      c[3][w].y);
+        const auto g10x = _mm_setr_ps(c[0][1].x, c[1][1].x, c[2][1].x,
+                                      c[3][1].x);
+        const auto g10y = _mm_setr_ps(c[0][1].y, c[1][1].y, c[2][1].y,
+                                      c[3][1].y);
+        const auto g11x = _mm_setr_ps(c[0][w + 1].x, c[1][w + 1].x,
+                                      c[2][w + 1].x, c[3][w + 1].x);
+        const auto g11y = _mm_setr_ps(c[0][w + 1].y, c[1][w + 1].y,
+                                      c[2][w + 1].y, c[3][w + 1].y);
+
+        const auto xo = _mm_loadu_ps(&lattice.x_offsets[x]);
+        const auto xo1 = _mm_sub_ps(xo, one);
+        const auto xb = _mm_loadu_ps(&x_blends[x]);
+        const auto xbs = _mm_loadu_ps(&x_blend_slopes[x]);
+
+        // Same operations in the same order as PerlinCell
+        const auto dot_00 =
+            _mm_add_ps(_mm_mul_ps(g00x, xo), _mm_mul_ps(g00y, yo));
+        const auto dot_01 =
+            _mm_add_ps(_mm_mul_ps(g01x, xo), _mm_mul_ps(g01y, yo1));
+        const auto dot_10 =
+            _mm_add_ps(_mm_mul_ps(g10x, xo1), _mm_mul_ps(g10y, yo));
+        const auto dot_11 =
+            _mm_add_ps(_mm_mul_ps(g11x, xo1), _mm_mul_ps(g11y, yo1));
+
+        const auto low = Lerp4(dot_00, dot_01, yb);
+        const auto high = Lerp4(dot_10, dot_11, yb);
+        const auto val = Lerp4(low, high, xb);
+
+        const auto low_dx = Lerp4(g00x, g01x, yb);
+        const auto high_dx = Lerp4(g10x, g11x, yb);
+        const auto dx = _mm_add_ps(Lerp4(low_dx, high_dx, xb),
+                                   _mm_mul_ps(xbs, _mm_sub_ps(high, low)));
+        const auto low_dy =
+            _mm_add_ps(Lerp4(g00y, g01y, yb),
+                       _mm_mul_ps(ybs, _mm_sub_ps(dot_01, dot_00)));
+        const auto high_dy =
+            _mm_add_ps(Lerp4(g10y, g11y, yb),
+                       _mm_mul_ps(ybs, _mm_sub_ps(dot_11, dot_10)));
+        const auto dy = Lerp4(low_dy, high_dy, xb);
+
+        Accumulate4(x + y * width, amplitude4, slope_amplitude4, dx, dy, val,
+                    height, slope_x, slope_y);
+      }
+    }
+#endif
+
+    for (; x < width; ++x) {
+      const auto corner = row + columns[x];
+      const auto noise = PerlinCell(
+          majors[corner], majors[corner + row_width], majors[corner + 1],
+          majors[corner + row_width + 1], lattice.x_offsets[x], y_offset);
+      Accumulate(x + y * width, amplitude, slope_amplitude, noise, height,
+                 slope_x, slope_y);
+    }
+  }
+}
+
+void ValueEngine::AddOctave(const mt19937::result_type seed,
+                            const OctaveLattice &lattice, const float amplitude,
+                            float *height, float *slope_x,
+                            float *slope_y) const {
+  const auto octave = static_cast<uint32_t>(lattice.detail);
+  size_t row_width;
+  const auto values = CornerTable<float>(
+      lattice, &row_width, [seed, octave](int64_t x, int64_t y) {
+        return LatticeValue(seed, octave, x, y);
+      });
+  const auto columns = CornerColumns(lattice);
+  const auto width = lattice.major_x.size();
+  const auto length = lattice.major_y.size();
+  const auto slope_amplitude = amplitude / static_cast<float>(lattice.detail);
+
+  vector<float> x_blends(width);
+  vector<float> x_blend_slopes(width);
+  for (size_t x = 0; x < width; ++x) {
+    x_blends[x] = SmootherStep(lattice.x_offsets[x]);
+    x_blend_slopes[x] = SmootherStepSlope(lattice.x_offsets[x]);
+  }
+
+#ifdef __SSE2__
+  const auto amplitude4 = _mm_set1_ps(amplitude);
+  const auto slope_amplitude4 = _mm_set1_ps(slope_amplitude);
+#endif
+
+  for (size_t y = 0; y < length; ++y) {
+    const auto row = static_cast<size_t>(lattice.major_y[y] -
+                                         lattice.major_y[0]) *
+                     row_width;
+    const auto y_blend = SmootherStep(lattice.y_offsets[y]);
+    const auto y_blend_slope = SmootherStepSlope(lattice.y_offsets[y]);
+    size_t x = 0;
+
+#ifdef __SSE2__
+    if (simd_) {
+      const auto yb = _mm_set1_ps(y_blend);
+      const auto ybs = _mm_set1_ps(y_blend_slope);
+      for (; x + 4 <= width; x += 4) {
+        const float *c[4];
+        for (size_t lane = 0; lane < 4; ++lane) {
+          c[lane] = &values[row + columns[x + lane]];
+        }
+        const auto w = row_width;
+        const auto v00 = _mm_setr_ps(c[0][0], c[1][0], c[2][0], c[3][0]);
+        const auto v01 = _mm_setr_ps(c[0][w], c[1][w], c[2][w], c[3][w]);
+        const auto v10 = _mm_setr_ps(c[0][1], c[1][1], c[2][1], c[3][1]);
+        const auto v11 =
+            _mm_setr_ps(c[0][w + 1], c[1][w + 1], c[2][w + 1], c[3][w + 1]);
+        const auto xb = _mm_loadu_ps(&x_blends[x]);
+        const auto xbs = _mm_loadu_ps(&x_blend_slopes[x]);
+
+        const auto low = Lerp4(v00, v01, yb);
+        const auto high = Lerp4(v10, v11, yb);
+        const auto val = Lerp4(low, high, xb);
+        const auto dx = _mm_mul_ps(xbs, _mm_sub_ps(high, low));
+        const auto low_dy = _mm_mul_ps(ybs, _mm_sub_ps(v01, v00));
+        const auto high_dy = _mm_mul_ps(ybs, _mm_sub_ps(v11, v10));
+        const auto dy = Lerp4(low_dy, high_dy, xb);
+
+        Accumulate4(x + y * width, amplitude4, slope_amplitude4, dx, dy, val,
+                    height, slope_x, slope_y);
+      }
+    }
+#endif
+
+    for (; x < width; ++x) {
+      const auto corner = row + columns[x];
+      const auto v00 = values[corner];
+      const auto v01 = values[corner + row_width];
+      const auto v10 = values[corner + 1];
+      const auto v11 = values[corner + row_width + 1];
+      const auto low = v00 + y_blend * (v01 - v00);
+      const auto high = v10 + y_blend * (v11 - v10);
+      const auto low_dy = y_blend_slope * (v01 - v00);
+      const auto high_dy = y_blend_slope * (v11 - v10);
+      const glm::vec3 noise{x_blend_slopes[x] * (high - low),
+                            low_dy + x_blends[x] * (high_dy - low_dy),
+                            low + x_blends[x] * (high - low)};
+      Accumulate(x + y * width, amplitude, slope_amplitude, noise, height,
+                 slope_x, slope_y);
+    }
+  }
+}
+
+// Lattice position of a sample skewed onto the triangular lattice, so the cell
+// containing it is found by rounding down
+static inline double Skewed(const double position, const double other) {
+  return position + (position + other) * kSkew;
+}
+
+void SimplexEngine::AddOctave(const mt19937::result_type seed,
+                              const OctaveLattice &lattice,
+                              const float amplitude, float *height,
+                              float *slope_x, float *slope_y) const {
+  const auto octave = static_cast<uint32_t>(lattice.detail);
+  const auto width = lattice.major_x.size();
+  const auto length = lattice.major_y.size();
+  const auto slope_amplitude = amplitude / static_cast<float>(lattice.detail);
+
+  // Positions only grow along each axis, so the corners of the rectangle bound
+  // the skewed cells of every sample in it (with a cell to spare for rounding)
+  vector<double> xs(width);
+  for (size_t x = 0; x < width; ++x) {
+    xs[x] = static_cast<double>(lattice.major_x[x]) + lattice.x_offsets[x];
+  }
+  vector<double> ys(length);
+  for (size_t y = 0; y < length; ++y) {
+    ys[y] = static_cast<double>(lattice.major_y[y]) + lattice.y_offsets[y];
+  }
+  const auto first_i =
+      static_cast<int64_t>(floor(Skewed(xs.front(), ys.front()))) - 1;
+  const auto first_j =
+      static_cast<int64_t>(floor(Skewed(ys.front(), xs.front()))) - 1;
+  const auto row_width =
+      static_cast<size_t>(floor(Skewed(xs.back(), ys.back())) - first_i) + 3;
+  const auto rows =
+      static_cast<size_t>(floor(Skewed(ys.back(), xs.back())) - first_j) + 3;
+  vector<glm::vec2> gradients(row_width * rows);
+  for (size_t j = 0; j < rows; ++j) {
+    for (size_t i = 0; i < row_width; ++i) {
+      gradients[i + j * row_width] =
+          LatticeGradient(seed, octave, first_i + static_cast<int64_t>(i),
+                          first_j + static_cast<int64_t>(j));
+    }
+  }
+
+  // The three corners of the triangle around each sample in a row, as the
+  // offset of the sample from the corner and the gradient there
+  vector<float> offset_x[3];
+  vector<float> offset_y[3];
+  vector<float> gradient_x[3];
+  vector<float> gradient_y[3];
+  for (size_t k = 0; k < 3; ++k) {
+    offset_x[k].resize(width);
+    offset_y[k].resize(width);
+    gradient_x[k].resize(width);
+    gradient_y[k].resize(width);
+  }
+  const auto unskew = static_cast<float>(kUnskew);
+
+#ifdef __SSE2__
+  const auto zero = _mm_setzero_ps();
+  const auto half = _mm_set1_ps(0.5f);
+  const auto eight = _mm_set1_ps(8);
+  const auto scale = _mm_set1_ps(kSimplexScale);
+  const auto amplitude4 = _mm_set1_ps(amplitude);
+  const auto slope_amplitude4 = _mm_set1_ps(slope_amplitude);
+#endif
+
+  for (size_t y = 0; y < length; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      const auto i = floor(Skewed(xs[x], ys[y]));
+      const auto j = floor(Skewed(ys[y], xs[x]));
+      const auto unskewed = (i + j) * kUnskew;
+      const auto x0 = static_cast<float>(xs[x] - (i - unskewed));
+      const auto y0 = static_cast<float>(ys[y] - (j - unskewed));
+      // Lower or upper triangle of the skewed cell
+      const auto i1 = x0 > y0 ? 1 : 0;
+      const auto j1 = 1 - i1;
+      const auto corner = static_cast<size_t>(static_cast<int64_t>(i) -
+                                              first_i) +
+                          static_cast<size_t>(static_cast<int64_t>(j) -
+                                              first_j) *
+                              row_width;
+
+      offset_x[0][x] = x0;
+      offset_y[0][x] = y0;
+      offset_x[1][x] = x0 - static_cast<float>(i1) + unskew;
+      offset_y[1][x] = y0 - static_cast<float>(j1) + unskew;
+      offset_x[2][x] = x0 - 1 + 2 * unskew;
+      offset_y[2][x] = y0 - 1 + 2 * unskew;
+      const glm::vec2 *g[3]{
+          &gradients[corner],
+          &gradients[corner + static_cast<size_t>(i1) +
+                     static_cast<size_t>(j1) * row_width],
+          &gradients[corner + 1 + row_width]};
+      for (size_t k = 0; k < 3; ++k) {
+        gradient_x[k][x] = g[k]->x;
+        gradient_y[k][x] = g[k]->y;
+      }
+    }
+
+    size_t x = 0;
+
+#ifdef __SSE2__
+    if (simd_) {
+      for (; x + 4 <= width; x += 4) {
+        auto val = zero;
+        auto dx = zero;
+        auto dy = zero;
+        for (size_t k = 0; k < 3; ++k) {
+          const auto ox = _mm_loadu_ps(&offset_x[k][x]);
+          const auto oy = _mm_loadu_ps(&offset_y[k][x]);
+          const auto gx = _mm_loadu_ps(&gradient_x[k][x]);
+          const auto gy = _mm_loadu_ps(&gradient_y[k][x]);
+          const auto t = _mm_max_ps(
+              _mm_sub_ps(_mm_sub_ps(half, _mm_mul_ps(ox, ox)),
+                         _mm_mul_ps(oy, oy)),
+              zero);
+          const auto t2 = _mm_mul_ps(t, t);
+          const auto t3 = _mm_mul_ps(t2, t);
+          const auto t4 = _mm_mul_ps(t2, t2);
+          const auto dot = _mm_add_ps(_mm_mul_ps(gx, ox), _mm_mul_ps(gy, oy));
+          const auto falloff = _mm_mul_ps(_mm_mul_ps(eight, t3), dot);
+          val = _mm_add_ps(val, _mm_mul_ps(t4, dot));
+          dx = _mm_add_ps(dx, _mm_sub_ps(_mm_mul_ps(t4, gx),
+                                         _mm_mul_ps(falloff, ox)));
+          dy = _mm_add_ps(dy, _mm_sub_ps(_mm_mul_ps(t4, gy),
+                                         _mm_mul_ps(falloff, oy)));
+        }
+        Accumulate4(x + y * width, amplitude4, slope_amplitude4,
+                    _mm_mul_ps(scale, dx), _mm_mul_ps(scale, dy),
+                    _mm_mul_ps(scale, val), height, slope_x, slope_y);
+      }
+    }
+#endif
+
+    for (; x < width; ++x) {
+      glm::vec3 noise{0, 0, 0};
+      for (size_t k = 0; k < 3; ++k) {
+        const auto ox = offset_x[k][x];
+        const auto oy = offset_y[k][x];
+        const auto gx = gradient_x[k][x];
+        const auto gy = gradient_y[k][x];
+        // Each corner only reaches samples within sqrt(0.5) of it
+        const auto t = std::max(0.5f - ox * ox - oy * oy, 0.0f);
+        const auto t2 = t * t;
+        const auto t3 = t2 * t;
+        const auto t4 = t2 * t2;
+        const auto dot = gx * ox + gy * oy;
+        const auto falloff = 8 * t3 * dot;
+        noise.z += t4 * dot;
+        noise.x += t4 * gx - falloff * ox;
+        noise.y += t4 * gy - falloff * oy;
+      }
+      Accumulate(x + y * width, amplitude, slope_amplitude,
+                 kSimplexScale * noise, height, slope_x, slope_y);
+    }
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+enum class NoiseType : std::uint32_t { kPerlin, kSimplex, kValue };
+constexpr std::size_t kNoiseTypeCount{3};
+
+const char *NoiseName(NoiseType);
+// The type NoiseName gives name, false for any other name
+bool ParseNoise(const std::string &name, NoiseType *);
+
+// Every column and row of a rectangle of samples located on the lattice of a
+// single octave, as the index of the lattice cell and the offset into it
+struct OctaveLattice {
+  std::size_t detail;
+  // Samples are at whole world positions starting from first_x, first_y and
+  // detail is 1 << shift, so every cell holds the same run of offsets
+  bool aligned;
+  std::size_t shift;
+  std::int64_t first_x;
+  std::int64_t first_y;
+  std::vector<std::int64_t> major_x;
+  std::vector<float> x_offsets;
+  std::vector<std::int64_t> major_y;
+  std::vector<float> y_offsets;
+};
+
+// A kind of gradient or value noise that NoiseField sums octaves of. Each
+// engine has a scalar implementation and a SIMD one (SSE2, falling back on the
+// scalar one where it is unavailable) that produce identical results.
+class NoiseEngine {
+ public:
+  virtual ~NoiseEngine() = default;
+
+  static std::unique_ptr<NoiseEngine> Create(NoiseType, bool = true);
+
+  // Adds amplitude times the noise of the octave to the row-major height, and
+  // its slopes per world unit to slope_x and slope_y unless they are null
+  virtual void AddOctave(std::mt19937::result_type, const OctaveLattice &,
+                         float, float *, float *, float *) const = 0;
+
+ protected:
+  explicit NoiseEngine(bool simd) : simd_(simd) {}
+
+  bool simd_;
+};
+
+// Classic gradient noise on a square lattice
+class PerlinEngine : public NoiseEngine {
+ public:
+  explicit PerlinEngine(bool simd) : NoiseEngine(simd) {}
+
+  void AddOctave(std::mt19937::result_type, const OctaveLattice &, float,
+                 float *, float *, float *) const override;
+};
+
+// Gradient noise on a triangular lattice, three corners per sample instead of
+// four and no interpolation
+class SimplexEngine : public NoiseEngine {
+ public:
+  explicit SimplexEngine(bool simd) : NoiseEngine(simd) {}
+
+  void AddOctave(std::mt19937::result_type, const OctaveLattice &, float,
+                 float *, float *, float *) const override;
+};
+
+// Random values at the corners of a square lattice, smoothly interpolated
+class ValueEngine : public NoiseEngine {
+ public:
+  explicit ValueEngine(bool simd) : NoiseEngine(simd) {}
+
+  void AddOctave(std::mt19937::result_type, const OctaveLattice &, float,
+                 float *, float *, float *) const override;
+};
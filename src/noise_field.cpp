@@ -0,0 +1,94 @@
+#include "noise_field.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "constants.h"
+
+using namespace std;
+
+void NoiseField::Evaluate(const int64_t first_x, const int64_t first_y,
+                          const double spacing, const size_t width,
+                          const size_t length, float *height, float *slope_x,
+                          float *slope_y) const {
+  const auto samples = width * length;
+  fill(height, height + samples, 0.0f);
+  if (slope_x != nullptr) {
+    fill(slope_x, slope_x + samples, 0.0f);
+    fill(slope_y, slope_y + samples, 0.0f);
+  }
+
+  // Each octave has half the period and half the amplitude of the last
+  OctaveLattice lattice;
+  for (size_t factor = 0; (kDetail >> factor) > kMinDetail; ++factor) {
+    lattice.detail = kDetail >> factor;
+    Place(first_x, first_y, spacing, width, length, &lattice);
+    engine_->AddOctave(seed_, lattice, 1 / static_cast<float>(1 << factor),
+                       height, slope_x, slope_y);
+  }
+
+  for (size_t i = 0; i < samples; ++i) {
+    height[i] *= kHeightMultiplier;
+  }
+  if (slope_x != nullptr) {
+    for (size_t i = 0; i < samples; ++i) {
+      slope_x[i] *= kHeightMultiplier;
+      slope_y[i] *= kHeightMultiplier;
+    }
+  }
+}
+
+void NoiseField::Place(const int64_t first_x, const int64_t first_y,
+                       const double spacing, const size_t width,
+                       const size_t length, OctaveLattice *lattice) {
+  const auto detail = lattice->detail;
+  lattice->aligned = spacing == 1 && (detail & (detail - 1)) == 0;
+  lattice->shift = 0;
+  while ((size_t{1} << lattice->shift) < detail) {
+    ++lattice->shift;
+  }
+  lattice->first_x = first_x;
+  lattice->first_y = first_y;
+  lattice->major_x.resize(width);
+  lattice->x_offsets.resize(width);
+  lattice->major_y.resize(length);
+  lattice->y_offsets.resize(length);
+  Locate(first_x, spacing, *lattice, width, &lattice->major_x,
+         &lattice->x_offsets);
+  Locate(first_y, spacing, *lattice, length, &lattice->major_y,
+         &lattice->y_offsets);
+}
+
+// Finds the lattice cell containing each of count samples along one axis,
+// and the offset of the sample into that cell
+void NoiseField::Locate(const int64_t first, const double spacing,
+                        const OctaveLattice &lattice, const size_t count,
+                        vector<int64_t> *majors, vector<float> *offsets) {
+  const auto detail = lattice.detail;
+  if (lattice.aligned) {
+    // Whole positions on a power of two lattice, the same results as below
+    // (every step is exact) with a mask instead of a divide
+    const auto mask = static_cast<int64_t>(detail) - 1;
+    for (size_t i = 0; i < count; ++i) {
+      const auto position = first + static_cast<int64_t>(i);
+      const auto minor = position & mask;
+      (*majors)[i] = (position - minor) / static_cast<int64_t>(detail);
+      (*offsets)[i] = static_cast<float>(
+          (static_cast<double>(minor) + kNoiseOffset) /
+          static_cast<double>(detail));
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    // Offsets by half a unit so samples at whole positions never land on a
+    // lattice corner, where the noise is always 0
+    const auto position =
+        (static_cast<double>(first + static_cast<int64_t>(i)) * spacing +
+         kNoiseOffset) /
+        static_cast<double>(detail);
+    const auto major = floor(position);
+    (*majors)[i] = static_cast<int64_t>(major);
+    (*offsets)[i] = static_cast<float>(position - major);
+  }
+}
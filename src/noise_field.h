@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "noise_engine.h"
+
+// The summed octaves of noise making up the terrain, defined over
+// continuous world coordinates rather than per tile. Any rectangle of samples
+// can be evaluated on its own, at any resolution, and agrees exactly with every
+// other rectangle wherever their sample positions coincide.
+class NoiseField {
+ public:
+  explicit NoiseField(std::mt19937::result_type seed,
+                      NoiseType type = NoiseType::kPerlin, bool simd = true)
+      : seed_(seed), engine_(NoiseEngine::Create(type, simd)) {}
+
+  // Samples the width x length rectangle at world positions
+  // ((first_x + i) * spacing, (first_y + j) * spacing), writing row-major
+  // heights and, unless they are null, slopes per world unit. Positions are
+  // only guaranteed to agree between rectangles when they are exactly
+  // representable, i.e. spacing is a power of two.
+  void Evaluate(std::int64_t, std::int64_t, double, std::size_t, std::size_t,
+                float *, float * = nullptr, float * = nullptr) const;
+
+  // Fills in where the same rectangle of samples falls on the lattice of the
+  // octave with period lattice->detail
+  static void Place(std::int64_t, std::int64_t, double, std::size_t,
+                    std::size_t, OctaveLattice *);
+
+ private:
+  static void Locate(std::int64_t, double, const OctaveLattice &, std::size_t,
+                     std::vector<std::int64_t> *, std::vector<float> *);
+
+  std::mt19937::result_type seed_;
+  std::unique_ptr<NoiseEngine> engine_;
+};
@@ -1,5 +1,12 @@
 #pragma once
 
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
 // Based on Ken Perlin's smoother step function:
 // https://en.wikipedia.org/wiki/Smoothstep#Variations Returns value in range
 // [0, 1]
@@ -14,6 +21,14 @@ inline constexpr float SmootherStep(const float x) {
   return x * x * x * (x * (6 * x - 15) + 10);
 }
 
+// Derivative of SmootherStep, 0 outside of [0, 1]
+inline constexpr float SmootherStepSlope(const float x) {
+  if (x < 0 || x > 1) {
+    return 0;
+  }
+  return 30 * x * x * (x - 1) * (x - 1);
+}
+
 // Interpolates between two doubles
 // If x <= 0 returns bound_0, if x >= 1 returns bound_1,
 // otherwise smoothly transitions between the two
@@ -21,3 +36,97 @@ inline constexpr float Interpolate(const float x, const float bound_0,
                                    const float bound_1) {
   return bound_0 + SmootherStep(x) * (bound_1 - bound_0);
 }
+
+// PCG hash, from "Hash Functions for GPU Rendering" by Jarzynski and Olano:
+// https://jcgt.org/published/0009/03/02/
+inline constexpr std::uint32_t PcgHash(const std::uint32_t input) {
+  const std::uint32_t state = input * 747796405u + 2891336453u;
+  const std::uint32_t word =
+      ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Stateless hash of a lattice corner, the same inputs always give the same
+// result no matter which tile or thread asks for it
+inline constexpr std::uint32_t LatticeHash(const std::uint64_t seed,
+                                           const std::uint32_t octave,
+                                           const std::int64_t x,
+                                           const std::int64_t y) {
+  auto hash = PcgHash(static_cast<std::uint32_t>(seed ^ (seed >> 32)));
+  hash = PcgHash(hash ^ octave);
+  hash = PcgHash(hash + static_cast<std::uint32_t>(x));
+  return PcgHash(hash ^ static_cast<std::uint32_t>(y));
+}
+
+// Value in [-1, 1) for a lattice corner, from the top 24 bits of its hash
+inline float LatticeValue(const std::uint64_t seed, const std::uint32_t octave,
+                          const std::int64_t x, const std::int64_t y) {
+  return static_cast<float>(LatticeHash(seed, octave, x, y) >> 8) /
+             static_cast<float>(1 << 23) -
+         1;
+}
+
+// Unit gradient vectors spread evenly around the circle
+constexpr std::size_t kGradientCount{256};
+
+inline const std::array<glm::vec2, kGradientCount> &Gradients() {
+  static const auto gradients = [] {
+    std::array<glm::vec2, kGradientCount> result{};
+    for (std::size_t i = 0; i < kGradientCount; ++i) {
+      const auto angle = glm::two_pi<float>() * static_cast<float>(i) /
+                         static_cast<float>(kGradientCount);
+      result[i] = {std::cos(angle), std::sin(angle)};
+    }
+    return result;
+  }();
+  return gradients;
+}
+
+inline const glm::vec2 &LatticeGradient(const std::uint64_t seed,
+                                        const std::uint32_t octave,
+                                        const std::int64_t x,
+                                        const std::int64_t y) {
+  return Gradients()[LatticeHash(seed, octave, x, y) % kGradientCount];
+}
+
+// Perlin noise within a single lattice cell, given the vectors at its corners
+// (indexed by whether they are on the high x and high y side) and the offset
+// of the point into the cell. Implementation based on:
+// https://en.wikipedia.org/wiki/Perlin_noise
+// Returns the noise in z, and its exact derivatives with respect to the
+// offset in x and y.
+inline glm::vec3 PerlinCell(const glm::vec2 &major_00,
+                            const glm::vec2 &major_01,
+                            const glm::vec2 &major_10,
+                            const glm::vec2 &major_11, const float x_offset,
+                            const float y_offset) {
+  const float x_blend = SmootherStep(x_offset);
+  const float x_blend_slope = SmootherStepSlope(x_offset);
+  const float y_blend = SmootherStep(y_offset);
+  const float y_blend_slope = SmootherStepSlope(y_offset);
+
+  // Dot products of the offset vector of the point with each corner vector
+  const auto dot_00 = major_00.x * x_offset + major_00.y * y_offset;
+  const auto dot_01 = major_01.x * x_offset + major_01.y * (y_offset - 1);
+  const auto dot_10 = major_10.x * (x_offset - 1) + major_10.y * y_offset;
+  const auto dot_11 = major_11.x * (x_offset - 1) + major_11.y * (y_offset - 1);
+
+  // Interpolates between the dot products, first along y then along x
+  const auto low = Interpolate(y_offset, dot_00, dot_01);
+  const auto high = Interpolate(y_offset, dot_10, dot_11);
+  const auto val = Interpolate(x_offset, low, high);
+
+  // Product rule through both interpolations, each dot product changes with
+  // the offset by its corner vector
+  const auto low_dx = major_00.x + y_blend * (major_01.x - major_00.x);
+  const auto high_dx = major_10.x + y_blend * (major_11.x - major_10.x);
+  const auto dx =
+      low_dx + x_blend * (high_dx - low_dx) + x_blend_slope * (high - low);
+  const auto low_dy = major_00.y + y_blend * (major_01.y - major_00.y) +
+                      y_blend_slope * (dot_01 - dot_00);
+  const auto high_dy = major_10.y + y_blend * (major_11.y - major_10.y) +
+                       y_blend_slope * (dot_11 - dot_10);
+  const auto dy = low_dy + x_blend * (high_dy - low_dy);
+
+  return {dx, dy, val};
+}
@@ -0,0 +1,141 @@
+#include "normal_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <glm/glm.hpp>
+#include <thread>
+#include <vector>
+
+#include "grid.h"
+
+using namespace std;
+
+// Calls bake(first, last) for bands of rows of blocks, one thread each
+static void ForBlockRows(const size_t threads,
+                         const function<void(size_t, size_t)> &bake) {
+  if (threads <= 1) {
+    bake(0, kMapBlocksLong);
+    return;
+  }
+
+  const auto band = (kMapBlocksLong + threads - 1) / threads;
+  vector<thread> workers;
+  for (size_t row = 0; row < kMapBlocksLong; row += band) {
+    const auto last = std::min(row + band, kMapBlocksLong);
+    workers.emplace_back([&bake, row, last] { bake(row, last); });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+static uint8_t Quantize(const float value) {
+  return static_cast<uint8_t>(glm::clamp(value, 0.0f, 1.0f) * 255 + 0.5f);
+}
+
+// One RGTC channel of a block, 8 bytes: the highest and lowest value, then a
+// 3-bit code per texel picking one of 8 evenly spaced values between them.
+// Code 0 is the highest value, 1 the lowest and 2 to 7 step from the highest
+// down to the lowest.
+static void EncodeChannel(const uint8_t *values, uint8_t *block) {
+  const auto low = *min_element(values, values + 16);
+  const auto high = *max_element(values, values + 16);
+  uint64_t codes = 0;
+  if (high > low) {
+    const auto range = high - low;
+    for (auto i = 0; i < 16; ++i) {
+      // Nearest of the 8 values, counting up from the lowest
+      const auto step = (14 * (values[i] - low) + range) / (2 * range);
+      const uint64_t code = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+      codes |= code << (3 * i);
+    }
+  }
+  block[0] = high;
+  block[1] = low;
+  for (auto byte = 0; byte < 6; ++byte) {
+    block[2 + byte] = static_cast<uint8_t>(codes >> (8 * byte));
+  }
+}
+
+// Calls texel(x, y, i) for the vertex under each texel i of block (x, y),
+// padding texels repeat the last row or column of the tile
+template <typename Texel>
+static void ForBlockTexels(const size_t block_x, const size_t block_y,
+                           const Texel &texel) {
+  for (size_t row = 0; row < 4; ++row) {
+    const auto y = std::min(block_y * 4 + row, kGeographyLong - 1);
+    for (size_t column = 0; column < 4; ++column) {
+      const auto x = std::min(block_x * 4 + column, kGeographyShort - 1);
+      texel(x, y, column + row * 4);
+    }
+  }
+}
+
+void BakeNormalMap(const float *slope_x, const float *slope_y,
+                   const size_t threads, uint8_t *map) {
+  ForBlockRows(threads, [=](const size_t first, const size_t last) {
+    uint8_t normal_x[16], normal_y[16];
+    for (auto block_y = first; block_y < last; ++block_y) {
+      for (size_t block_x = 0; block_x < kMapBlocksShort; ++block_x) {
+        ForBlockTexels(block_x, block_y, [&](size_t x, size_t y, size_t i) {
+          // Same as the vertex normals written by Grid
+          const auto normal = glm::normalize(
+              glm::vec3(-slope_x[index(x, y)], -slope_y[index(x, y)], 1));
+          normal_x[i] = Quantize(normal.x * 0.5f + 0.5f);
+          normal_y[i] = Quantize(normal.y * 0.5f + 0.5f);
+        });
+        const auto block = map + (block_x + block_y * kMapBlocksShort) * 16;
+        EncodeChannel(normal_x, block);
+        EncodeChannel(normal_y, block + 8);
+      }
+    }
+  });
+}
+
+// The sine of the highest elevation of the terrain seen from vertex (x, y)
+// looking along (dx, dy), nothing below the horizontal counts. Steps double in
+// length, near terrain matters most.
+static float Horizon(const float *height, const size_t x, const size_t y,
+                     const int dx, const int dy) {
+  const auto origin = height[index(x, y)];
+  const auto step = sqrt(static_cast<float>(dx * dx + dy * dy));
+  auto highest = 0.0f;
+  for (size_t distance = 1; distance <= kHorizonDistance; distance *= 2) {
+    const auto reach = static_cast<int64_t>(distance);
+    const auto to_x = static_cast<int64_t>(x) + dx * reach;
+    const auto to_y = static_cast<int64_t>(y) + dy * reach;
+    if (to_x < 0 || to_y < 0 ||
+        to_x >= static_cast<int64_t>(kGeographyShort) ||
+        to_y >= static_cast<int64_t>(kGeographyLong)) {
+      break;
+    }
+    const auto rise =
+        (height[index(static_cast<size_t>(to_x), static_cast<size_t>(to_y))] -
+         origin) /
+        (step * static_cast<float>(distance));
+    highest = std::max(highest, rise);
+  }
+  return highest / sqrt(1 + highest * highest);
+}
+
+void BakeOcclusionMap(const float *height, const size_t threads,
+                      uint8_t *map) {
+  constexpr int kDirections[8][2] = {{1, 0},  {1, 1},   {0, 1},  {-1, 1},
+                                     {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+  ForBlockRows(threads, [=](const size_t first, const size_t last) {
+    uint8_t sky[16];
+    for (auto block_y = first; block_y < last; ++block_y) {
+      for (size_t block_x = 0; block_x < kMapBlocksShort; ++block_x) {
+        ForBlockTexels(block_x, block_y, [&](size_t x, size_t y, size_t i) {
+          auto hidden = 0.0f;
+          for (const auto &direction : kDirections) {
+            hidden += Horizon(height, x, y, direction[0], direction[1]);
+          }
+          sky[i] = Quantize(1 - hidden / 8);
+        });
+        EncodeChannel(sky, map + (block_x + block_y * kMapBlocksShort) * 8);
+      }
+    }
+  });
+}
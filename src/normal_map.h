@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "constants.h"
+
+// Baked maps are RGTC compressed, one texel per vertex of the tile in blocks
+// of 4x4 texels, the last row and column of blocks padded with the edge
+constexpr std::size_t kMapBlocksShort{(kGeographyShort + 3) / 4};
+constexpr std::size_t kMapBlocksLong{(kGeographyLong + 3) / 4};
+// RGTC2, 16 bytes per block for two channels
+constexpr std::size_t kNormalMapBytes{kMapBlocksShort * kMapBlocksLong * 16};
+// RGTC1, 8 bytes per block for one channel
+constexpr std::size_t kOcclusionMapBytes{kMapBlocksShort * kMapBlocksLong * 8};
+
+// x and y of the unit normal of each vertex, from the slope Grids of the tile,
+// mapped from [-1, 1] to [0, 1]. z is positive on a heightfield and recovered
+// from the other two. Rows of blocks are split over up to the given number of
+// threads.
+void BakeNormalMap(const float *slope_x, const float *slope_y,
+                   std::size_t threads, std::uint8_t *map);
+// Fraction of the sky each vertex sees from the heights of the tile, by how
+// high the horizon rises within kHorizonDistance cells in each of 8
+// directions. Looks no further than the edges of the tile.
+void BakeOcclusionMap(const float *height, std::size_t threads,
+                      std::uint8_t *map);
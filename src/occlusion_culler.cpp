@@ -0,0 +1,244 @@
+#include "occlusion_culler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+static_assert((kOcclusionWidth & (kOcclusionWidth - 1)) == 0 &&
+                  (kOcclusionHeight & (kOcclusionHeight - 1)) == 0,
+              "The occlusion buffer halves evenly down to a single pixel");
+
+// Nothing has been drawn at this depth
+constexpr float kEmpty{numeric_limits<float>::max()};
+
+static inline size_t LevelWidth(const size_t level) {
+  return std::max<size_t>(kOcclusionWidth >> level, 1);
+}
+
+static inline size_t LevelHeight(const size_t level) {
+  return std::max<size_t>(kOcclusionHeight >> level, 1);
+}
+
+OcclusionCuller::OcclusionCuller() {
+  for (size_t level = 0;; ++level) {
+    levels_.emplace_back(LevelWidth(level) * LevelHeight(level));
+    if (LevelWidth(level) == 1 && LevelHeight(level) == 1) {
+      break;
+    }
+  }
+}
+
+void OcclusionCuller::Begin(const glm::mat4 &view_projection,
+                            const glm::vec3 &eye) {
+  viewProjection_ = view_projection;
+  eye_ = eye;
+  fill(levels_[0].begin(), levels_[0].end(), kEmpty);
+}
+
+// Corner i of a box has the high x, y and z when bit 0, 1 and 2 is set
+static void Corners(const glm::mat4 &view_projection, const glm::vec3 &low,
+                    const glm::vec3 &high, glm::vec4 *corners) {
+  for (size_t i = 0; i < 8; ++i) {
+    corners[i] = view_projection * glm::vec4(i & 1 ? high.x : low.x,
+                                             i & 2 ? high.y : low.y,
+                                             i & 4 ? high.z : low.z, 1);
+  }
+}
+
+// Whether every corner is beyond the same plane of the frustum
+static bool Outside(const glm::vec4 *corners) {
+  auto planes = 0x3f;
+  for (size_t i = 0; i < 8 && planes != 0; ++i) {
+    const auto &c = corners[i];
+    planes &= (c.w + c.x < 0) | (c.w - c.x < 0) << 1 | (c.w + c.y < 0) << 2 |
+              (c.w - c.y < 0) << 3 | (c.w + c.z < 0) << 4 |
+              (c.w - c.z < 0) << 5;
+  }
+  return planes != 0;
+}
+
+void OcclusionCuller::AddOccluder(const glm::vec3 &low, const glm::vec3 &high) {
+  glm::vec4 corners[8];
+  Corners(viewProjection_, low, high, corners);
+  if (Outside(corners)) {
+    return;
+  }
+  const auto draw = [this, &corners](size_t a, size_t b, size_t c, size_t d) {
+    const glm::vec4 face[] = {corners[a], corners[b], corners[c], corners[d]};
+    DrawPolygon(face, 4);
+  };
+  // Boxes stand on the terrain, so their bottoms are never seen
+  if (eye_.z > high.z) {
+    draw(4, 5, 7, 6);
+  }
+  if (eye_.x < low.x) {
+    draw(0, 2, 6, 4);
+  } else if (eye_.x > high.x) {
+    draw(1, 3, 7, 5);
+  }
+  if (eye_.y < low.y) {
+    draw(0, 1, 5, 4);
+  } else if (eye_.y > high.y) {
+    draw(2, 3, 7, 6);
+  }
+}
+
+// Draws a convex, planar polygon given in clip space
+void OcclusionCuller::DrawPolygon(const glm::vec4 *clip, const size_t count) {
+  // Cut away whatever is in front of the near plane (z < -w)
+  glm::vec4 kept[8];
+  size_t kept_count = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const auto &a = clip[i];
+    const auto &b = clip[(i + 1) % count];
+    const auto da = a.z + a.w;
+    const auto db = b.z + b.w;
+    if (da >= 0) {
+      kept[kept_count++] = a;
+    }
+    if ((da >= 0) != (db >= 0)) {
+      kept[kept_count++] = a + (b - a) * (da / (da - db));
+    }
+  }
+  if (kept_count < 3) {
+    return;
+  }
+
+  // Pixel coordinates, pixel (x, y) spans [x, x + 1) x [y, y + 1)
+  glm::vec3 screen[8];
+  auto min_x = numeric_limits<float>::max(), max_x = -min_x;
+  auto min_y = min_x, max_y = max_x;
+  for (size_t i = 0; i < kept_count; ++i) {
+    const auto &v = kept[i];
+    screen[i] = {(v.x / v.w * 0.5f + 0.5f) * kOcclusionWidth,
+                 (v.y / v.w * 0.5f + 0.5f) * kOcclusionHeight, v.z / v.w};
+    min_x = std::min(min_x, screen[i].x);
+    max_x = std::max(max_x, screen[i].x);
+    min_y = std::min(min_y, screen[i].y);
+    max_y = std::max(max_y, screen[i].y);
+  }
+
+  // Depth is linear in pixel coordinates over the polygon, its slope follows
+  // from the polygon's normal, which is edge on when that is flat
+  glm::vec3 normal{0, 0, 0};
+  for (size_t i = 0; i < kept_count; ++i) {
+    normal += glm::cross(screen[i], screen[(i + 1) % kept_count]);
+  }
+  if (abs(normal.z) < 1e-6f) {
+    return;
+  }
+  const auto slope_x = -normal.x / normal.z;
+  const auto slope_y = -normal.y / normal.z;
+  // Farthest depth over a pixel, relative to its first corner
+  const auto deepest = std::max(slope_x, 0.0f) + std::max(slope_y, 0.0f);
+  const auto sign = normal.z > 0 ? 1.0f : -1.0f;
+
+  const auto first_y = static_cast<int>(std::max(floor(min_y), 0.0f));
+  const auto last_y = static_cast<int>(
+      std::min(ceil(max_y), static_cast<float>(kOcclusionHeight))) - 1;
+  auto &depth = levels_[0];
+  for (auto y = first_y; y <= last_y; ++y) {
+    // Pixels of the row inside every edge even at their corner farthest
+    // outside it, each edge bounds x from one side
+    auto left = std::max(floor(min_x), 0.0f);
+    auto right = std::min(ceil(max_x), static_cast<float>(kOcclusionWidth)) - 1;
+    for (size_t i = 0; i < kept_count && left <= right; ++i) {
+      const auto &a = screen[i];
+      const auto &b = screen[(i + 1) % kept_count];
+      const auto edge_x = -sign * (b.y - a.y);
+      const auto edge_y = sign * (b.x - a.x);
+      const auto rest = edge_y * (y - a.y) - edge_x * a.x +
+                        std::min(edge_x, 0.0f) + std::min(edge_y, 0.0f);
+      if (edge_x > 0) {
+        left = std::max(left, ceil(-rest / edge_x));
+      } else if (edge_x < 0) {
+        right = std::min(right, floor(-rest / edge_x));
+      } else if (rest < 0) {
+        right = left - 1;
+      }
+    }
+    auto z = screen[0].z + slope_x * (left - screen[0].x) +
+             slope_y * (y - screen[0].y) + deepest;
+    auto pixel = depth.data() + y * kOcclusionWidth;
+    for (auto x = static_cast<int>(left); x <= static_cast<int>(right); ++x) {
+      pixel[x] = std::min(pixel[x], z);
+      z += slope_x;
+    }
+  }
+}
+
+void OcclusionCuller::Finish() {
+  for (size_t level = 1; level < levels_.size(); ++level) {
+    const auto &below = levels_[level - 1];
+    const auto below_width = LevelWidth(level - 1);
+    const auto below_height = LevelHeight(level - 1);
+    auto &current = levels_[level];
+    for (size_t y = 0; y < LevelHeight(level); ++y) {
+      const auto y0 = std::min(y * 2, below_height - 1);
+      const auto y1 = std::min(y * 2 + 1, below_height - 1);
+      for (size_t x = 0; x < LevelWidth(level); ++x) {
+        const auto x0 = std::min(x * 2, below_width - 1);
+        const auto x1 = std::min(x * 2 + 1, below_width - 1);
+        current[x + y * LevelWidth(level)] = std::max(
+            {below[x0 + y0 * below_width], below[x1 + y0 * below_width],
+             below[x0 + y1 * below_width], below[x1 + y1 * below_width]});
+      }
+    }
+  }
+}
+
+OcclusionCuller::Visibility OcclusionCuller::Test(
+    const glm::vec3 &low, const glm::vec3 &high) const {
+  glm::vec4 corners[8];
+  Corners(viewProjection_, low, high, corners);
+  if (Outside(corners)) {
+    return Visibility::kOutside;
+  }
+  // A box reaching past the near plane is right in front of the camera
+  if (any_of(corners, corners + 8,
+             [](const glm::vec4 &c) { return c.z + c.w < 0; })) {
+    return Visibility::kVisible;
+  }
+
+  auto min_x = numeric_limits<float>::max(), max_x = -min_x;
+  auto min_y = min_x, max_y = max_x;
+  auto nearest = min_x;
+  for (const auto &c : corners) {
+    const auto x = (c.x / c.w * 0.5f + 0.5f) * kOcclusionWidth;
+    const auto y = (c.y / c.w * 0.5f + 0.5f) * kOcclusionHeight;
+    min_x = std::min(min_x, x);
+    max_x = std::max(max_x, x);
+    min_y = std::min(min_y, y);
+    max_y = std::max(max_y, y);
+    nearest = std::min(nearest, c.z / c.w);
+  }
+  const auto pixel = [](float value, size_t size) {
+    return static_cast<size_t>(
+        std::min(std::max(floor(value), 0.0f), static_cast<float>(size - 1)));
+  };
+  const auto x0 = pixel(min_x, kOcclusionWidth);
+  const auto x1 = pixel(max_x, kOcclusionWidth);
+  const auto y0 = pixel(min_y, kOcclusionHeight);
+  const auto y1 = pixel(max_y, kOcclusionHeight);
+
+  // The level at which the box covers at most 2x2 pixels
+  size_t level = 0;
+  while ((x1 >> level) - (x0 >> level) > 1 ||
+         (y1 >> level) - (y0 >> level) > 1) {
+    ++level;
+  }
+  const auto &depth = levels_[level];
+  const auto width = LevelWidth(level);
+  auto farthest = -kEmpty;
+  for (auto y = y0 >> level; y <= y1 >> level; ++y) {
+    for (auto x = x0 >> level; x <= x1 >> level; ++x) {
+      farthest = std::max(farthest, depth[x + y * width]);
+    }
+  }
+  if (nearest > farthest) {
+    return Visibility::kOccluded;
+  }
+  return Visibility::kVisible;
+}
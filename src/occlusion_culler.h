@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "constants.h"
+
+// Software occlusion culling of tiles hidden behind nearer terrain. Solid boxes
+// known to lie under the terrain are drawn into a small depth buffer, which
+// only takes a pixel that a box covers entirely and at the farthest depth the
+// box reaches inside it, so the buffer never hides more than the terrain does.
+// A pyramid of the farthest depth under every 2x2 block of pixels then tells
+// whether a bounding box is behind everything over it from a few reads.
+class OcclusionCuller {
+ public:
+  enum class Visibility { kVisible, kOutside, kOccluded };
+
+  OcclusionCuller();
+
+  // Clears the depth buffer for a camera at eye
+  void Begin(const glm::mat4 &view_projection, const glm::vec3 &eye);
+  // Draws the faces of the solid box between the two corners that face the eye
+  void AddOccluder(const glm::vec3 &, const glm::vec3 &);
+  // Builds the pyramid, every occluder has to be added before this
+  void Finish();
+  Visibility Test(const glm::vec3 &, const glm::vec3 &) const;
+
+ private:
+  void DrawPolygon(const glm::vec4 *, std::size_t);
+
+  glm::mat4 viewProjection_{1};
+  glm::vec3 eye_{0, 0, 0};
+  // Level 0 holds the normalized device depth of kOcclusionWidth x
+  // kOcclusionHeight pixels, every further level halves both sides
+  std::vector<std::vector<float>> levels_;
+};
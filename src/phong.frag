@@ -26,6 +26,8 @@ const vec4 attenuation = vec4(0, 0, 1, 1);
 uniform bool useColor;
 uniform bool useLight;
 uniform bool useShadows;
+// Samples along each axis of the shadow PCF, from 1 to 3
+uniform int shadowTaps;
 uniform vec3 camera;
 
 uniform pointLight_t pointLight;
@@ -36,11 +38,34 @@ uniform float farPlane;
 uniform float minHeight;
 uniform float maxHeight;
 
+// Local lights, see ClusteredLights
+uniform mat4 view;
+uniform samplerBuffer lightData;
+uniform usamplerBuffer lightClusters;
+uniform usamplerBuffer lightIndices;
+uniform sampler2D shadowAtlas;
+uniform mat4 cubeFaces[6];
+// Clusters per pixel across and up, slices per log depth, near plane
+uniform vec4 clusterGrid;
+uniform vec3 clusterCounts;
+
+// Tiles drawn with a coarse mesh, see Geography
+uniform bool useNormalMap;
+uniform bool useOcclusionMap;
+uniform sampler2D normalMap;
+uniform sampler2D occlusionMap;
+
 in fragData {
     vec3 worldPos;
     vec3 normal;
+    vec2 tilePos;
 } frag;
 
+// The interpolated vertex normal, or the full resolution one from normalMap,
+// and the fraction of the sky the fragment sees
+vec3 normal;
+float sky;
+
 
 float fog() {
     return 1 - smoothstep(farPlane * 0.97, farPlane, length(frag.worldPos - camera));
@@ -61,18 +86,22 @@ float inLight() {
         return 1.0;
     }
     vec3 lightOffset = frag.worldPos - pointLight.position;
-    float bias = -clamp(0.5 / dot(normalize(frag.normal), normalize(lightOffset)), 0.5, 10);
+    float bias = -clamp(0.5 / dot(normalize(normal), normalize(lightOffset)), 0.5, 10);
+    // Samples span the same quarter unit either side however many there are
+    float spacing = shadowTaps > 1 ? 0.5 / float(shadowTaps - 1) : 0.0;
+    float first = shadowTaps > 1 ? -0.25 : 0.0;
     float lightAmount = 0;
-    for (int x = -1; x < 2; ++x) {
-        for (int y = -1; y < 2; ++y) {
-            for (int z = -1; z < 2; ++z) {
-                if (!inShadow(lightOffset + vec3(x, y, z) / 4, bias)) {
+    for (int x = 0; x < shadowTaps; ++x) {
+        for (int y = 0; y < shadowTaps; ++y) {
+            for (int z = 0; z < shadowTaps; ++z) {
+                vec3 offset = first + vec3(x, y, z) * spacing;
+                if (!inShadow(lightOffset + offset, bias)) {
                     lightAmount += 1.0;
                 }
             }
         }
     }
-    return pow(lightAmount / 27, 0.25);
+    return pow(lightAmount / float(shadowTaps * shadowTaps * shadowTaps), 0.25);
 }
 
 
@@ -87,19 +116,19 @@ vec3 objectColor() {
         float relativeHeight = (frag.worldPos.z - minHeight) / (maxHeight - minHeight);
         return vec3(relativeHeight, relativeHeight, 0.875);
     } else {
-        return vec3((1 + frag.normal.x) / 2, (1 + frag.normal.y) / 2, frag.normal.z);
+        return vec3((1 + normal.x) / 2, (1 + normal.y) / 2, normal.z);
     }
 }
 
 
 vec3 ambient() {
-    return pointLight.ambient * material.ambient;
+    return pointLight.ambient * material.ambient * sky;
 }
 
 vec3 diffuse() {
     vec3 lightOffset = frag.worldPos - pointLight.position;
     vec3 lightVec = normalize(lightOffset);
-    float factor = clamp(dot(frag.normal, -lightVec), 0, 1);
+    float factor = clamp(dot(normal, -lightVec), 0, 1);
     return pointLight.diffuse * factor * material.diffuse * attenuate(lightOffset);
 }
 
@@ -108,14 +137,81 @@ vec3 specular() {
     vec3 lightVec = normalize(lightOffset);
     vec3 fragEyeOffset = camera - frag.worldPos;
     vec3 fragEyeVec = normalize(fragEyeOffset);
-    vec3 reflectVec = normalize(reflect(lightVec, frag.normal));
+    vec3 reflectVec = normalize(reflect(lightVec, normal));
     float factor = pow(clamp(dot(reflectVec, fragEyeVec), 0, 1), pointLight.specularPower);
     return pointLight.specular * factor * material.specular * attenuate(lightOffset) * attenuate(fragEyeOffset);
 }
 
+// Fraction of 2x2 texels of the light's face in the shadow atlas that see
+// this fragment
+float localShadow(int light, vec3 lightOffset, float radius, float size) {
+    if (!useShadows || size == 0.0) {
+        return 1.0;
+    }
+    vec3 axes = abs(lightOffset);
+    int face;
+    if (axes.x >= axes.y && axes.x >= axes.z) {
+        face = lightOffset.x > 0 ? 0 : 1;
+    } else if (axes.y >= axes.z) {
+        face = lightOffset.y > 0 ? 2 : 3;
+    } else {
+        face = lightOffset.z > 0 ? 4 : 5;
+    }
+    vec4 corners = texelFetch(lightData, light * 5 + 2 + face / 2);
+    vec2 corner = face % 2 == 0 ? corners.xy : corners.zw;
+    vec3 facePos = (cubeFaces[face] * vec4(lightOffset, 0)).xyz;
+    vec2 texel = (facePos.xy / -facePos.z * 0.5 + 0.5) * size - 0.5;
+
+    // A texel covers this much ground at the fragment's distance
+    float distance = length(lightOffset);
+    float bias = 2 * distance / size;
+    float lightAmount = 0;
+    for (int x = 0; x < 2; ++x) {
+        for (int y = 0; y < 2; ++y) {
+            vec2 tap = clamp(texel + vec2(x, y), vec2(0), vec2(size - 1));
+            float depth = texelFetch(shadowAtlas, ivec2(corner + tap), 0).r;
+            lightAmount += distance - bias <= depth * radius ? 1.0 : 0.0;
+        }
+    }
+    return lightAmount / 4;
+}
+
+// Only the lights listed for this fragment's cluster can reach it
+vec3 localLight() {
+    float depth = -(view * vec4(frag.worldPos, 1)).z;
+    ivec3 cell = ivec3(clamp(
+        vec3(gl_FragCoord.xy * clusterGrid.xy, log(depth / clusterGrid.w) * clusterGrid.z),
+        vec3(0), clusterCounts - 1));
+    int cluster = cell.x + int(clusterCounts.x) * (cell.y + int(clusterCounts.y) * cell.z);
+    uvec2 range = texelFetch(lightClusters, cluster).xy;
+
+    vec3 fragEyeVec = normalize(camera - frag.worldPos);
+    vec3 total = vec3(0);
+    for (uint i = 0u; i < range.y; ++i) {
+        int light = int(texelFetch(lightIndices, int(range.x + i)).r);
+        vec4 position = texelFetch(lightData, light * 5);
+        vec3 lightOffset = frag.worldPos - position.xyz;
+        float distance = length(lightOffset);
+        if (distance >= position.w) {
+            continue;
+        }
+        vec4 color = texelFetch(lightData, light * 5 + 1);
+        // Fades out smoothly at the edge of the light's reach
+        float falloff = 1 - distance * distance / (position.w * position.w);
+        vec3 lightVec = lightOffset / distance;
+        float diffuse = clamp(dot(normal, -lightVec), 0, 1);
+        vec3 reflectVec = normalize(reflect(lightVec, normal));
+        float specular = pow(clamp(dot(reflectVec, fragEyeVec), 0, 1), pointLight.specularPower);
+        total += color.rgb * falloff * falloff *
+                 (diffuse * material.diffuse + specular * material.specular) *
+                 localShadow(light, lightOffset, position.w, color.w);
+    }
+    return total;
+}
+
 vec3 light() {
     if (useLight && frag.worldPos != pointLight.position) {
-        return fog() * (ambient() + inLight() * (diffuse() + specular()));
+        return fog() * (ambient() + inLight() * (diffuse() + specular()) + localLight());
     } else {
         return pointLight.diffuse;
     }
@@ -123,5 +219,16 @@ vec3 light() {
 
 
 void main() {
+    normal = frag.normal;
+    sky = 1.0;
+    if (useNormalMap) {
+        // One texel per vertex, texel centres on the vertices
+        vec2 uv = (frag.tilePos + 0.5) / vec2(textureSize(normalMap, 0));
+        vec2 xy = texture(normalMap, uv).rg * 2 - 1;
+        normal = vec3(xy, sqrt(max(1 - dot(xy, xy), 0)));
+        if (useOcclusionMap) {
+            sky = texture(occlusionMap, uv).r;
+        }
+    }
     gl_FragColor = vec4(objectColor() * light(), 1);
 }
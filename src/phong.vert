@@ -8,9 +8,14 @@ uniform mat4 model;
 attribute vec3 vtxPos;
 attribute vec3 vtxNormal;
 
+// The depth pre-pass runs this same shader, its depths must match exactly
+invariant gl_Position;
+
 out fragData {
     vec3 worldPos;
     vec3 normal;
+    // Within the tile, for its baked maps
+    vec2 tilePos;
 } frag;
 
 
@@ -20,4 +25,5 @@ void main() {
     gl_Position = projection * view * worldPos;
 
     frag.normal = vtxNormal;
+    frag.tilePos = vtxPos.xy;
 }
@@ -16,14 +16,9 @@ PointLight::PointLight(const glm::vec3 &pos) : Renderable(false), pos_(pos) {
   // Licensed CC BY 4.0 (https://creativecommons.org/licenses/by/4.0/legalcode)
 
   glGenTextures(1, &depth_);
+  SetShadowMapSize(kShadowMapSize);
   glBindTexture(GL_TEXTURE_CUBE_MAP, depth_);
 
-  for (auto i = 0; i < 6; ++i) {
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT,
-                 kShadowMapSize, kShadowMapSize, 0, GL_DEPTH_COMPONENT,
-                 GL_FLOAT, nullptr);
-  }
-
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -47,6 +42,41 @@ PointLight::~PointLight() {
   glDeleteFramebuffers(1, &fbo_);
 }
 
+// The depth format is unsized, most drivers give it 4 bytes a texel
+static int64_t CubeBytes(const GLsizei size) {
+  return static_cast<int64_t>(size) * size * 6 * 4;
+}
+
+bool PointLight::SetShadowMapSize(GLsizei size) {
+  // Without this, every quality change would log the reduction again
+  if (size == requestedShadowMapSize_) {
+    return false;
+  }
+  const auto requested = size;
+  requestedShadowMapSize_ = requested;
+  while (size > kMinShadowMapSize &&
+         !MemoryAccounting::Fits(MemoryPool::kShadowMaps,
+                                 CubeBytes(size) - cube_.bytes())) {
+    size /= 2;
+  }
+  if (size == shadowMapSize_) {
+    return false;
+  }
+  if (size != requested) {
+    cerr << "Shadow map of " << requested << " reduced to " << size
+         << " to fit the shadow map budget" << endl;
+  }
+  shadowMapSize_ = size;
+  glBindTexture(GL_TEXTURE_CUBE_MAP, depth_);
+  for (auto i = 0; i < 6; ++i) {
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT,
+                 size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  }
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  cube_.Set(CubeBytes(size));
+  return true;
+}
+
 void PointLight::LoadData(Shader *shader) const {
   if (!shader->CopyDataToUniform(ambient_, "pointLight.ambient")) {
     cerr << "Point light ambient not loaded to shader" << endl;
@@ -94,7 +124,7 @@ void PointLight::GenerateCubeMaps(
       shadowProj * glm::lookAt(pos_, pos_ + glm::vec3(0.0, 0.0, -1.0),
                                glm::vec3(0.0, -1.0, 0.0));
 
-  glViewport(0, 0, kShadowMapSize, kShadowMapSize);
+  glViewport(0, 0, shadowMapSize_, shadowMapSize_);
   glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
   glClear(GL_DEPTH_BUFFER_BIT);
   glUseProgram(shadow_.id());
@@ -5,6 +5,8 @@
 #include <glm/vec3.hpp>
 #include <vector>
 
+#include "constants.h"
+#include "memory_accounting.h"
 #include "renderable.h"
 #include "shader.h"
 
@@ -15,8 +17,13 @@ class PointLight : public Renderable {
 
   void LoadData(Shader *) const;
   void GenerateCubeMaps(const std::vector<Renderable *> &) const;
+  // Reallocates the depth cube, which is empty until generated again. The size
+  // is halved while the cube would go over kShadowMapBudget. Returns false,
+  // keeping the cube, if that leaves the size as it was.
+  bool SetShadowMapSize(GLsizei);
 
   inline GLuint getDepthTexture() const { return depth_; }
+  inline GLsizei shadowMapSize() const { return shadowMapSize_; }
   inline void setPosition(const glm::vec3 &pos) {
     pos_ = pos;
     CleanUp();
@@ -38,6 +45,11 @@ class PointLight : public Renderable {
   glm::vec3 pos_;
 
   Shader shadow_{"shadow.vert", "shadow.frag", "shadow.geom"};
+  // Allocated from the constructor. shadowMapSize_ is the size requested last
+  // once fitted into the budget.
+  GLsizei requestedShadowMapSize_{0};
+  GLsizei shadowMapSize_{0};
   GLuint fbo_{0};
   GLuint depth_{0};
+  MemoryCharge cube_{MemoryPool::kShadowMaps};
 };
@@ -0,0 +1,79 @@
+#include "quality_governor.h"
+
+#include <algorithm>
+
+#include "constants.h"
+
+using namespace std;
+
+// From full quality down, each step gives up whatever costs the most for the
+// least visible difference next
+static const QualityLevel kLevels[] = {
+    {1.0f, kShadowMapSize, 3, 1, 1},
+    {1.0f, kShadowMapSize / 2, 3, 1, 1},
+    {1.0f, kShadowMapSize / 2, 2, 2, 1},
+    {1.0f, kShadowMapSize / 4, 2, 2, 2},
+    {0.85f, kShadowMapSize / 4, 2, 4, 2},
+    {0.75f, kShadowMapSize / 8, 1, 4, 4},
+    {0.6f, kShadowMapSize / 8, 1, 8, 4},
+    {0.5f, kShadowMapSize / 16, 1, 8, 8},
+};
+
+// Doubling stops here, about two minutes of calm at kFPS
+constexpr int kMaxCalmWindows{kGovernorCalmWindows * 64};
+
+QualityGovernor::QualityGovernor(const double budget_milliseconds)
+    : budget_(budget_milliseconds), calmNeeded_(kGovernorCalmWindows) {}
+
+size_t QualityGovernor::count() { return extent<decltype(kLevels)>::value; }
+
+const QualityLevel &QualityGovernor::level() const { return kLevels[level_]; }
+
+void QualityGovernor::Reset() {
+  level_ = 0;
+  sum_ = 0;
+  frames_ = 0;
+  calm_ = 0;
+  calmNeeded_ = kGovernorCalmWindows;
+  raised_ = false;
+}
+
+bool QualityGovernor::AddFrame(const double milliseconds) {
+  sum_ += milliseconds;
+  if (++frames_ < kGovernorFrames) {
+    return false;
+  }
+  average_ = sum_ / frames_;
+  sum_ = 0;
+  frames_ = 0;
+  const auto just_raised = raised_;
+  raised_ = false;
+
+  if (average_ > budget_) {
+    calm_ = 0;
+    if (level_ + 1 == count()) {
+      return false;
+    }
+    // The level just raised to can't hold the budget
+    if (just_raised) {
+      calmNeeded_ = std::min(calmNeeded_ * 2, kMaxCalmWindows);
+    }
+    ++level_;
+    return true;
+  }
+  // A raise that held up resets the wait
+  if (just_raised) {
+    calmNeeded_ = kGovernorCalmWindows;
+  }
+  if (average_ >= budget_ * kGovernorHeadroom || level_ == 0) {
+    calm_ = 0;
+    return false;
+  }
+  if (++calm_ < calmNeeded_) {
+    return false;
+  }
+  calm_ = 0;
+  raised_ = true;
+  --level_;
+  return true;
+}
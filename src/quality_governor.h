@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+
+// Every quality knob the governor turns, at one step of its ladder
+struct QualityLevel {
+  // Fraction of the window's resolution the scene is drawn at
+  float renderScale;
+  int shadowMapSize;
+  // Shadow samples along each axis of the main light's PCF, cubed
+  int shadowTaps;
+  // Multiplies kMeshError of the adaptive mesh
+  float meshErrorScale;
+  // Frames between updates of the main light's shadows while they change
+  int shadowInterval;
+};
+
+// Holds frame time within a budget by walking a fixed ladder of quality
+// levels. Frame times are averaged over windows of kGovernorFrames frames.
+// Quality drops a step after any window over budget, but only rises again
+// after kGovernorCalmWindows windows in a row under kGovernorHeadroom of the
+// budget. A step up that has to be taken back within a window doubles the
+// calm windows needed before the next one, so a level just out of reach is
+// only retried every so often.
+class QualityGovernor {
+ public:
+  explicit QualityGovernor(double budget_milliseconds);
+
+  // Returns whether the level changed
+  bool AddFrame(double milliseconds);
+  // Back to full quality
+  void Reset();
+
+  const QualityLevel &level() const;
+  inline std::size_t index() const { return level_; }
+  static std::size_t count();
+  // Average frame time of the last full window
+  inline double average() const { return average_; }
+  inline double budget() const { return budget_; }
+
+ private:
+  double budget_;
+  std::size_t level_{0};
+  double sum_{0};
+  int frames_{0};
+  double average_{0};
+  int calm_{0};
+  int calmNeeded_;
+  // Quality was raised at the end of the last window
+  bool raised_{false};
+};
@@ -0,0 +1,131 @@
+#include "regenerator.h"
+
+#include <iostream>
+
+#include "constants.h"
+
+using namespace std;
+
+Regenerator::Regenerator() : pool_(new ThreadPool(kBackgroundThreads)) {}
+
+Regenerator::~Regenerator() {
+  Discard();
+  // Joins the workers so nothing is added to ready_ past this point
+  pool_.reset();
+
+  for (const auto &ready : ready_) {
+    delete ready.geography;
+  }
+  for (auto &buffers : freeBuffers_) {
+    Renderable::DeleteBuffer(&buffers.first);
+    Renderable::DeleteBuffer(&buffers.second);
+  }
+}
+
+void Regenerator::Start(const mt19937::result_type seed,
+                        const NoiseType noise, const bool progressive) {
+  Discard();
+  staged_.assign(kGeographyCountShort * kGeographyCountLong, nullptr);
+  stagedCount_ = 0;
+  running_ = true;
+  progressive_ = progressive;
+  startTime_ = chrono::high_resolution_clock::now();
+
+  // Same order as the tiles created by the Renderer
+  const auto epoch = epoch_;
+  size_t index = 0;
+  for (auto x = 0; x < static_cast<int>(kGeographyCountShort); ++x) {
+    for (auto y = 0; y < static_cast<int>(kGeographyCountLong); ++y) {
+      pool_->Submit([this, epoch, index, x, y, seed, noise] {
+        auto geography = new Geography(x, y, seed, noise);
+        geography->PrepareGeom();
+        lock_guard<mutex> lock(readyMutex_);
+        ready_.push_back({epoch, index, geography});
+      });
+      ++index;
+    }
+  }
+}
+
+bool Regenerator::Update(vector<Renderable *> *objects) {
+  if (!running_) {
+    return false;
+  }
+
+  auto changed = false;
+  GLsizeiptr uploaded = 0;
+  while (uploaded < kUploadBudget) {
+    Ready ready{};
+    {
+      lock_guard<mutex> lock(readyMutex_);
+      if (ready_.empty()) {
+        break;
+      }
+      ready = ready_.front();
+      ready_.pop_front();
+    }
+    // Left over from a regeneration that has since been cancelled
+    if (ready.epoch != epoch_) {
+      delete ready.geography;
+      continue;
+    }
+
+    if (!freeBuffers_.empty()) {
+      ready.geography->AdoptBuffers(freeBuffers_.back().first,
+                                    freeBuffers_.back().second);
+      freeBuffers_.pop_back();
+    }
+    uploaded += ready.geography->vertexBytes() + ready.geography->indexBytes();
+    ready.geography->UploadGeom();
+    ++stagedCount_;
+    if (progressive_) {
+      objects->push_back(ready.geography);
+      changed = true;
+    } else {
+      staged_[ready.index] = ready.geography;
+    }
+  }
+
+  if (stagedCount_ < staged_.size()) {
+    return changed;
+  }
+
+  if (!progressive_) {
+    // The old world's buffers become the staging buffers of the next one
+    for (const auto object : *objects) {
+      Recycle(object);
+    }
+    objects->assign(staged_.begin(), staged_.end());
+  }
+  staged_.clear();
+  running_ = false;
+
+  const auto endTime = chrono::high_resolution_clock::now();
+  cout << (progressive_ ? "Generation time: " : "Regeneration time: ")
+       << chrono::duration_cast<chrono::milliseconds>(endTime - startTime_)
+              .count()
+       << "ms" << endl;
+  return true;
+}
+
+void Regenerator::Recycle(Renderable *object) {
+  pair<GLuint, GLuint> buffers;
+  object->ReleaseBuffers(&buffers.first, &buffers.second);
+  if (buffers.first != 0) {
+    freeBuffers_.push_back(buffers);
+  }
+  delete object;
+}
+
+void Regenerator::Discard() {
+  ++epoch_;
+  pool_->Clear();
+  for (const auto geography : staged_) {
+    if (geography != nullptr) {
+      Recycle(geography);
+    }
+  }
+  staged_.clear();
+  stagedCount_ = 0;
+  running_ = false;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "geography.h"
+#include "thread_pool.h"
+
+// Regenerates the fixed world without stalling the GLUT thread. Tiles are
+// generated into staging memory on background threads and uploaded into
+// spare buffers within kUploadBudget bytes per tick while the current terrain
+// keeps rendering, then the whole world is swapped in at once. A progressive
+// regeneration, for when there is no terrain yet, instead shows each tile as
+// soon as it has been uploaded.
+//
+// Generation needs no GL context, so a regeneration may be started before
+// there is one, as long as Update is only called once there is.
+class Regenerator {
+ public:
+  Regenerator();
+  ~Regenerator();
+
+  // Cancels any regeneration that is still in progress
+  void Start(std::mt19937::result_type, NoiseType, bool progressive = false);
+  // Returns whether objects changed, which without progressive is only when
+  // it is swapped for the whole regenerated world
+  bool Update(std::vector<Renderable *> *);
+
+  inline bool running() const { return running_; }
+  // Tiles uploaded so far, out of the whole world
+  inline std::size_t uploaded() const { return stagedCount_; }
+
+ private:
+  struct Ready {
+    unsigned int epoch;
+    std::size_t index;
+    Geography *geography;
+  };
+
+  void Recycle(Renderable *);
+  void Discard();
+
+  std::vector<Geography *> staged_;
+  std::size_t stagedCount_{0};
+  std::vector<std::pair<GLuint, GLuint>> freeBuffers_;
+  unsigned int epoch_{0};
+  bool running_{false};
+  bool progressive_{false};
+  std::chrono::high_resolution_clock::time_point startTime_;
+
+  std::mutex readyMutex_;
+  std::deque<Ready> ready_;
+
+  std::unique_ptr<ThreadPool> pool_;
+};
@@ -0,0 +1,69 @@
+#include "remesher.h"
+
+#include <map>
+#include <utility>
+
+#include "constants.h"
+
+using namespace std;
+
+Remesher::Remesher() : pool_(new ThreadPool(kBackgroundThreads)) {}
+
+Remesher::~Remesher() {
+  // Joins the workers so nothing is added to ready_ past this point
+  pool_->Clear();
+  pool_.reset();
+}
+
+bool Remesher::Update(const vector<Renderable *> &objects) {
+  if (!kAdaptiveMesh || kNormalMaps) {
+    return false;
+  }
+
+  const auto error = Geography::meshError();
+  map<uint64_t, Geography *> tiles;
+  for (const auto object : objects) {
+    const auto geo = dynamic_cast<Geography *>(object);
+    if (geo == nullptr) {
+      continue;
+    }
+    tiles[geo->serial()] = geo;
+    if (geo->meshedError() == error || !pending_.insert(geo->serial()).second) {
+      continue;
+    }
+    const auto job = geo->MeshJob(error);
+    const auto serial = geo->serial();
+    pool_->Submit([this, job, serial] {
+      unique_ptr<Geography::Mesh> mesh(new Geography::Mesh());
+      job(mesh.get());
+      lock_guard<mutex> lock(readyMutex_);
+      ready_.push_back({serial, move(mesh)});
+    });
+  }
+
+  auto changed = false;
+  GLsizeiptr uploaded = 0;
+  while (uploaded < kUploadBudget) {
+    Ready ready{};
+    {
+      lock_guard<mutex> lock(readyMutex_);
+      if (ready_.empty()) {
+        break;
+      }
+      ready = move(ready_.front());
+      ready_.pop_front();
+    }
+    pending_.erase(ready.serial);
+    // The tile is gone, or the error changed again while the job ran and the
+    // tile is remeshed on the next tick
+    const auto tile = tiles.find(ready.serial);
+    if (tile == tiles.end() || ready.mesh->error != error) {
+      continue;
+    }
+    uploaded += static_cast<GLsizeiptr>(ready.mesh->indices.size() *
+                                        sizeof(unsigned int));
+    tile->second->UploadMesh(ready.mesh.get());
+    changed = true;
+  }
+  return changed;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "geography.h"
+#include "thread_pool.h"
+
+// Triangulates tiles again on background threads once the mesh error has
+// changed, and uploads their indices within kUploadBudget bytes per tick, so
+// the quality governor changing the error doesn't stall the GLUT thread. Jobs
+// only share the heights of a tile, a tile dropped in the meantime simply
+// never gets its new mesh.
+class Remesher {
+ public:
+  Remesher();
+  ~Remesher();
+
+  // Starts jobs for the tiles in objects meshed with another error than
+  // Geography::meshError(), and returns whether any tile's mesh was replaced
+  bool Update(const std::vector<Renderable *> &);
+
+ private:
+  struct Ready {
+    std::uint64_t serial;
+    std::unique_ptr<Geography::Mesh> mesh;
+  };
+
+  // Serials of the tiles with a job that hasn't been picked up yet
+  std::set<std::uint64_t> pending_;
+
+  std::mutex readyMutex_;
+  std::deque<Ready> ready_;
+
+  std::unique_ptr<ThreadPool> pool_;
+};
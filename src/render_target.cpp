@@ -0,0 +1,42 @@
+#include "render_target.h"
+
+RenderTarget::RenderTarget() {
+  glGenFramebuffers(1, &fbo_);
+  glGenRenderbuffers(1, &color_);
+  glGenRenderbuffers(1, &depth_);
+}
+
+RenderTarget::~RenderTarget() {
+  glDeleteRenderbuffers(1, &depth_);
+  glDeleteRenderbuffers(1, &color_);
+  glDeleteFramebuffers(1, &fbo_);
+}
+
+void RenderTarget::Bind(const int width, const int height) {
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  if (width == width_ && height == height_) {
+    return;
+  }
+  width_ = width;
+  height_ = height;
+  glBindRenderbuffer(GL_RENDERBUFFER, color_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  // Depth is padded to 4 bytes a pixel like the colour
+  charge_.Set(static_cast<int64_t>(width) * height * 8);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, depth_);
+}
+
+void RenderTarget::Blit(const int window_width,
+                        const int window_height) const {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, width_, height_, 0, 0, window_width, window_height,
+                    GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include "memory_accounting.h"
+
+// Offscreen colour and depth buffers the scene can be drawn into at a lower
+// resolution than the window, and then stretched over it
+class RenderTarget {
+ public:
+  RenderTarget();
+  ~RenderTarget();
+
+  RenderTarget(const RenderTarget &) = delete;
+  RenderTarget &operator=(const RenderTarget &) = delete;
+
+  // Draws into the target from now on, resized to width x height if needed
+  void Bind(int width, int height);
+  // Filters the target onto the whole window and draws there from now on
+  void Blit(int window_width, int window_height) const;
+
+ private:
+  GLuint fbo_{0};
+  GLuint color_{0};
+  GLuint depth_{0};
+  int width_{0};
+  int height_{0};
+  MemoryCharge charge_{MemoryPool::kTextures};
+};
@@ -1,6 +1,8 @@
 #include "renderable.h"
 
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 
@@ -9,23 +11,90 @@ Renderable::Renderable(bool drawTriangles) : drawTriangles_(drawTriangles) {}
 Renderable::~Renderable() { CleanUp(); }
 
 void Renderable::InitGeom() {
+  PrepareGeom();
+  UploadGeom();
+}
+
+void Renderable::PrepareGeom() {
   SetData();
+  staging_.Set(static_cast<int64_t>(StagingBytes()));
+}
 
-  glGenBuffers(1, &vbo_);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-  glBufferData(GL_ARRAY_BUFFER,
-               static_cast<long>(sizeof(Vertex)) * vertexCount_, vertices_,
-               GL_STATIC_DRAW);
-  delete[] vertices_;
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+void Renderable::UploadGeom() {
+  UploadBuffer(GL_ARRAY_BUFFER, &vbo_, vertexBytes(), vertices_,
+               [this](void *mapped) {
+                 WriteVertices(static_cast<Vertex *>(mapped));
+               });
+  UploadIndices();
+  FreeData();
+}
 
-  glGenBuffers(1, &ebo_);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-               static_cast<long>(sizeof(unsigned int)) * indexCount_, indices_,
-               GL_STATIC_DRAW);
-  delete[] indices_;
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+void Renderable::UploadIndices() {
+  UploadBuffer(GL_ELEMENT_ARRAY_BUFFER, &ebo_, indexBytes(), indices_,
+               [this](void *mapped) {
+                 WriteIndices(static_cast<unsigned int *>(mapped));
+               });
+}
+
+void Renderable::WriteVertices(Vertex *) {}
+
+void Renderable::WriteIndices(unsigned int *) {}
+
+// Fills buffer with size bytes copied from data or, if data is null, written
+// in place by write. Reuses the existing storage of buffer when it is already
+// the right size, otherwise (re)allocates it.
+void Renderable::UploadBuffer(const GLenum target, GLuint *buffer,
+                              const GLsizeiptr size, const void *data,
+                              const function<void(void *)> &write) {
+  GLint64 existingSize = 0;
+  if (*buffer == 0) {
+    glGenBuffers(1, buffer);
+    glBindBuffer(target, *buffer);
+  } else {
+    glBindBuffer(target, *buffer);
+    glGetBufferParameteri64v(target, GL_BUFFER_SIZE, &existingSize);
+  }
+
+  if (existingSize != size) {
+    glBufferData(target, size, data, GL_STATIC_DRAW);
+    MemoryAccounting::Add(MemoryPool::kGeometry, size - existingSize);
+    if (data != nullptr) {
+      glBindBuffer(target, 0);
+      return;
+    }
+  }
+
+  // Invalidating the whole range lets the driver hand out fresh memory rather
+  // than wait for frames still drawing from the old contents
+  for (auto attempt = 0; attempt < 2; ++attempt) {
+    auto mapped = glMapBufferRange(
+        target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped == nullptr) {
+      break;
+    }
+    if (data != nullptr) {
+      memcpy(mapped, data, static_cast<size_t>(size));
+    } else {
+      write(mapped);
+    }
+    // Contents are undefined if the mapping was lost in the meantime
+    if (glUnmapBuffer(target) == GL_TRUE) {
+      glBindBuffer(target, 0);
+      return;
+    }
+  }
+
+  // Mapping isn't available, fall back on a temporary copy
+  if (data != nullptr) {
+    glBufferData(target, size, data, GL_STATIC_DRAW);
+  } else {
+    vector<char> staging(static_cast<size_t>(size));
+    MemoryCharge charge(MemoryPool::kStaging);
+    charge.Set(size);
+    write(staging.data());
+    glBufferData(target, size, staging.data(), GL_STATIC_DRAW);
+  }
+  glBindBuffer(target, 0);
 }
 
 void Renderable::Render(const Shader *const shader) const {
@@ -64,12 +133,48 @@ void Renderable::Render(const Shader *const shader) const {
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+void Renderable::FreeData() {
+  delete[] vertices_;
+  vertices_ = nullptr;
+  delete[] indices_;
+  indices_ = nullptr;
+  staging_.Set(0);
+}
+
+size_t Renderable::StagingBytes() const {
+  return (vertices_ != nullptr ? static_cast<size_t>(vertexBytes()) : 0) +
+         (indices_ != nullptr ? static_cast<size_t>(indexBytes()) : 0);
+}
+
+void Renderable::ReleaseBuffers(GLuint *vbo, GLuint *ebo) {
+  *vbo = vbo_;
+  *ebo = ebo_;
+  vbo_ = 0;
+  ebo_ = 0;
+}
+
+void Renderable::AdoptBuffers(const GLuint vbo, const GLuint ebo) {
+  CleanUp();
+  vbo_ = vbo;
+  ebo_ = ebo;
+}
+
 void Renderable::CleanUp() {
-  if (vbo_ == 0 && ebo_ == 0) {
+  DeleteBuffer(&vbo_);
+  DeleteBuffer(&ebo_);
+}
+
+// Buffers don't remember what they were created for, so any target can ask
+// for the size
+void Renderable::DeleteBuffer(GLuint *buffer) {
+  if (*buffer == 0) {
     return;
   }
-  glDeleteBuffers(1, &vbo_);
-  glDeleteBuffers(1, &ebo_);
-  vbo_ = 0;
-  ebo_ = 0;
+  GLint64 size = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, *buffer);
+  glGetBufferParameteri64v(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  MemoryAccounting::Add(MemoryPool::kGeometry, -size);
+  glDeleteBuffers(1, buffer);
+  *buffer = 0;
 }
@@ -3,33 +3,71 @@
 #include <GL/glew.h>
 
 #include <array>
+#include <functional>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/glm.hpp>
 
+#include "memory_accounting.h"
 #include "shader.h"
 
 class Renderable {
  public:
   explicit Renderable(bool);
-  ~Renderable();
+  virtual ~Renderable();
 
   void InitGeom();
-  void Render(const Shader *) const;
+  // InitGeom split in two, PrepareGeom does no GL work and may be called from
+  // any thread, UploadGeom must then be called from the GL thread
+  void PrepareGeom();
+  virtual void UploadGeom();
+  virtual void Render(const Shader *) const;
   void CleanUp();
 
+  // Hands the GL buffers over to another Renderable, uploads into adopted
+  // buffers reuse their storage when the size matches
+  void ReleaseBuffers(GLuint *, GLuint *);
+  void AdoptBuffers(GLuint, GLuint);
+  // Deletes a buffer and stops counting its storage, for buffers that have
+  // been released
+  static void DeleteBuffer(GLuint *);
+
+  inline GLsizeiptr vertexBytes() const {
+    return static_cast<GLsizeiptr>(sizeof(Vertex)) * vertexCount_;
+  }
+  inline GLsizeiptr indexBytes() const {
+    return static_cast<GLsizeiptr>(sizeof(unsigned int)) * indexCount_;
+  }
+
  protected:
   bool drawTriangles_;
 
   GLsizei indexCount_{0};
   unsigned int *indices_{nullptr};
   GLsizei vertexCount_{0};
-  Vertex *vertices_{nullptr};
+  const Vertex *vertices_{nullptr};
 
   glm::mat4 model_{glm::identity<glm::mat4>()};
 
+  // Releases vertices_ and indices_ once they have been uploaded
+  virtual void FreeData();
+  // Bytes held from PrepareGeom until FreeData, counted as
+  // MemoryPool::kStaging
+  virtual std::size_t StagingBytes() const;
+  // Replaces the uploaded indices only, with indexCount_ from indices_ or
+  // WriteIndices
+  void UploadIndices();
+
  private:
   virtual void SetData() = 0;
+  // Used when SetData leaves vertices_ or indices_ null, these fill the
+  // (mapped) buffer directly with vertexCount_ vertices or indexCount_ indices
+  virtual void WriteVertices(Vertex *);
+  virtual void WriteIndices(unsigned int *);
+
+  static void UploadBuffer(GLenum, GLuint *, GLsizeiptr, const void *,
+                           const std::function<void(void *)> &);
 
   GLuint ebo_{0};
   GLuint vbo_{0};
+  MemoryCharge staging_{MemoryPool::kStaging};
 };
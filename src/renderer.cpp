@@ -1,12 +1,22 @@
 #include "renderer.h"
 
 #include <GL/freeglut_std.h>
+#include <sys/resource.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "arguments.h"
 #include "constants.h"
+#include "memory_accounting.h"
 
 using namespace std;
 
@@ -17,9 +27,27 @@ Renderer::Renderer(int argc, char *argv[]) {
     throw runtime_error("Only one window may exist.");
   }
   window = this;
-  Grid::RandomizeBase();
 
   glutInit(&argc, argv);
+  // GLUT removes the arguments it understands, an optional seed may remain
+  if (argc > 1) {
+    unsigned long seed;
+    if (argc > 2 || !ParseUnsigned(argv[1], &seed)) {
+      throw runtime_error(string("Usage: ") + argv[0] + " [seed]");
+    }
+    Grid::SetBase(seed);
+  } else {
+    Grid::RandomizeBase();
+  }
+  cout << "Seed: " << Grid::seed() << "\n";
+  // Generation needs no GL, so it runs on background threads while the window,
+  // context, shaders and shadow maps are set up, and tiles appear as they are
+  // uploaded
+  if (!kStreamWorld) {
+    regenerator_ = new Regenerator();
+    regenerator_->Start(Grid::seed(), Grid::noise(), true);
+  }
+
   glutInitWindowPosition(10, 10);
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
   glutInitWindowSize(viewport_width_, viewport_height_);
@@ -50,58 +78,246 @@ Renderer::Renderer(int argc, char *argv[]) {
   CheckGLError();
 
   shader_ = new Shader("phong.vert", "phong.frag");
+  depth_ = new Shader("phong.vert", "depth.frag");
+  target_ = new RenderTarget();
+  glGenQueries(4, timers_);
   light_ = new PointLight({kGeographyShort * kGeographyCountShort / 2,
                            kGeographyLong * kGeographyCountLong / 2,
                            kHeightMultiplier * kGeographyCountShort / 2});
-
-  using std::chrono::duration_cast;
-  using std::chrono::milliseconds;
-  auto start_time = chrono::high_resolution_clock::now();
-  for (auto x = 0; x < kGeographyCountShort; ++x) {
-    for (auto y = 0; y < kGeographyCountLong; ++y) {
-      objects_.push_back(new Geography(x, y));
-    }
+  localLights_ = new ClusteredLights();
+  cout << "Shader setup: " << fixed << setprecision(1)
+       << Shader::milliseconds() << defaultfloat << "ms, "
+       << Shader::cachedPrograms() << " of " << Shader::programs()
+       << " programs from the binary cache\n";
+
+  if (kStreamWorld) {
+    // Tiles arrive over the first few ticks instead
+    streamer_ = new TileStreamer();
+    cout << "Streaming tiles within " << kStreamRadius
+         << " tiles of the camera\n";
   }
-
-  auto end_time = chrono::high_resolution_clock::now();
-  cout << "Generation time: "
-       << duration_cast<milliseconds>(end_time - start_time).count() << "ms\n";
-  cout << "       vertices: "
-       << kGeographyCountShort * kGeographyCountLong * kGeographyShort *
-              kGeographyLong
-       << "\n";
   CheckGLError();
 
   InitGeom();
+  UpdateSampler();
   CheckGLError();
+  PrintPeakMemory();
 
   PrintKeyMap();
   TimerCB(0);
   glutMainLoop();
 }
 
-Renderer::~Renderer() { delete shader_; }
+Renderer::~Renderer() {
+  delete streamer_;
+  delete regenerator_;
+  delete localLights_;
+  glDeleteQueries(4, timers_);
+  delete target_;
+  delete depth_;
+  delete shader_;
+}
 
+// Meshing needs no GL, so every tile is prepared on a thread of its own (at
+// most kMaxThreads at once) before the uploads on this thread
 void Renderer::InitGeom() {
   light_->InitGeom();
+  vector<thread> threads;
+  for (size_t first = 0; first < kMaxThreads; ++first) {
+    threads.emplace_back([this, first] {
+      for (auto i = first; i < objects_.size(); i += kMaxThreads) {
+        objects_[i]->PrepareGeom();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
   for (const auto geo : objects_) {
-    geo->InitGeom();
+    geo->UploadGeom();
   }
   CheckGLError();
 }
 
-void Renderer::Display() const {
-  if (useShadows_ && shadowsChanged_) {
+// Every tile adds its occluders before any is tested, a tile's own boxes are
+// inside its bounds and so never hide it
+void Renderer::Cull() {
+  if (!useOcclusion_) {
+    visible_ = objects_;
+    return;
+  }
+
+  const auto start = chrono::high_resolution_clock::now();
+  occlusion_.Begin(camera_.projection() * camera_.view(),
+                   camera_.getPosition());
+  for (const auto object : objects_) {
+    const auto geo = dynamic_cast<Geography *>(object);
+    if (geo != nullptr) {
+      geo->AddOccluders(&occlusion_);
+    }
+  }
+  occlusion_.Finish();
+
+  visible_.clear();
+  cullStats_ = CullStats();
+  for (const auto object : objects_) {
+    const auto geo = dynamic_cast<Geography *>(object);
+    if (geo == nullptr) {
+      visible_.push_back(object);
+      continue;
+    }
+    ++cullStats_.tiles;
+    switch (geo->Test(occlusion_)) {
+      case OcclusionCuller::Visibility::kVisible:
+        visible_.push_back(object);
+        break;
+      case OcclusionCuller::Visibility::kOutside:
+        ++cullStats_.outside;
+        break;
+      case OcclusionCuller::Visibility::kOccluded:
+        ++cullStats_.occluded;
+        break;
+    }
+  }
+  cullStats_.milliseconds =
+      chrono::duration<double, milli>(chrono::high_resolution_clock::now() -
+                                      start)
+          .count();
+}
+
+// Waiting on the GPU would stall the frame, so timings only count once the
+// queries of the previous frame are done
+void Renderer::ReadTimers() {
+  if (!timersPending_) {
+    return;
+  }
+  GLint available = 0;
+  glGetQueryObjectiv(timers_[3], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available == GL_FALSE) {
+    return;
+  }
+  GLuint64 nanoseconds[4]{};
+  for (auto i = 0; i < 4; ++i) {
+    glGetQueryObjectui64v(timers_[i], GL_QUERY_RESULT, &nanoseconds[i]);
+  }
+  timerSums_[0] += nanoseconds[0] * 1e-6;
+  timerSums_[1] += nanoseconds[1] * 1e-6;
+  frameMilliseconds_ = (nanoseconds[3] - nanoseconds[2]) * 1e-6;
+  timersPending_ = false;
+  if (++timerFrames_ == kTimerFrames) {
+    prepassMilliseconds_ = timerSums_[0] / kTimerFrames;
+    shadingMilliseconds_ = timerSums_[1] / kTimerFrames;
+    timerSums_[0] = timerSums_[1] = 0;
+    timerFrames_ = 0;
+  }
+}
+
+// Shows the GPU time of the main passes and the culling counts in the title bar
+void Renderer::UpdateTitle() {
+  auto title = "Ice Simulator - " +
+               (usePrepass_ ? "pre-pass " + to_string(prepassMilliseconds_) +
+                                  "ms + shading "
+                            : string("shading ")) +
+               to_string(shadingMilliseconds_) + "ms";
+  if (useGovernor_) {
+    title += ", quality " + to_string(governor_.index() + 1) + "/" +
+             to_string(QualityGovernor::count());
+  }
+  if (useOcclusion_) {
+    const auto drawn =
+        cullStats_.tiles - cullStats_.outside - cullStats_.occluded;
+    title += ", " + to_string(drawn) + "/" + to_string(cullStats_.tiles) +
+             " tiles drawn, " + to_string(cullStats_.occluded) +
+             " occluded, " + to_string(cullStats_.outside) +
+             " outside view, culled in " +
+             to_string(cullStats_.milliseconds) + "ms";
+  }
+  glutSetWindowTitle(title.c_str());
+}
+
+// Makes the knobs of the current quality level take effect and logs them
+void Renderer::ApplyQuality() {
+  const auto &quality = governor_.level();
+  if (light_->SetShadowMapSize(quality.shadowMapSize)) {
+    shadowsPending_ = true;
+  }
+  const auto mesh_error = kMeshError * quality.meshErrorScale;
+  // Tiles are meshed again in the background from the next tick
+  if (kAdaptiveMesh) {
+    Geography::SetMeshError(mesh_error);
+  }
+
+  cout << "Quality " << governor_.index() + 1 << "/"
+       << QualityGovernor::count() << " at " << governor_.average()
+       << "ms per frame (budget " << governor_.budget()
+       << "ms): " << quality.renderScale * 100 << "% resolution, "
+       << light_->shadowMapSize() << " shadow map, "
+       << quality.shadowTaps * quality.shadowTaps * quality.shadowTaps
+       << " shadow taps, mesh error " << mesh_error << ", shadows every "
+       << quality.shadowInterval << " frames" << endl;
+}
+
+void Renderer::Display() {
+  const auto start = chrono::high_resolution_clock::now();
+  ReadTimers();
+  // Whichever of the CPU and the GPU took longer held the last frame up, the
+  // GPU time is from the last frame whose queries are done
+  if (useGovernor_ &&
+      governor_.AddFrame(std::max(cpuMilliseconds_, frameMilliseconds_))) {
+    ApplyQuality();
+  }
+  glQueryCounter(timers_[2], GL_TIMESTAMP);
+  const auto &quality = governor_.level();
+
+  shadowsPending_ = shadowsPending_ || shadowsChanged_;
+  ++shadowFrames_;
+  if (useShadows_ && shadowsPending_ &&
+      shadowFrames_ >= quality.shadowInterval) {
     light_->GenerateCubeMaps(objects_);
+    shadowsPending_ = false;
+    shadowFrames_ = 0;
   }
 
-  glViewport(0, 0, viewport_width_, viewport_height_);
+  // Below full resolution the scene goes through the offscreen target
+  const auto scaled = quality.renderScale < 1;
+  const auto width =
+      std::max(static_cast<int>(viewport_width_ * quality.renderScale), 1);
+  const auto height =
+      std::max(static_cast<int>(viewport_height_ * quality.renderScale), 1);
+  localLights_->Update(camera_, width, height, objects_, terrainChanged_);
+  if (scaled) {
+    target_->Bind(width, height);
+  }
+
+  glViewport(0, 0, width, height);
   glClearColor(0, 0, 0, 1);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  Cull();
+
+  // Both passes are timed every frame, the pre-pass is empty when off
+  glBeginQuery(GL_TIME_ELAPSED, timers_[0]);
+  if (usePrepass_) {
+    glUseProgram(depth_->id());
+    depth_->CopyDataToUniform(camera_.view(), "view");
+    depth_->CopyDataToUniform(camera_.projection(), "projection");
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    light_->Render(depth_);
+    for (const auto geo : visible_) {
+      geo->Render(depth_);
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    // Only the fragments that won the pre-pass are shaded
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_EQUAL);
+  }
+  glEndQuery(GL_TIME_ELAPSED);
+
+  glBeginQuery(GL_TIME_ELAPSED, timers_[1]);
   glUseProgram(shader_->id());
 
   camera_.LoadMatrices(shader_);
   light_->LoadData(shader_);
+  localLights_->LoadData(shader_);
   CheckGLError();
 
   if (!shader_->CopyDataToUniform(useColor_, "useColor")) {
@@ -113,6 +329,9 @@ void Renderer::Display() const {
   if (!shader_->CopyDataToUniform(useShadows_, "useShadows")) {
     cerr << "Shader not considering light toggle" << endl;
   }
+  if (!shader_->CopyDataToUniform(quality.shadowTaps, "shadowTaps")) {
+    cerr << "Shader not considering shadow taps" << endl;
+  }
   float minHeight = numeric_limits<float>::infinity();
   float maxHeight = -minHeight;
   for (const auto object : objects_) {
@@ -139,14 +358,41 @@ void Renderer::Display() const {
   glBindTexture(GL_TEXTURE_CUBE_MAP, light_->getDepthTexture());
   auto depthMap = glGetUniformLocation(shader_->id(), "depthMap");
   glUniform1i(depthMap, 0);
+  // Tiles with baked maps bind them and turn them on as they are drawn
+  shader_->CopyDataToUniform(Geography::kNormalMapUnit, "normalMap");
+  shader_->CopyDataToUniform(Geography::kOcclusionMapUnit, "occlusionMap");
+  shader_->CopyDataToUniform(false, "useNormalMap");
 
   light_->Render(shader_);
-  for (const auto geo : objects_) {
+  for (const auto geo : visible_) {
     geo->Render(shader_);
   }
+  glDepthMask(GL_TRUE);
+  glDepthFunc(GL_LESS);
+  glEndQuery(GL_TIME_ELAPSED);
+  if (scaled) {
+    target_->Blit(viewport_width_, viewport_height_);
+  }
+  glQueryCounter(timers_[3], GL_TIMESTAMP);
+  timersPending_ = true;
+  cpuMilliseconds_ =
+      chrono::duration<double, milli>(chrono::high_resolution_clock::now() -
+                                      start)
+          .count();
+  UpdateTitle();
 
   glutSwapBuffers();
   CheckGLError();
+
+  if (!firstFrame_) {
+    firstFrame_ = true;
+    cout << "Time to first frame: " << StartupMilliseconds() << "ms";
+    if (regenerator_ != nullptr) {
+      cout << ", " << regenerator_->uploaded() << " of "
+           << kGeographyCountShort * kGeographyCountLong << " tiles";
+    }
+    cout << endl;
+  }
 }
 
 void Renderer::Reshape(const int new_width, const int new_height) {
@@ -166,6 +412,15 @@ void Renderer::Keyboard(const unsigned char key, const int, const int) {
     case 'Q':
     case 27:  // ESC
       exit(0);
+    case 'j':
+    case 'J':
+      AddLights();
+      break;
+    case 'u':
+    case 'U':
+      localLights_->Clear();
+      cout << "Local lights: 0" << endl;
+      break;
     case 'k':
     case 'K':
       setPointLight_ = !setPointLight_;
@@ -182,20 +437,50 @@ void Renderer::Keyboard(const unsigned char key, const int, const int) {
     case 'N':
       useColor_ = !useColor_;
       break;
+    case 'o':
+    case 'O':
+      useOcclusion_ = !useOcclusion_;
+      cout << "Occlusion culling: " << (useOcclusion_ ? "on" : "off") << endl;
+      break;
+    case 'g':
+    case 'G':
+      useGovernor_ = !useGovernor_;
+      cout << "Quality governor: " << (useGovernor_ ? "on" : "off") << endl;
+      if (!useGovernor_ && governor_.index() != 0) {
+        governor_.Reset();
+        ApplyQuality();
+      }
+      break;
+    case 'i':
+    case 'I':
+      MemoryAccounting::Print(cout);
+      PrintPeakMemory();
+      break;
+    case 'f':
+    case 'F':
+      usePrepass_ = !usePrepass_;
+      // Averages start over so they never mix both modes
+      timerSums_[0] = timerSums_[1] = 0;
+      timerFrames_ = 0;
+      cout << "Depth pre-pass: " << (usePrepass_ ? "on" : "off") << endl;
+      break;
     case 'p':
     case 'P':
       simulating_ = !simulating_;
       break;
+    case 'e':
+    case 'E':
+      // Same seed with the next kind of noise
+      Grid::SetNoise(static_cast<NoiseType>(
+          (static_cast<size_t>(Grid::noise()) + 1) % kNoiseTypeCount));
+      cout << "Noise: " << NoiseName(Grid::noise()) << endl;
+      Regenerate();
+      break;
     case 'r':
     case 'R':
       Grid::RandomizeBase();
-      for (const auto object : objects_) {
-        const auto geo = dynamic_cast<Geography *>(object);
-        if (geo != nullptr) {
-          geo->Randomize(true);
-        }
-      }
-      shadowsChanged_ = true;
+      cout << "Seed: " << Grid::seed() << endl;
+      Regenerate();
     default:
       break;
   }
@@ -255,6 +540,81 @@ void Renderer::HandleMovementKey(const unsigned char key, const bool down) {
   }
 }
 
+// Scatters kLightBatch local lights a few units above the terrain within a
+// tile's width of the camera
+void Renderer::AddLights() {
+  if (kColdHeights) {
+    UpdateSampler();
+  }
+  uniform_real_distribution<float> unit(0, 1);
+  const auto spread = static_cast<float>(kGeographyShort - 1);
+  const auto &camera = camera_.getPosition();
+  vector<glm::vec2> positions(kLightBatch);
+  for (auto &position : positions) {
+    position = {camera.x + (unit(random_) * 2 - 1) * spread,
+                camera.y + (unit(random_) * 2 - 1) * spread};
+  }
+  vector<float> ground(kLightBatch);
+  sampler_.Sample(positions.data(), kLightBatch, SampleFilter::kBilinear,
+                  ground.data());
+  for (size_t i = 0; i < kLightBatch; ++i) {
+    // Off the terrain
+    if (isnan(ground[i])) {
+      continue;
+    }
+    // Saturated colours at full brightness
+    glm::vec3 color(unit(random_), unit(random_), unit(random_));
+    color /= std::max({color.x, color.y, color.z, 0.01f});
+    localLights_->Add({{positions[i], ground[i] + 2 + unit(random_) * 10},
+                       color,
+                       16 + unit(random_) * 32,
+                       true});
+  }
+  cout << "Local lights: " << localLights_->size() << endl;
+}
+
+double Renderer::StartupMilliseconds() const {
+  return chrono::duration<double, milli>(chrono::high_resolution_clock::now() -
+                                         startTime_)
+      .count();
+}
+
+static_assert(!kColdHeights || kHotTiles >= 9,
+              "The tiles around the camera have to stay decoded together");
+
+// Points the sampler at the heights of the current tiles, which stay valid
+// for as long as the tiles are in objects_. Cold heights are only decoded for
+// the tiles next to the camera's, and may be dropped as soon as other tiles
+// are decoded, so with kColdHeights this is called again before every use.
+void Renderer::UpdateSampler() {
+  sampler_.Clear();
+  const auto &eye = camera_.getPosition();
+  const auto eye_x = static_cast<int>(floor(eye.x / (kGeographyShort - 1)));
+  const auto eye_y = static_cast<int>(floor(eye.y / (kGeographyLong - 1)));
+  for (const auto object : objects_) {
+    const auto geo = dynamic_cast<Geography *>(object);
+    if (geo != nullptr &&
+        (!kColdHeights ||
+         (abs(geo->x() - eye_x) <= 1 && abs(geo->y() - eye_y) <= 1))) {
+      sampler_.SetTile(geo->x(), geo->y(), geo->heights());
+    }
+  }
+}
+
+// Replaces the terrain with the one for the current seed and noise
+void Renderer::Regenerate() {
+  if (streamer_ != nullptr) {
+    streamer_->Reset();
+    objects_ = streamer_->objects();
+    UpdateSampler();
+    shadowsChanged_ = true;
+    terrainChanged_ = true;
+  } else {
+    // The current terrain stays up until the new one has been uploaded
+    regenerator_->Start(Grid::seed(), Grid::noise());
+  }
+}
+
 void Renderer::Tick(int ticks) {
   bool doneSomething = false;
   if (last_mouse_x_ < 0 || last_mouse_x_ > viewport_width_ ||
@@ -284,6 +644,46 @@ void Renderer::Tick(int ticks) {
     doneSomething = true;
   }
 
+  if (streamer_ != nullptr && streamer_->Update(camera_.getPosition())) {
+    objects_ = streamer_->objects();
+    UpdateSampler();
+    doneSomething = true;
+    shadowsChanged_ = true;
+    terrainChanged_ = true;
+  }
+  if (regenerator_ != nullptr && regenerator_->Update(&objects_)) {
+    UpdateSampler();
+    doneSomething = true;
+    shadowsChanged_ = true;
+    terrainChanged_ = true;
+    if (!worldLoaded_ && !regenerator_->running()) {
+      worldLoaded_ = true;
+      cout << "Time to whole world: " << StartupMilliseconds() << "ms\n";
+      cout << "       vertices: "
+           << kGeographyCountShort * kGeographyCountLong * kTileVertices
+           << "\n";
+      PrintPeakMemory();
+    }
+  }
+
+  if (remesher_.Update(objects_)) {
+    doneSomething = true;
+    terrainChanged_ = true;
+  }
+
+  // Keeps the camera above the terrain under it
+  if (kColdHeights) {
+    UpdateSampler();
+  }
+  const auto &eye = camera_.getPosition();
+  const glm::vec2 below(eye.x, eye.y);
+  float ground;
+  sampler_.Sample(&below, 1, SampleFilter::kCatmullRom, &ground);
+  if (!isnan(ground) && eye.z < ground + kCameraClearance) {
+    camera_.AbsoluteMove({0, 0, ground + kCameraClearance - eye.z});
+    doneSomething = true;
+  }
+
   if (setPointLight_) {
     light_->setPosition(camera_.getPosition());
     light_->setColors({1, 1, 1});
@@ -316,6 +716,7 @@ void Renderer::Tick(int ticks) {
 void Renderer::DisplayCB() {
   window->Display();
   window->shadowsChanged_ = false;
+  window->terrainChanged_ = false;
 }
 
 void Renderer::ReshapeCB(const int w, const int h) { window->Reshape(w, h); }
@@ -360,6 +761,15 @@ void Renderer::PrintOpenGLError(GLenum errorCode) {
   }
 }
 
+// Meshes are written straight into mapped buffers, so after startup this
+// should sit close to the resident heights plus whatever the driver keeps
+void Renderer::PrintPeakMemory() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  // Reported in KiB on Linux
+  cout << "       peak RSS: " << usage.ru_maxrss / 1024 << "MiB\n";
+}
+
 void Renderer::PrintKeyMap() {
   cout << "\n";
   cout << "Mouse control:\n";
@@ -368,14 +778,21 @@ void Renderer::PrintKeyMap() {
   cout << "Keyboard control (case-insensitive):\n";
   cout << "\tx, q, [ESC]: Quit program\n";
   cout << "\tr: Regenerate terrain\n";
+  cout << "\te: Cycle noise engine (perlin/simplex/value)\n";
   cout << "\n";
   cout << "\twasd: Move forward/left/backward/right relative to the camera\n";
   cout << "\tcz: Move up/down relative to the world\n";
   cout << "\n";
+  cout << "\tf: Toggle depth pre-pass\n";
+  cout << "\tg: Toggle quality governor\n";
+  cout << "\ti: Print memory use per subsystem\n";
+  cout << "\tj: Add " << kLightBatch << " local lights around the camera\n";
+  cout << "\tu: Remove all local lights\n";
   cout << "\tk: Toggle point light following camera\n";
   cout << "\tl: Toggle phong light simulation\n";
   cout << "\tm: Toggle shadows\n";
   cout << "\tn: Toggle ground/normal colour\n";
+  cout << "\to: Toggle occlusion culling\n";
   cout << "\tp: Toggle day/night cycle\n";
   cout << endl;
 }
@@ -1,12 +1,23 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <random>
 #include <vector>
 
 #include "camera.h"
+#include "clustered_lights.h"
 #include "constants.h"
 #include "geography.h"
+#include "occlusion_culler.h"
 #include "point_light.h"
+#include "quality_governor.h"
+#include "regenerator.h"
+#include "remesher.h"
+#include "render_target.h"
 #include "shader.h"
+#include "terrain_sampler.h"
+#include "tile_streamer.h"
 
 constexpr auto kInitialWidth = 1280;
 constexpr auto kInitialHeight = 720;
@@ -28,13 +39,18 @@ class Renderer {
   static void PrintOpenGLError(GLenum);
 
   static void PrintKeyMap();
+  static void PrintPeakMemory();
 
  private:
   static Renderer *window;
 
   void InitGeom();
 
-  void Display() const;
+  void Cull();
+  void ReadTimers();
+  void UpdateTitle();
+  void ApplyQuality();
+  void Display();
   void Reshape(int, int);
   void Keyboard(unsigned char, int, int);
   void KeyboardUp(unsigned char, int, int);
@@ -43,8 +59,19 @@ class Renderer {
 
   void HandleMouseMove(int, int, bool);
   void HandleMovementKey(unsigned char, bool);
+  void AddLights();
+  void Regenerate();
+  void UpdateSampler();
+  double StartupMilliseconds() const;
   void Tick(int);
 
+  // Startup is timed from the construction of the Renderer to the first frame
+  // and to the last tile of the world being uploaded
+  std::chrono::high_resolution_clock::time_point startTime_{
+      std::chrono::high_resolution_clock::now()};
+  bool firstFrame_{false};
+  bool worldLoaded_{kStreamWorld};
+
   int viewport_width_{kInitialWidth};
   int viewport_height_{kInitialHeight};
 
@@ -60,9 +87,50 @@ class Renderer {
   bool setPointLight_{false};
   bool useShadows_{true};
   bool shadowsChanged_{true};
+  bool terrainChanged_{true};
+  bool useOcclusion_{kOcclusionCulling};
+  bool usePrepass_{kDepthPrepass};
+  bool useGovernor_{kQualityGovernor};
+  // The main light moved since its shadows were last drawn, which happens at
+  // most every QualityLevel::shadowInterval frames
+  bool shadowsPending_{true};
+  int shadowFrames_{0};
+
+  // Tiles in the last frame drawn with occlusion culling
+  struct CullStats {
+    std::size_t tiles{0};
+    std::size_t outside{0};
+    std::size_t occluded{0};
+    double milliseconds{0};
+  } cullStats_;
+
+  // GPU time of the depth pre-pass and of the shading pass, then timestamps at
+  // the start and end of the frame. The queries of the last frame are read
+  // once their results are in.
+  GLuint timers_[4]{};
+  bool timersPending_{false};
+  double timerSums_[2]{};
+  int timerFrames_{0};
+  double prepassMilliseconds_{0};
+  double shadingMilliseconds_{0};
+  double frameMilliseconds_{0};
+  double cpuMilliseconds_{0};
+  QualityGovernor governor_{1000.0 / kFPS};
 
   Camera camera_{viewport_width_, viewport_height_};
   std::vector<Renderable *> objects_{};
+  // Objects not culled in the current frame
+  std::vector<Renderable *> visible_{};
+  OcclusionCuller occlusion_;
+  // Heights of the tiles in objects_
+  TerrainSampler sampler_{kMaxThreads};
   PointLight *light_;
+  ClusteredLights *localLights_;
+  std::mt19937 random_{};
   Shader *shader_;
+  Shader *depth_;
+  RenderTarget *target_;
+  TileStreamer *streamer_{nullptr};
+  Regenerator *regenerator_{nullptr};
+  Remesher remesher_;
 };
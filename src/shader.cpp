@@ -1,41 +1,102 @@
 #include "shader.h"
 
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <sstream>
 #include <string>
+#include <vector>
 
+#include "constants.h"
 #include "renderer.h"
 
 using namespace std;
 
+// "PSPB" in little-endian
+constexpr uint32_t kProgramMagic{0x42505350};
+
+// Header of a cached program binary, followed by the binary itself
+struct ProgramBinaryHeader {
+  uint32_t magic;
+  GLenum format;
+  GLsizei length;
+};
+
+int Shader::programs_{0};
+int Shader::cachedPrograms_{0};
+double Shader::milliseconds_{0};
+
+// Loads the program from the binary cache when the driver has seen the same
+// sources before, and otherwise compiles it and caches the result
 Shader::Shader(const string &vertexShaderFile, const string &fragmentShaderFile,
                const string &geometryShaderFile) {
-  auto vertexShaderId = CompileShader(vertexShaderFile, GL_VERTEX_SHADER);
-  auto fragmentShaderId = CompileShader(fragmentShaderFile, GL_FRAGMENT_SHADER);
-  GLuint geometryShaderId;
+  const auto start = chrono::high_resolution_clock::now();
+  const auto vertexSource = ReadFile(vertexShaderFile);
+  const auto fragmentSource = ReadFile(fragmentShaderFile);
+  const auto geometrySource =
+      geometryShaderFile.empty() ? "" : ReadFile(geometryShaderFile);
+  const auto cachePath =
+      kProgramCache
+          ? CachePath({vertexSource, fragmentSource, geometrySource})
+          : "";
 
   id_ = glCreateProgram();
+  const auto cached = !cachePath.empty() && LoadBinary(cachePath);
+  if (!cached) {
+    auto vertexShaderId =
+        CompileShader(vertexSource, vertexShaderFile, GL_VERTEX_SHADER);
+    auto fragmentShaderId =
+        CompileShader(fragmentSource, fragmentShaderFile, GL_FRAGMENT_SHADER);
+    GLuint geometryShaderId;
+
+    glAttachShader(id_, vertexShaderId);
+    CheckGLError("Error in attaching the vertex shader");
+    glAttachShader(id_, fragmentShaderId);
+    CheckGLError("Error in attaching the fragment shader");
+
+    if (!geometryShaderFile.empty()) {
+      geometryShaderId = CompileShader(geometrySource, geometryShaderFile,
+                                       GL_GEOMETRY_SHADER);
+      glAttachShader(id_, geometryShaderId);
+      CheckGLError("Error in attaching the geometry shader");
+    }
 
-  glAttachShader(id_, vertexShaderId);
-  CheckGLError("Error in attaching the vertex shader");
-  glAttachShader(id_, fragmentShaderId);
-  CheckGLError("Error in attaching the fragment shader");
+    if (!cachePath.empty()) {
+      glProgramParameteri(id_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(id_);
+    CheckProgramivError(id_, GL_LINK_STATUS,
+                        "Error when creating shader program");
+
+    glDeleteShader(vertexShaderId);
+    glDeleteShader(fragmentShaderId);
+    if (!geometryShaderFile.empty()) {
+      glDeleteShader(geometryShaderId);
+    }
 
-  if (!geometryShaderFile.empty()) {
-    geometryShaderId = CompileShader(geometryShaderFile, GL_GEOMETRY_SHADER);
-    glAttachShader(id_, geometryShaderId);
-    CheckGLError("Error in attaching the geometry shader");
+    if (!cachePath.empty()) {
+      SaveBinary(cachePath);
+    }
   }
 
-  glLinkProgram(id_);
-  CheckProgramivError(id_, GL_LINK_STATUS,
-                      "Error when creating shader program");
-
-  glDeleteShader(vertexShaderId);
-  glDeleteShader(fragmentShaderId);
-  if (!geometryShaderFile.empty()) {
-    glDeleteShader(geometryShaderId);
+  GLint length = 0;
+  if (GLEW_ARB_get_program_binary) {
+    glGetProgramiv(id_, GL_PROGRAM_BINARY_LENGTH, &length);
   }
+  charge_.Set(length);
+
+  ++programs_;
+  cachedPrograms_ += cached ? 1 : 0;
+  milliseconds_ += chrono::duration<double, milli>(
+                       chrono::high_resolution_clock::now() - start)
+                       .count();
 
   glUseProgram(id_);
   PrintStatus();
@@ -113,27 +174,18 @@ bool Shader::CopyDataToUniform(bool data, const string &name) const {
 }
 
 string Shader::ReadFile(const string &filename) {
-  string data, line;
-  ifstream file;
-  file.open(filename, std::ios::binary);
-  if (file.is_open()) {
-    while (getline(file, line)) {
-      data += line + '\n';
-    }
-    if (data.empty()) {
-      data.pop_back();
-    }
-  } else {
+  ifstream file(filename, ios::binary);
+  if (!file.is_open()) {
     throw runtime_error("Could not open " + filename);
   }
-  return data;
+  return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
 }
 
-GLuint Shader::CompileShader(const std::string &filename,
+GLuint Shader::CompileShader(const std::string &source,
+                             const std::string &filename,
                              const GLenum shader_type) {
   const GLuint id = glCreateShader(shader_type);
-  auto shaderString = ReadFile(filename);
-  auto shaderC_str = shaderString.c_str();
+  auto shaderC_str = source.c_str();
   glShaderSource(id, 1, &shaderC_str, nullptr);
   glCompileShader(id);
   CheckShaderivError(id, GL_COMPILE_STATUS,
@@ -141,6 +193,113 @@ GLuint Shader::CompileShader(const std::string &filename,
   return id;
 }
 
+// 64-bit FNV-1a, each part followed by a zero byte so that moving text from
+// one part to the next changes the hash
+static uint64_t Hash(const vector<string> &parts) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const auto &part : parts) {
+    for (const auto c : part) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static string GLString(const GLenum name) {
+  const auto value = glGetString(name);
+  return value == nullptr ? "" : reinterpret_cast<const char *>(value);
+}
+
+string Shader::CachePath(const vector<string> &sources) {
+  GLint formats = 0;
+  if (GLEW_ARB_get_program_binary) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  }
+  if (formats == 0) {
+    return "";
+  }
+
+  // A driver update has to miss, its binaries may not load or behave the same
+  auto parts = sources;
+  for (const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION,
+                          GL_SHADING_LANGUAGE_VERSION}) {
+    parts.push_back(GLString(name));
+  }
+  ostringstream path;
+  path << kProgramCacheDirectory << "/" << hex << setw(16) << setfill('0')
+       << Hash(parts) << ".bin";
+  return path.str();
+}
+
+// Errors are sticky until read, so one left over from earlier setup would
+// otherwise be taken for a failure of the next call. Bounded, since a lost
+// context keeps reporting itself.
+static void ClearGLErrors() {
+  for (auto i = 0; i < 16 && glGetError() != GL_NO_ERROR; ++i) {
+  }
+}
+
+// Any failure, including a binary the driver no longer accepts, leaves a
+// fresh program object behind for compiling from source
+bool Shader::LoadBinary(const string &path) {
+  ifstream file(path, ios::binary);
+  ProgramBinaryHeader header{};
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != kProgramMagic || header.length <= 0) {
+    return false;
+  }
+  vector<char> binary(static_cast<size_t>(header.length));
+  if (!file.read(binary.data(), header.length)) {
+    return false;
+  }
+
+  ClearGLErrors();
+  glProgramBinary(id_, header.format, binary.data(), header.length);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(id_, GL_LINK_STATUS, &linked);
+  // Unknown formats are reported as errors rather than failed links
+  const auto error = glGetError();
+  if (linked == GL_TRUE && error == GL_NO_ERROR) {
+    return true;
+  }
+  cerr << "Discarding stale program binary " << path << endl;
+  remove(path.c_str());
+  glDeleteProgram(id_);
+  id_ = glCreateProgram();
+  return false;
+}
+
+// Written to a temporary file first so another instance never loads half a
+// binary
+void Shader::SaveBinary(const string &path) const {
+  GLint length = 0;
+  glGetProgramiv(id_, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  vector<char> binary(static_cast<size_t>(length));
+  ProgramBinaryHeader header{kProgramMagic, 0, 0};
+  ClearGLErrors();
+  glGetProgramBinary(id_, length, &header.length, &header.format,
+                     binary.data());
+  if (glGetError() != GL_NO_ERROR || header.length <= 0) {
+    return;
+  }
+
+  if (mkdir(kProgramCacheDirectory, 0755) != 0 && errno != EEXIST) {
+    return;
+  }
+  const auto temporaryPath = path + ".tmp";
+  ofstream file(temporaryPath, ios::binary | ios::trunc);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(binary.data(), header.length);
+  file.close();
+  if (!file || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+    remove(temporaryPath.c_str());
+  }
+}
+
 void Shader::PrintStatus() const {
   GLint rc;
   GLsizei length;
@@ -5,11 +5,10 @@
 #include <array>
 #include <glm/glm.hpp>
 #include <string>
+#include <vector>
 
-struct Vertex {
-  glm::vec3 position;
-  glm::vec3 normal;
-};
+#include "memory_accounting.h"
+#include "vertex.h"
 
 class Shader {
  public:
@@ -28,11 +27,31 @@ class Shader {
 
   inline GLuint id() const { return id_; }
 
+  // Programs created so far, how many of them came from the binary cache and
+  // the total time spent creating them
+  static inline int programs() { return programs_; }
+  static inline int cachedPrograms() { return cachedPrograms_; }
+  static inline double milliseconds() { return milliseconds_; }
+
  private:
   GLuint id_;
+  // The size of the program binary, the nearest the driver comes to saying
+  // what the program takes
+  MemoryCharge charge_{MemoryPool::kShaderPrograms};
 
   static std::string ReadFile(const std::string &);
-  static GLuint CompileShader(const std::string &, GLenum);
+  static GLuint CompileShader(const std::string &, const std::string &,
+                              GLenum);
+
+  // Program binaries are keyed by a hash of the sources and the driver, an
+  // empty path means the driver cannot give binaries back
+  static std::string CachePath(const std::vector<std::string> &);
+  bool LoadBinary(const std::string &);
+  void SaveBinary(const std::string &) const;
+
+  static int programs_;
+  static int cachedPrograms_;
+  static double milliseconds_;
 
   static void CheckGLError(const std::string &);
   static void CheckProgramivError(GLuint, GLenum, const std::string &);
@@ -0,0 +1,12 @@
+#version 330 core
+
+
+in vec3 worldPos;
+
+uniform vec3 lightPos;
+uniform float radius;
+
+
+void main() {
+    gl_FragDepth = length(worldPos - lightPos) / radius;
+}
@@ -0,0 +1,16 @@
+#version 330 core
+
+
+uniform mat4 model;
+uniform mat4 lightMatrix;
+
+in vec3 vtxPos;
+
+out vec3 worldPos;
+
+
+void main() {
+    vec4 position = model * vec4(vtxPos, 1.0);
+    worldPos = position.xyz;
+    gl_Position = lightMatrix * position;
+}
@@ -0,0 +1,489 @@
+#include "terrain_exporter.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include "constants.h"
+#include "grid.h"
+#include "noise_field.h"
+#include "terrain_mesh.h"
+#include "thread_pool.h"
+#include "tile_generator.h"
+
+using namespace std;
+
+constexpr char kPngSignature[] = "\x89PNG\r\n\x1a\n";
+constexpr char kObjHeader[] = "# perlin-shadows terrain, Y-up\n";
+// Deflate's stored blocks hold at most this many bytes
+constexpr size_t kStoredBlock{65535};
+constexpr uint32_t kAdlerModulus{65521};
+
+bool ParseExportFormat(const string &name, ExportFormat *format) {
+  const pair<const char *, ExportFormat> formats[] = {
+      {"raw", ExportFormat::kRaw},
+      {"png", ExportFormat::kPng},
+      {"obj", ExportFormat::kObj},
+      {"gltf", ExportFormat::kGltf}};
+  for (const auto &entry : formats) {
+    if (name == entry.first) {
+      *format = entry.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint32_t Crc32(const char *data, const size_t size,
+                      uint32_t crc = 0xffffffff) {
+  static const auto table = [] {
+    array<uint32_t, 256> entries{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      auto value = i;
+      for (auto bit = 0; bit < 8; ++bit) {
+        value = value & 1 ? 0xedb88320 ^ (value >> 1) : value >> 1;
+      }
+      entries[i] = value;
+    }
+    return entries;
+  }();
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static uint32_t Adler32(const char *data, const size_t size) {
+  uint32_t a = 1, b = 0;
+  for (size_t i = 0; i < size; ++i) {
+    a = (a + static_cast<uint8_t>(data[i])) % kAdlerModulus;
+    b = (b + a) % kAdlerModulus;
+  }
+  return b << 16 | a;
+}
+
+// Adler-32 of two runs of bytes one after the other, from the checksum of
+// each and the length of the second
+static uint32_t CombineAdler32(const uint32_t first, const uint32_t second,
+                               const uint64_t length) {
+  const uint64_t a1 = first & 0xffff, b1 = first >> 16;
+  const uint64_t a2 = second & 0xffff, b2 = second >> 16;
+  const auto a = (a1 + a2 + kAdlerModulus - 1) % kAdlerModulus;
+  const auto b = (b1 + b2 + (length % kAdlerModulus) *
+                                ((a1 + kAdlerModulus - 1) % kAdlerModulus)) %
+                 kAdlerModulus;
+  return static_cast<uint32_t>(b << 16 | a);
+}
+
+static void AppendBigEndian(const uint32_t value, vector<char> *out) {
+  for (auto shift = 24; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>(value >> shift));
+  }
+}
+
+// A complete PNG chunk of the given type around data
+static void AppendPngChunk(const char *type, const vector<char> &data,
+                           vector<char> *out) {
+  AppendBigEndian(static_cast<uint32_t>(data.size()), out);
+  const auto start = out->size();
+  out->insert(out->end(), type, type + 4);
+  out->insert(out->end(), data.begin(), data.end());
+  AppendBigEndian(Crc32(out->data() + start, out->size() - start) ^ 0xffffffff,
+                  out);
+}
+
+static void Write(const vector<char> &bytes, ostream *out,
+                  ExportStats *stats) {
+  out->write(bytes.data(), static_cast<streamsize>(bytes.size()));
+  stats->bytes += bytes.size();
+}
+
+TerrainExporter::TerrainExporter(const mt19937::result_type seed,
+                                 const NoiseType noise, const int tiles_x,
+                                 const int tiles_y, const size_t threads)
+    : seed_(seed),
+      noise_(noise),
+      tilesX_(tiles_x),
+      tilesY_(tiles_y),
+      threads_(std::max<size_t>(threads, 1)) {}
+
+ExportStats TerrainExporter::Export(const ExportFormat format,
+                                    const string &path) const {
+  ofstream out(path, ios::binary | ios::trunc);
+  if (!out) {
+    throw runtime_error("Cannot write to " + path);
+  }
+
+  ExportStats stats{tilesX_ * (kGeographyShort - 1) + 1,
+                    tilesY_ * (kGeographyLong - 1) + 1,
+                    0,
+                    0,
+                    numeric_limits<float>::max(),
+                    numeric_limits<float>::lowest()};
+  const auto start = chrono::high_resolution_clock::now();
+  switch (format) {
+    case ExportFormat::kRaw:
+      WriteHeights(false, &out, &stats);
+      break;
+    case ExportFormat::kPng:
+      WriteHeights(true, &out, &stats);
+      break;
+    case ExportFormat::kObj:
+      WriteObj(&out, &stats);
+      break;
+    case ExportFormat::kGltf:
+      WriteGltf(path, &out, &stats);
+      break;
+  }
+  out.close();
+  if (!out) {
+    throw runtime_error("Failed writing " + path);
+  }
+  stats.seconds =
+      chrono::duration<double>(chrono::high_resolution_clock::now() - start)
+          .count();
+  return stats;
+}
+
+// Chunks are written strictly in order as they finish, a new one is started
+// for each one written
+void TerrainExporter::Stream(
+    const size_t count, const function<void(size_t, Chunk *)> &encode,
+    const function<void(const Chunk &)> &write) const {
+  ThreadPool pool(threads_);
+  mutex done_mutex;
+  condition_variable finished;
+  deque<unique_ptr<Chunk>> window;
+  size_t submitted = 0;
+  const auto submit = [&] {
+    window.emplace_back(new Chunk());
+    const auto chunk = window.back().get();
+    const auto index = submitted++;
+    pool.Submit([&, chunk, index] {
+      encode(index, chunk);
+      {
+        lock_guard<mutex> lock(done_mutex);
+        chunk->done = true;
+      }
+      finished.notify_all();
+    });
+  };
+
+  while (submitted < count && window.size() < 2 * threads_) {
+    submit();
+  }
+  while (!window.empty()) {
+    {
+      unique_lock<mutex> lock(done_mutex);
+      finished.wait(lock, [&window] { return window.front()->done; });
+    }
+    write(*window.front());
+    window.pop_front();
+    if (submitted < count) {
+      submit();
+    }
+  }
+}
+
+// Both hold the rows of the whole world in order of y. PNG rows are big-endian
+// behind a filter byte and stored in uncompressed deflate blocks, so no
+// compression library is needed and encoding runs as fast as RAW.
+void TerrainExporter::WriteHeights(const bool png, ostream *out,
+                                   ExportStats *stats) const {
+  uint32_t checksum = 1;
+  if (png) {
+    vector<char> header(kPngSignature,
+                        kPngSignature + sizeof(kPngSignature) - 1);
+    vector<char> ihdr;
+    AppendBigEndian(static_cast<uint32_t>(stats->width), &ihdr);
+    AppendBigEndian(static_cast<uint32_t>(stats->length), &ihdr);
+    // 16-bit greyscale, deflate, adaptive filtering, not interlaced
+    const char format[] = {16, 0, 0, 0, 0};
+    ihdr.insert(ihdr.end(), format, format + sizeof(format));
+    AppendPngChunk("IHDR", ihdr, &header);
+    // zlib header: deflate with a 32 KiB window, no dictionary
+    AppendPngChunk("IDAT", {0x78, 0x01}, &header);
+    Write(header, out, stats);
+  }
+
+  Stream(
+      static_cast<size_t>(tilesY_),
+      [this, png](size_t row, Chunk *chunk) {
+        EncodeHeights(row, png, chunk);
+      },
+      [&](const Chunk &chunk) {
+        Write(chunk.bytes, out, stats);
+        stats->min = std::min(stats->min, chunk.min);
+        stats->max = std::max(stats->max, chunk.max);
+        checksum = CombineAdler32(checksum, chunk.checksum, chunk.checked);
+      });
+
+  if (png) {
+    // An empty final stored block and the checksum end the zlib stream
+    vector<char> end = {1, 0, 0, -1, -1};
+    AppendBigEndian(checksum, &end);
+    vector<char> trailer;
+    AppendPngChunk("IDAT", end, &trailer);
+    AppendPngChunk("IEND", {}, &trailer);
+    Write(trailer, out, stats);
+  }
+}
+
+// A row of tiles, each tile's last row belongs to the next row of tiles
+// except in the last one
+void TerrainExporter::EncodeHeights(const size_t row, const bool png,
+                                    Chunk *chunk) const {
+  const auto width = tilesX_ * (kGeographyShort - 1) + 1;
+  const auto rows =
+      kGeographyLong - (row + 1 < static_cast<size_t>(tilesY_) ? 1 : 0);
+  const auto pitch = width * 2 + (png ? 1 : 0);
+  vector<char> lines(rows * pitch);
+  const NoiseField field(seed_, noise_);
+  vector<float> height(kTotalVertices);
+  chunk->min = numeric_limits<float>::max();
+  chunk->max = numeric_limits<float>::lowest();
+  for (auto tile = 0; tile < tilesX_; ++tile) {
+    GenerateTile(field, tile, static_cast<int>(row), 1, height.data());
+    for (size_t y = 0; y < rows; ++y) {
+      auto line = lines.data() + y * pitch + (png ? 1 : 0) +
+                  tile * (kGeographyShort - 1) * 2;
+      for (size_t x = 0; x < kGeographyShort; ++x, line += 2) {
+        const auto value = height[index(x, y)];
+        chunk->min = std::min(chunk->min, value);
+        chunk->max = std::max(chunk->max, value);
+        const auto scaled = lround(
+            (value + kExportHeightRange) / (2 * kExportHeightRange) * 65535);
+        const auto level =
+            static_cast<uint16_t>(std::min(std::max(scaled, 0L), 65535L));
+        line[png ? 0 : 1] = static_cast<char>(level >> 8);
+        line[png ? 1 : 0] = static_cast<char>(level & 0xff);
+      }
+    }
+  }
+  if (!png) {
+    chunk->bytes = move(lines);
+    return;
+  }
+
+  // Filter type 0 leads every row
+  for (size_t y = 0; y < rows; ++y) {
+    lines[y * pitch] = 0;
+  }
+  chunk->checked = lines.size();
+  chunk->checksum = Adler32(lines.data(), lines.size());
+  vector<char> blocks;
+  blocks.reserve(lines.size() + (lines.size() / kStoredBlock + 1) * 5);
+  for (size_t offset = 0; offset < lines.size(); offset += kStoredBlock) {
+    const auto size = std::min(kStoredBlock, lines.size() - offset);
+    const char header[] = {0, static_cast<char>(size & 0xff),
+                           static_cast<char>(size >> 8),
+                           static_cast<char>(~size & 0xff),
+                           static_cast<char>((~size >> 8) & 0xff)};
+    blocks.insert(blocks.end(), header, header + sizeof(header));
+    blocks.insert(blocks.end(), lines.begin() + offset,
+                  lines.begin() + offset + size);
+  }
+  AppendPngChunk("IDAT", blocks, &chunk->bytes);
+}
+
+// Faces index back from the end of the vertex list, so every tile is encoded
+// without knowing how many vertices the tiles before it kept
+void TerrainExporter::WriteObj(ostream *out, ExportStats *stats) const {
+  Write(vector<char>(kObjHeader, kObjHeader + sizeof(kObjHeader) - 1), out,
+        stats);
+  Stream(
+      static_cast<size_t>(tilesX_ * tilesY_),
+      [this](size_t tile, Chunk *chunk) { EncodeMesh(tile, true, chunk); },
+      [&](const Chunk &chunk) {
+        Write(chunk.bytes, out, stats);
+        stats->min = std::min(stats->min, chunk.min);
+        stats->max = std::max(stats->max, chunk.max);
+      });
+}
+
+// The binary buffer streams out tile by tile, the JSON describing it only
+// needs a few numbers per tile and is written once the buffer is complete
+void TerrainExporter::WriteGltf(const string &path, ostream *out,
+                                ExportStats *stats) const {
+  const auto dot = path.find_last_of('.');
+  const auto slash = path.find_last_of('/');
+  auto bin_path = (dot == string::npos ||
+                   (slash != string::npos && dot < slash)
+                       ? path
+                       : path.substr(0, dot)) +
+                  ".bin";
+  ofstream bin(bin_path, ios::binary | ios::trunc);
+  if (!bin) {
+    throw runtime_error("Cannot write to " + bin_path);
+  }
+
+  struct Tile {
+    size_t offset;
+    size_t vertices;
+    size_t indices;
+    float min;
+    float max;
+  };
+  vector<Tile> tiles;
+  size_t offset = 0;
+  Stream(
+      static_cast<size_t>(tilesX_ * tilesY_),
+      [this](size_t tile, Chunk *chunk) { EncodeMesh(tile, false, chunk); },
+      [&](const Chunk &chunk) {
+        Write(chunk.bytes, &bin, stats);
+        tiles.push_back(
+            {offset, chunk.vertices, chunk.indices, chunk.min, chunk.max});
+        offset += chunk.bytes.size();
+        stats->min = std::min(stats->min, chunk.min);
+        stats->max = std::max(stats->max, chunk.max);
+      });
+  bin.close();
+  if (!bin) {
+    throw runtime_error("Failed writing " + bin_path);
+  }
+
+  const auto name = bin_path.substr(slash == string::npos ? 0 : slash + 1);
+  // Bounds are printed exactly, validators hold the vertices to them
+  ostringstream json;
+  json << setprecision(9);
+  json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"perlin-shadows\"},"
+       << "\"buffers\":[{\"uri\":\"" << name << "\",\"byteLength\":" << offset
+       << "}],\"bufferViews\":[";
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    const auto &tile = tiles[i];
+    const auto vertex_bytes = tile.vertices * sizeof(Vertex);
+    json << (i == 0 ? "" : ",") << "{\"buffer\":0,\"byteOffset\":"
+         << tile.offset << ",\"byteLength\":" << vertex_bytes
+         << ",\"byteStride\":" << sizeof(Vertex) << ",\"target\":34962},"
+         << "{\"buffer\":0,\"byteOffset\":" << tile.offset + vertex_bytes
+         << ",\"byteLength\":" << tile.indices * 4 << ",\"target\":34963}";
+  }
+  json << "],\"accessors\":[";
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    const auto &tile = tiles[i];
+    const auto x = static_cast<float>(i % tilesX_ * (kGeographyShort - 1));
+    const auto y = static_cast<float>(i / tilesX_ * (kGeographyLong - 1));
+    json << (i == 0 ? "" : ",") << "{\"bufferView\":" << i * 2
+         << ",\"componentType\":5126,\"count\":" << tile.vertices
+         << ",\"type\":\"VEC3\",\"min\":[" << x << "," << tile.min << ","
+         << -(y + kGeographyLong - 1) << "],\"max\":["
+         << x + kGeographyShort - 1 << "," << tile.max << "," << -y << "]},"
+         << "{\"bufferView\":" << i * 2 << ",\"byteOffset\":"
+         << offsetof(Vertex, normal)
+         << ",\"componentType\":5126,\"count\":" << tile.vertices
+         << ",\"type\":\"VEC3\"},"
+         << "{\"bufferView\":" << i * 2 + 1
+         << ",\"componentType\":5125,\"count\":" << tile.indices
+         << ",\"type\":\"SCALAR\"}";
+  }
+  json << "],\"meshes\":[";
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    json << (i == 0 ? "" : ",")
+         << "{\"primitives\":[{\"attributes\":{\"POSITION\":" << i * 3
+         << ",\"NORMAL\":" << i * 3 + 1 << "},\"indices\":" << i * 3 + 2
+         << "}]}";
+  }
+  json << "],\"nodes\":[";
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    json << (i == 0 ? "" : ",") << "{\"mesh\":" << i << "}";
+  }
+  json << "],\"scenes\":[{\"nodes\":[";
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    json << (i == 0 ? "" : ",") << i;
+  }
+  json << "]}],\"scene\":0}\n";
+  const auto text = json.str();
+  Write(vector<char>(text.begin(), text.end()), out, stats);
+}
+
+// World positions, Y-up with the terrain's y running along -z. The mirrored
+// axis turns the clockwise triangles drawn by the renderer counter-clockwise.
+void TerrainExporter::EncodeMesh(const size_t tile, const bool obj,
+                                 Chunk *chunk) const {
+  const auto tile_x = static_cast<int>(tile % tilesX_);
+  const auto tile_y = static_cast<int>(tile / tilesX_);
+  Grid height, slope_x, slope_y;
+  GenerateTile(NoiseField(seed_, noise_), tile_x, tile_y, 1, height.data(),
+               slope_x.data(), slope_y.data());
+
+  vector<Vertex> vertices(kTotalVertices);
+  height.WriteVertices(slope_x, slope_y, vertices.data(), 0, kGeographyLong);
+  vector<unsigned int> indices;
+  if (kAdaptiveMesh) {
+    TerrainMesh(height.data()).Triangulate(kMeshError, &indices);
+  } else {
+    indices.resize(kTotalIndices);
+    height.WriteIndices(indices.data(), 0, kGeographyLong - 1);
+  }
+
+  // Only the vertices the triangles use are kept, in order of first use. The
+  // bounds of a glTF accessor have to be those of the kept vertices.
+  vector<unsigned int> remap(kTotalVertices, 0);
+  vector<Vertex> kept;
+  chunk->min = numeric_limits<float>::max();
+  chunk->max = numeric_limits<float>::lowest();
+  for (auto &i : indices) {
+    if (remap[i] == 0) {
+      const auto &vertex = vertices[i];
+      chunk->min = std::min(chunk->min, vertex.position.z);
+      chunk->max = std::max(chunk->max, vertex.position.z);
+      kept.push_back(
+          {{vertex.position.x + tile_x * (kGeographyShort - 1),
+            vertex.position.z,
+            -(vertex.position.y + tile_y * (kGeographyLong - 1))},
+           {vertex.normal.x, vertex.normal.z, -vertex.normal.y}});
+      remap[i] = static_cast<unsigned int>(kept.size());
+    }
+    i = remap[i] - 1;
+  }
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    swap(indices[i + 1], indices[i + 2]);
+  }
+  chunk->vertices = kept.size();
+  chunk->indices = indices.size();
+
+  if (!obj) {
+    const auto vertex_bytes = kept.size() * sizeof(Vertex);
+    chunk->bytes.resize(vertex_bytes + indices.size() * sizeof(unsigned int));
+    memcpy(chunk->bytes.data(), kept.data(), vertex_bytes);
+    memcpy(chunk->bytes.data() + vertex_bytes, indices.data(),
+           indices.size() * sizeof(unsigned int));
+    return;
+  }
+
+  auto &text = chunk->bytes;
+  char line[128];
+  const auto append = [&text, &line](int length) {
+    text.insert(text.end(), line, line + length);
+  };
+  append(snprintf(line, sizeof(line), "o tile_%d_%d\n", tile_x, tile_y));
+  for (const auto &vertex : kept) {
+    append(snprintf(line, sizeof(line), "v %.7g %.7g %.7g\n",
+                    vertex.position.x, vertex.position.y, vertex.position.z));
+  }
+  for (const auto &vertex : kept) {
+    append(snprintf(line, sizeof(line), "vn %.4f %.4f %.4f\n", vertex.normal.x,
+                    vertex.normal.y, vertex.normal.z));
+  }
+  const auto count = static_cast<long>(kept.size());
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const auto a = static_cast<long>(indices[i]) - count;
+    const auto b = static_cast<long>(indices[i + 1]) - count;
+    const auto c = static_cast<long>(indices[i + 2]) - count;
+    append(snprintf(line, sizeof(line), "f %ld//%ld %ld//%ld %ld//%ld\n", a, a,
+                    b, b, c, c));
+  }
+}
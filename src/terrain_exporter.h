@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "noise_engine.h"
+
+enum class ExportFormat { kRaw, kPng, kObj, kGltf };
+
+// Parses "raw", "png", "obj" or "gltf"
+bool ParseExportFormat(const std::string &, ExportFormat *);
+
+struct ExportStats {
+  std::size_t width;
+  std::size_t length;
+  std::uint64_t bytes;
+  double seconds;
+  float min;
+  float max;
+};
+
+// Writes a generated world of tiles_x x tiles_y tiles to disk, without ever
+// holding more than a few tiles of it. Heightmaps go a row of tiles at a time
+// and meshes a tile at a time; each such chunk is generated and encoded on a
+// pool of worker threads and written in order, with at most two chunks per
+// worker in flight.
+//
+// Heightmaps are 16-bit, kExportHeightRange below zero to kExportHeightRange
+// above it mapped onto [0, 65535]. Meshes are Y-up with counter-clockwise
+// triangles, one mesh per tile, and only keep vertices the triangles use.
+class TerrainExporter {
+ public:
+  TerrainExporter(std::mt19937::result_type, NoiseType, int tiles_x,
+                  int tiles_y, std::size_t threads);
+
+  // glTF also writes its buffer next to path, with the extension .bin
+  ExportStats Export(ExportFormat, const std::string &path) const;
+
+ private:
+  struct Chunk {
+    std::vector<char> bytes;
+    std::size_t vertices{0};
+    std::size_t indices{0};
+    float min{0};
+    float max{0};
+    // Adler-32 of the PNG scanlines inside bytes, and how long they are
+    std::uint32_t checksum{1};
+    std::size_t checked{0};
+    bool done{false};
+  };
+
+  void Stream(std::size_t, const std::function<void(std::size_t, Chunk *)> &,
+              const std::function<void(const Chunk &)> &) const;
+
+  void WriteHeights(bool, std::ostream *, ExportStats *) const;
+  void WriteObj(std::ostream *, ExportStats *) const;
+  void WriteGltf(const std::string &, std::ostream *, ExportStats *) const;
+
+  void EncodeHeights(std::size_t, bool, Chunk *) const;
+  void EncodeMesh(std::size_t, bool, Chunk *) const;
+
+  std::mt19937::result_type seed_;
+  NoiseType noise_;
+  int tilesX_;
+  int tilesY_;
+  std::size_t threads_;
+};
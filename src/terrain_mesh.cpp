@@ -0,0 +1,117 @@
+#include "terrain_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "grid.h"
+
+using namespace std;
+
+// Cells along each side of the tile
+constexpr size_t kCells{kGeographyShort - 1};
+
+TerrainMesh::TerrainMesh(const float *height) : errors_(kTotalVertices) {
+  const auto &triangles = Triangles();
+  const auto count = triangles.size() / 4;
+  // Triangles below this one have no children
+  const auto parents = count - kCells * kCells;
+
+  // Finest triangles first, so every child's error is known before its parent
+  // folds it into its own
+  for (auto i = count; i-- > 0;) {
+    const size_t ax = triangles[i * 4];
+    const size_t ay = triangles[i * 4 + 1];
+    const size_t bx = triangles[i * 4 + 2];
+    const size_t by = triangles[i * 4 + 3];
+    const auto mx = (ax + bx) / 2;
+    const auto my = (ay + by) / 2;
+    const auto middle = index(mx, my);
+
+    auto error = abs((height[index(ax, ay)] + height[index(bx, by)]) / 2 -
+                     height[middle]);
+    // A hypotenuse along the edge of the tile is always split
+    if ((ax == bx && (ax == 0 || ax == kCells)) ||
+        (ay == by && (ay == 0 || ay == kCells))) {
+      error = numeric_limits<float>::max();
+    }
+    if (i < parents) {
+      const auto cx = mx + my - ay;
+      const auto cy = my + ax - mx;
+      error = std::max({error, errors_[index((ax + cx) / 2, (ay + cy) / 2)],
+                        errors_[index((bx + cx) / 2, (by + cy) / 2)]});
+    }
+    // The triangle on the other side of the hypotenuse shares the midpoint
+    errors_[middle] = std::max(errors_[middle], error);
+  }
+}
+
+void TerrainMesh::Triangulate(const float max_error,
+                              vector<unsigned int> *indices) const {
+  Split(0, 0, kCells, kCells, kCells, 0, max_error, indices);
+  Split(kCells, kCells, 0, 0, 0, kCells, max_error, indices);
+}
+
+// Splits the triangle with hypotenuse a-b and right angle c into the two
+// halves on either side of the midpoint of a-b, or keeps it whole when that
+// midpoint is within the error. Keeps the same (clockwise) winding as
+// Grid::WriteIndices.
+void TerrainMesh::Split(const size_t ax, const size_t ay, const size_t bx,
+                        const size_t by, const size_t cx, const size_t cy,
+                        const float max_error,
+                        vector<unsigned int> *indices) const {
+  const auto mx = (ax + bx) / 2;
+  const auto my = (ay + by) / 2;
+  // Legs one cell long have no vertex between their ends
+  const auto legs =
+      (ax > cx ? ax - cx : cx - ax) + (ay > cy ? ay - cy : cy - ay);
+  if (legs > 1 && errors_[index(mx, my)] > max_error) {
+    Split(cx, cy, ax, ay, mx, my, max_error, indices);
+    Split(bx, by, cx, cy, mx, my, max_error, indices);
+    return;
+  }
+  indices->push_back(static_cast<unsigned int>(index(ax, ay)));
+  indices->push_back(static_cast<unsigned int>(index(bx, by)));
+  indices->push_back(static_cast<unsigned int>(index(cx, cy)));
+}
+
+const vector<uint16_t> &TerrainMesh::Triangles() {
+  static const auto triangles = [] {
+    // Every triangle is numbered by the path to it through the binary tree of
+    // splits, starting from the two halves of the tile
+    const auto count = kCells * kCells * 2 - 2;
+    vector<uint16_t> result(count * 4);
+    for (size_t i = 0; i < count; ++i) {
+      auto id = i + 2;
+      size_t ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+      if (id & 1) {
+        bx = by = cx = kCells;
+      } else {
+        ax = ay = cy = kCells;
+      }
+      while ((id >>= 1) > 1) {
+        const auto mx = (ax + bx) / 2;
+        const auto my = (ay + by) / 2;
+        if (id & 1) {
+          bx = ax;
+          by = ay;
+          ax = cx;
+          ay = cy;
+        } else {
+          ax = bx;
+          ay = by;
+          bx = cx;
+          by = cy;
+        }
+        cx = mx;
+        cy = my;
+      }
+      result[i * 4] = static_cast<uint16_t>(ax);
+      result[i * 4 + 1] = static_cast<uint16_t>(ay);
+      result[i * 4 + 2] = static_cast<uint16_t>(bx);
+      result[i * 4 + 3] = static_cast<uint16_t>(by);
+    }
+    return result;
+  }();
+  return triangles;
+}
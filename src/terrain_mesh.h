@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "constants.h"
+
+// Right-triangulated irregular network over the heights of a tile, after
+// "MARTINI: Real-Time RTIN Terrain Mesh" by Vladimir Agafonkin. Triangles are
+// split along their hypotenuse only where the surface deviates from them by
+// more than the allowed error, so flat ground gets a few large triangles and
+// rough ground keeps the full resolution. Needs square tiles of 2^n + 1
+// vertices a side.
+//
+// Every vertex along the edge of the tile is always kept, so the mesh meets
+// the tiles next to it without cracks whatever their own errors.
+class TerrainMesh {
+ public:
+  static constexpr bool Supported() {
+    return kGeographyShort == kGeographyLong &&
+           ((kGeographyShort - 1) & (kGeographyShort - 2)) == 0;
+  }
+
+  // Works out the error of every possible triangle for the row-major heights
+  explicit TerrainMesh(const float *);
+
+  // Appends the indices (into the tile's vertices) of the triangles. Errors
+  // are measured at the midpoints of each split, against the hypotenuse being
+  // split, so points inside a triangle may stray a little past max_error.
+  void Triangulate(float, std::vector<unsigned int> *) const;
+
+ private:
+  void Split(std::size_t, std::size_t, std::size_t, std::size_t, std::size_t,
+             std::size_t, float, std::vector<unsigned int> *) const;
+
+  // Corners a and b (the ends of the hypotenuse) of every triangle in the
+  // hierarchy, coarsest first, the right angle corner follows from those
+  static const std::vector<std::uint16_t> &Triangles();
+
+  std::vector<float> errors_;
+};
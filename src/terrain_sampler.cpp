@@ -0,0 +1,363 @@
+#include "terrain_sampler.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "constants.h"
+#include "grid.h"
+
+using namespace std;
+
+// Tiles share their last row and column with the next tile over
+constexpr int kStepX{kGeographyShort - 1};
+constexpr int kStepY{kGeographyLong - 1};
+
+static uint64_t Key(const int64_t x, const int64_t y) {
+  return static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32 |
+         static_cast<uint32_t>(y);
+}
+
+// Finds tiles by position, remembering the last one since the positions of a
+// batch tend to fall on the same few tiles
+struct Lookup {
+  const float *Find(const int64_t x, const int64_t y) {
+    const auto key = Key(x, y);
+    if (key != lastKey) {
+      const auto tile = tiles->find(key);
+      lastKey = key;
+      lastTile = tile == tiles->end() ? nullptr : tile->second;
+    }
+    return lastTile;
+  }
+
+  const unordered_map<uint64_t, const float *> *tiles;
+  uint64_t lastKey{~0ull};
+  const float *lastTile{nullptr};
+};
+
+// Where a position falls: its tile, the cell within that and how far across
+struct Point {
+  const float *tile;
+  int64_t tile_x;
+  int64_t tile_y;
+  int cell_x;
+  int cell_y;
+  float fx;
+  float fy;
+  // Every height the filter reads lies within the tile
+  bool inside;
+};
+
+static void Locate(const float position, const int step, int64_t *tile,
+                   int *cell, float *fraction) {
+  *tile = static_cast<int64_t>(floor(position / step));
+  const auto local = position - static_cast<float>(*tile * step);
+  *cell = std::min(std::max(static_cast<int>(floor(local)), 0), step - 1);
+  *fraction = std::min(std::max(local - static_cast<float>(*cell), 0.0f), 1.0f);
+}
+
+static Point Resolve(Lookup *lookup, const glm::vec2 &position,
+                     const SampleFilter filter) {
+  Point point{};
+  if (!isfinite(position.x) || !isfinite(position.y)) {
+    return point;
+  }
+  Locate(position.x, kStepX, &point.tile_x, &point.cell_x, &point.fx);
+  Locate(position.y, kStepY, &point.tile_y, &point.cell_y, &point.fy);
+  point.tile = lookup->Find(point.tile_x, point.tile_y);
+  point.inside = filter == SampleFilter::kBilinear ||
+                 (point.cell_x >= 1 && point.cell_x + 2 <= kStepX &&
+                  point.cell_y >= 1 && point.cell_y + 2 <= kStepY);
+  return point;
+}
+
+// Height at an offset from the cell's first corner, from the next tile over
+// when that falls outside the tile, or the tile's own edge without one
+static float Tap(Lookup *lookup, const Point &point, const int dx,
+                 const int dy) {
+  if (point.tile == nullptr) {
+    return 0;
+  }
+  auto x = point.cell_x + dx;
+  auto y = point.cell_y + dy;
+  if (point.inside) {
+    return point.tile[index(x, y)];
+  }
+  auto tile_x = point.tile_x;
+  auto tile_y = point.tile_y;
+  if (x < 0) {
+    --tile_x;
+    x += kStepX;
+  } else if (x > kStepX) {
+    ++tile_x;
+    x -= kStepX;
+  }
+  if (y < 0) {
+    --tile_y;
+    y += kStepY;
+  } else if (y > kStepY) {
+    ++tile_y;
+    y -= kStepY;
+  }
+  auto tile = lookup->Find(tile_x, tile_y);
+  if (tile == nullptr) {
+    tile = point.tile;
+    x = std::min(std::max(point.cell_x + dx, 0), kStepX);
+    y = std::min(std::max(point.cell_y + dy, 0), kStepY);
+  }
+  return tile[index(x, y)];
+}
+
+// Weights of each tap along one axis and their derivatives, returns how many
+// taps there are. Catmull-Rom reads one before the cell and two after it.
+static int Weights(const SampleFilter filter, const float t, float *w,
+                   float *d) {
+  if (filter == SampleFilter::kBilinear) {
+    w[0] = 1 - t;
+    w[1] = t;
+    d[0] = -1;
+    d[1] = 1;
+    return 2;
+  }
+  w[0] = t * (t * (-0.5f * t + 1) - 0.5f);
+  w[1] = t * t * (1.5f * t - 2.5f) + 1;
+  w[2] = t * (t * (-1.5f * t + 2) + 0.5f);
+  w[3] = t * t * (0.5f * t - 0.5f);
+  d[0] = t * (-1.5f * t + 2) - 0.5f;
+  d[1] = t * (4.5f * t - 5);
+  d[2] = t * (-4.5f * t + 4) + 0.5f;
+  d[3] = t * (1.5f * t - 1);
+  return 4;
+}
+
+static glm::vec3 Normal(const float slope_x, const float slope_y) {
+  const auto scale = 1 / sqrt(slope_x * slope_x + slope_y * slope_y + 1);
+  return {-slope_x * scale, -slope_y * scale, scale};
+}
+
+static bool SampleOne(Lookup *lookup, const glm::vec2 &position,
+                      const SampleFilter filter, float *height,
+                      glm::vec3 *normal) {
+  const auto point = Resolve(lookup, position, filter);
+  if (point.tile == nullptr) {
+    *height = numeric_limits<float>::quiet_NaN();
+    if (normal != nullptr) {
+      *normal = {0, 0, 1};
+    }
+    return false;
+  }
+
+  float wx[4], dx[4], wy[4], dy[4];
+  const auto taps = Weights(filter, point.fx, wx, dx);
+  Weights(filter, point.fy, wy, dy);
+  const auto first = taps == 4 ? -1 : 0;
+  float h = 0, slope_x = 0, slope_y = 0;
+  for (auto j = 0; j < taps; ++j) {
+    float row = 0, row_slope = 0;
+    for (auto i = 0; i < taps; ++i) {
+      const auto tap = Tap(lookup, point, first + i, first + j);
+      row += wx[i] * tap;
+      row_slope += dx[i] * tap;
+    }
+    h += wy[j] * row;
+    slope_x += wy[j] * row_slope;
+    slope_y += dy[j] * row;
+  }
+  *height = h;
+  if (normal != nullptr) {
+    *normal = Normal(slope_x, slope_y);
+  }
+  return true;
+}
+
+#ifdef __SSE2__
+// Same operations in the same order as the scalar version, for four lanes
+static void Weights(const SampleFilter filter, const __m128 t, __m128 *w,
+                    __m128 *d) {
+  const auto one = _mm_set1_ps(1);
+  if (filter == SampleFilter::kBilinear) {
+    w[0] = _mm_sub_ps(one, t);
+    w[1] = t;
+    d[0] = _mm_set1_ps(-1);
+    d[1] = one;
+    return;
+  }
+  const auto tt = _mm_mul_ps(t, t);
+  const auto half = _mm_set1_ps(0.5f);
+  // Polynomial a * t + b
+  const auto linear = [t](const float a, const float b) {
+    return _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a), t), _mm_set1_ps(b));
+  };
+  w[0] = _mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, linear(-0.5f, 1)), half));
+  w[1] = _mm_add_ps(_mm_mul_ps(tt, linear(1.5f, -2.5f)), one);
+  w[2] = _mm_mul_ps(t, _mm_add_ps(_mm_mul_ps(t, linear(-1.5f, 2)), half));
+  w[3] = _mm_mul_ps(tt, linear(0.5f, -0.5f));
+  d[0] = _mm_sub_ps(_mm_mul_ps(t, linear(-1.5f, 2)), half);
+  d[1] = _mm_mul_ps(t, linear(4.5f, -5));
+  d[2] = _mm_add_ps(_mm_mul_ps(t, linear(-4.5f, 4)), half);
+  d[3] = _mm_mul_ps(t, linear(1.5f, -1));
+}
+
+// Samples four positions, returns how many were on a tile
+static size_t SampleFour(Lookup *lookup, const glm::vec2 *positions,
+                         const SampleFilter filter, float *heights,
+                         glm::vec3 *normals) {
+  Point points[4];
+  for (auto k = 0; k < 4; ++k) {
+    points[k] = Resolve(lookup, positions[k], filter);
+  }
+  __m128 wx[4], dx[4], wy[4], dy[4];
+  Weights(filter,
+          _mm_setr_ps(points[0].fx, points[1].fx, points[2].fx, points[3].fx),
+          wx, dx);
+  Weights(filter,
+          _mm_setr_ps(points[0].fy, points[1].fy, points[2].fy, points[3].fy),
+          wy, dy);
+  const auto taps = filter == SampleFilter::kBilinear ? 2 : 4;
+  const auto first = taps == 4 ? -1 : 0;
+
+#ifdef __AVX2__
+  auto gather = points[0].tile != nullptr;
+  for (auto k = 0; k < 4; ++k) {
+    gather = gather && points[k].inside && points[k].tile == points[0].tile;
+  }
+  const auto base = _mm_setr_epi32(
+      static_cast<int>(index(points[0].cell_x, points[0].cell_y)),
+      static_cast<int>(index(points[1].cell_x, points[1].cell_y)),
+      static_cast<int>(index(points[2].cell_x, points[2].cell_y)),
+      static_cast<int>(index(points[3].cell_x, points[3].cell_y)));
+#endif
+
+  auto h = _mm_setzero_ps();
+  auto slope_x = _mm_setzero_ps();
+  auto slope_y = _mm_setzero_ps();
+  for (auto j = 0; j < taps; ++j) {
+    auto row = _mm_setzero_ps();
+    auto row_slope = _mm_setzero_ps();
+    for (auto i = 0; i < taps; ++i) {
+      __m128 tap;
+#ifdef __AVX2__
+      if (gather) {
+        const auto offset =
+            first + i + (first + j) * static_cast<int>(kGeographyShort);
+        tap = _mm_i32gather_ps(points[0].tile,
+                               _mm_add_epi32(base, _mm_set1_epi32(offset)),
+                               4);
+      } else
+#endif
+      {
+        tap = _mm_setr_ps(Tap(lookup, points[0], first + i, first + j),
+                          Tap(lookup, points[1], first + i, first + j),
+                          Tap(lookup, points[2], first + i, first + j),
+                          Tap(lookup, points[3], first + i, first + j));
+      }
+      row = _mm_add_ps(row, _mm_mul_ps(wx[i], tap));
+      row_slope = _mm_add_ps(row_slope, _mm_mul_ps(dx[i], tap));
+    }
+    h = _mm_add_ps(h, _mm_mul_ps(wy[j], row));
+    slope_x = _mm_add_ps(slope_x, _mm_mul_ps(wy[j], row_slope));
+    slope_y = _mm_add_ps(slope_y, _mm_mul_ps(dy[j], row));
+  }
+  _mm_storeu_ps(heights, h);
+
+  float x[4], y[4], z[4];
+  if (normals != nullptr) {
+    const auto scale = _mm_div_ps(
+        _mm_set1_ps(1),
+        _mm_sqrt_ps(_mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(slope_x, slope_x),
+                       _mm_mul_ps(slope_y, slope_y)),
+            _mm_set1_ps(1))));
+    const auto zero = _mm_setzero_ps();
+    _mm_storeu_ps(x, _mm_mul_ps(_mm_sub_ps(zero, slope_x), scale));
+    _mm_storeu_ps(y, _mm_mul_ps(_mm_sub_ps(zero, slope_y), scale));
+    _mm_storeu_ps(z, scale);
+  }
+  size_t found = 0;
+  for (auto k = 0; k < 4; ++k) {
+    if (points[k].tile == nullptr) {
+      heights[k] = numeric_limits<float>::quiet_NaN();
+      x[k] = y[k] = 0;
+      z[k] = 1;
+    } else {
+      ++found;
+    }
+    if (normals != nullptr) {
+      normals[k] = {x[k], y[k], z[k]};
+    }
+  }
+  return found;
+}
+#endif
+
+void TerrainSampler::SetTile(const int x, const int y, const float *heights) {
+  if (heights == nullptr) {
+    tiles_.erase(Key(x, y));
+  } else {
+    tiles_[Key(x, y)] = heights;
+  }
+}
+
+size_t TerrainSampler::Sample(const glm::vec2 *positions, const size_t count,
+                              const SampleFilter filter, float *heights,
+                              glm::vec3 *normals) const {
+  if (threads_ <= 1 || count < kParallelSamples) {
+    return SampleRange(positions, count, filter, heights, normals);
+  }
+
+  const auto band = (count + threads_ - 1) / threads_;
+  vector<size_t> found(threads_, 0);
+  vector<thread> workers;
+  for (size_t first = 0, i = 0; first < count; first += band, ++i) {
+    const auto size = std::min(band, count - first);
+    workers.emplace_back([this, positions, first, size, filter, heights,
+                          normals, &found, i] {
+      found[i] = SampleRange(positions + first, size, filter, heights + first,
+                             normals == nullptr ? nullptr : normals + first);
+    });
+  }
+
+  // Wait for thread completion
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  size_t total = 0;
+  for (const auto part : found) {
+    total += part;
+  }
+  return total;
+}
+
+size_t TerrainSampler::SampleRange(const glm::vec2 *positions,
+                                   const size_t count,
+                                   const SampleFilter filter, float *heights,
+                                   glm::vec3 *normals) const {
+  Lookup lookup{&tiles_};
+  size_t found = 0;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  if (simd_) {
+    for (; i + 4 <= count; i += 4) {
+      found += SampleFour(&lookup, positions + i, filter, heights + i,
+                          normals == nullptr ? nullptr : normals + i);
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    found += SampleOne(&lookup, positions[i], filter, heights + i,
+                       normals == nullptr ? nullptr : normals + i);
+  }
+  return found;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <unordered_map>
+
+enum class SampleFilter { kBilinear, kCatmullRom };
+
+// Height and normal of the terrain at arbitrary world (x, y) positions, over
+// the heights of whichever tiles it is given. Bilinear reads the four vertices
+// around a position, Catmull-Rom the sixteen around it, reaching into the next
+// tile over near edges when that tile is there. Normals are those of the
+// interpolated surface.
+//
+// Positions go four at a time through SSE2, gathering each lane's heights
+// (with AVX2 gathers when all four read inside the same tile), and batches of
+// kParallelSamples or more are split over threads. The result is the same for
+// any thread count and with or without SIMD.
+class TerrainSampler {
+ public:
+  explicit TerrainSampler(std::size_t threads = 1, bool simd = true)
+      : threads_(threads), simd_(simd) {}
+
+  // Row-major heights of tile (x, y) as held by Grid, which have to stay
+  // valid while they are sampled. Null removes the tile.
+  void SetTile(int x, int y, const float *);
+  inline void Clear() { tiles_.clear(); }
+
+  // Writes the height at each position and, unless normals is null, the unit
+  // normal. Positions off every tile get a NaN height and an upwards normal.
+  // Returns how many positions were on a tile.
+  std::size_t Sample(const glm::vec2 *positions, std::size_t count,
+                     SampleFilter, float *heights,
+                     glm::vec3 *normals = nullptr) const;
+
+ private:
+  std::size_t SampleRange(const glm::vec2 *, std::size_t, SampleFilter,
+                          float *, glm::vec3 *) const;
+
+  std::unordered_map<std::uint64_t, const float *> tiles_;
+  std::size_t threads_;
+  bool simd_;
+};
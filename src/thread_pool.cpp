@@ -0,0 +1,63 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(const size_t threads) {
+  for (size_t i = 0; i < threads; ++i) {
+    threads_.emplace_back(&ThreadPool::Work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+    jobs_.clear();
+  }
+  condition_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Submit(function<void()> job) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    jobs_.push_back(move(job));
+  }
+  condition_.notify_one();
+}
+
+void ThreadPool::Clear() {
+  lock_guard<mutex> lock(mutex_);
+  jobs_.clear();
+}
+
+void ThreadPool::Work() {
+  while (true) {
+    function<void()> job;
+    {
+      unique_lock<mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      job = move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
+
+void Barrier::Wait() {
+  unique_lock<mutex> lock(mutex_);
+  const auto generation = generation_;
+  if (++waiting_ == count_) {
+    waiting_ = 0;
+    ++generation_;
+    condition_.notify_all();
+    return;
+  }
+  condition_.wait(lock,
+                  [this, generation] { return generation_ != generation; });
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling jobs off a shared FIFO queue
+class ThreadPool {
+ public:
+  explicit ThreadPool(std::size_t);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void Submit(std::function<void()>);
+  // Drops every job that has not been started yet
+  void Clear();
+
+  inline std::size_t size() const { return threads_.size(); }
+
+ private:
+  void Work();
+
+  std::vector<std::thread> threads_;
+  std::deque<std::function<void()>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stopping_{false};
+};
+
+// Blocks each of a fixed number of threads until all of them have arrived
+class Barrier {
+ public:
+  explicit Barrier(std::size_t count) : count_(count) {}
+
+  void Wait();
+
+ private:
+  std::size_t count_;
+  std::size_t waiting_{0};
+  std::size_t generation_{0};
+  std::mutex mutex_;
+  std::condition_variable condition_;
+};
@@ -0,0 +1,169 @@
+#include "tile_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "constants.h"
+#include "tile_store.h"
+
+using namespace std;
+
+// "PSTC" in little-endian
+constexpr uint32_t kTileMagic{0x43545350};
+// Bump whenever the layout of TileHeader or Vertex, or the generated terrain
+// itself, changes
+constexpr uint32_t kTileVersion{6};
+
+static_assert(sizeof(TileHeader) % 16 == 0,
+              "Vertex data should start on an aligned offset");
+
+TileCache::~TileCache() { Unload(); }
+
+// Maps the cached file for the given seed and noise, or the tile's slot in the
+// store when there is no such file, returns false on any kind of miss (missing
+// file, different version or parameters, truncated or unfinished tile)
+bool TileCache::Load(const mt19937::result_type seed, const NoiseType noise) {
+  Unload();
+
+  off_t offset = 0;
+  auto fd = open(Path(seed, noise).c_str(), O_RDONLY);
+  if (fd == -1) {
+    fd = TileStore::Find(seed, noise, x_, y_, &offset);
+    if (fd == -1) {
+      return false;
+    }
+  }
+
+  struct stat info {};
+  const auto expectedSize =
+      sizeof(TileHeader) + kTotalVertices * sizeof(Vertex);
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < offset + expectedSize ||
+      (offset == 0 && static_cast<size_t>(info.st_size) != expectedSize)) {
+    close(fd);
+    return false;
+  }
+
+  auto mapping = mmap(nullptr, expectedSize, PROT_READ,
+                      MAP_PRIVATE | MAP_POPULATE, fd, offset);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  const auto expected = ExpectedHeader(seed, noise, x_, y_);
+  const auto actual = static_cast<const TileHeader *>(mapping);
+  // Everything up to min/max is part of the key
+  if (memcmp(&expected, actual, offsetof(TileHeader, min)) != 0 ||
+      actual->vertexCount != expected.vertexCount) {
+    munmap(mapping, expectedSize);
+    return false;
+  }
+
+  madvise(mapping, expectedSize, MADV_SEQUENTIAL);
+  mapping_ = mapping;
+  mappingSize_ = expectedSize;
+  return true;
+}
+
+// Writes to a temporary file first so an interrupted write is never mistaken
+// for a valid tile
+bool TileCache::BeginStore(const mt19937::result_type seed,
+                           const NoiseType noise, const float min,
+                           const float max) {
+  if (mkdir(kTileCacheDirectory, 0755) != 0 && errno != EEXIST) {
+    cerr << "Could not create tile cache directory " << kTileCacheDirectory
+         << endl;
+    return false;
+  }
+
+  auto header = ExpectedHeader(seed, noise, x_, y_);
+  header.min = min;
+  header.max = max;
+
+  storePath_ = Path(seed, noise);
+  store_.close();
+  store_.clear();
+  store_.open(storePath_ + ".tmp", ios::binary | ios::trunc);
+  store_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  return static_cast<bool>(store_);
+}
+
+void TileCache::StoreVertices(const Vertex *vertices, const size_t count) {
+  store_.write(reinterpret_cast<const char *>(vertices),
+               static_cast<streamsize>(count * sizeof(Vertex)));
+}
+
+bool TileCache::EndStore() {
+  const auto temporaryPath = storePath_ + ".tmp";
+  const auto complete = store_.tellp() == static_cast<streamoff>(
+      sizeof(TileHeader) + kTotalVertices * sizeof(Vertex));
+  store_.close();
+  if (!complete || !store_ ||
+      rename(temporaryPath.c_str(), storePath_.c_str()) != 0) {
+    cerr << "Could not write tile cache " << storePath_ << endl;
+    remove(temporaryPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+void TileCache::Unload() {
+  if (mapping_ == nullptr) {
+    return;
+  }
+  munmap(mapping_, mappingSize_);
+  mapping_ = nullptr;
+  mappingSize_ = 0;
+}
+
+TileHeader TileCache::ExpectedHeader(const mt19937::result_type seed,
+                                     const NoiseType noise, const int x,
+                                     const int y) {
+  TileHeader header{};
+  header.magic = kTileMagic;
+  header.version = kTileVersion;
+  header.seed = seed;
+  header.x = x;
+  header.y = y;
+  header.width = kGeographyShort;
+  header.length = kGeographyLong;
+  header.detail = kDetail;
+  header.minDetail = kMinDetail;
+  header.heightMultiplier = kHeightMultiplier;
+  header.noise = static_cast<uint32_t>(noise);
+  header.hydraulicIterations = kErosion ? kHydraulicIterations : 0;
+  header.thermalIterations = kErosion ? kThermalIterations : 0;
+  header.vertexCount = kTotalVertices;
+  return header;
+}
+
+// Tile size, octave parameters and erosion budget, shared by tiles and stores
+static string Parameters() {
+  return to_string(kGeographyShort) + "x" + to_string(kGeographyLong) + "_" +
+         to_string(kDetail) + "_" + to_string(kMinDetail) +
+         (kErosion ? "_e" + to_string(kHydraulicIterations) + "_" +
+                         to_string(kThermalIterations)
+                   : "");
+}
+
+string TileCache::Path(const mt19937::result_type seed,
+                       const NoiseType noise) const {
+  return string(kTileCacheDirectory) + "/" + to_string(seed) + "_" +
+         NoiseName(noise) + "_" +
+         to_string(x_) + "_" + to_string(y_) + "_" + Parameters() + ".tile";
+}
+
+string TileCache::StorePath(const mt19937::result_type seed,
+                            const NoiseType noise) {
+  return string(kTileCacheDirectory) + "/" + to_string(seed) + "_" +
+         NoiseName(noise) + "_" + Parameters() + ".store";
+}
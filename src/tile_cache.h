@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <string>
+
+#include "noise_engine.h"
+#include "vertex.h"
+
+// Header at the start of every cached tile file, followed directly by the
+// tile's vertices exactly as they are uploaded to the VBO
+struct TileHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t seed;
+  std::int32_t x;
+  std::int32_t y;
+  std::uint32_t width;
+  std::uint32_t length;
+  std::uint32_t detail;
+  std::uint32_t minDetail;
+  float heightMultiplier;
+  std::uint32_t noise;
+  // Both 0 without erosion
+  std::uint32_t hydraulicIterations;
+  std::uint32_t thermalIterations;
+  float min;
+  float max;
+  std::uint32_t vertexCount;
+  // Keeps the vertex data 16-byte aligned within the mapping
+  std::uint32_t reserved[3];
+};
+
+// A single generated tile on disk, keyed by seed, noise type, tile position,
+// tile size, octave parameters and erosion budget. Loading maps the file
+// read-only so the vertex data can be handed straight to glBufferData without
+// an intermediate copy. Tiles missing from the directory are looked up in the
+// TileStore for the same seed and noise.
+class TileCache {
+ public:
+  TileCache(int x, int y) : x_(x), y_(y) {}
+  ~TileCache();
+
+  TileCache(const TileCache &) = delete;
+  TileCache &operator=(const TileCache &) = delete;
+
+  bool Load(std::mt19937::result_type, NoiseType);
+  void Unload();
+
+  // Vertices are stored in order over any number of StoreVertices calls, the
+  // tile only becomes visible to Load once EndStore succeeds
+  bool BeginStore(std::mt19937::result_type, NoiseType, float, float);
+  void StoreVertices(const Vertex *, std::size_t);
+  bool EndStore();
+
+  inline bool loaded() const { return mapping_ != nullptr; }
+  inline const Vertex *vertices() const {
+    return reinterpret_cast<const Vertex *>(
+        static_cast<const char *>(mapping_) + sizeof(TileHeader));
+  }
+  inline float min() const { return header()->min; }
+  inline float max() const { return header()->max; }
+
+  // Header a valid tile at (x, y) carries, with min and max left at zero
+  static TileHeader ExpectedHeader(std::mt19937::result_type, NoiseType, int x,
+                                   int y);
+  // Path of the TileStore for the given seed and noise
+  static std::string StorePath(std::mt19937::result_type, NoiseType);
+
+ private:
+  inline const TileHeader *header() const {
+    return static_cast<const TileHeader *>(mapping_);
+  }
+
+  std::string Path(std::mt19937::result_type, NoiseType) const;
+
+  int x_;
+  int y_;
+
+  void *mapping_{nullptr};
+  std::size_t mappingSize_{0};
+
+  std::ofstream store_;
+  std::string storePath_;
+};
@@ -0,0 +1,89 @@
+#include "tile_generator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "constants.h"
+#include "erosion.h"
+
+using namespace std;
+
+// Evaluates the rectangle with one thread for each band of rows
+static void Evaluate(const NoiseField &field, const int64_t first_x,
+                     const int64_t first_y, const size_t width,
+                     const size_t length, const size_t threads, float *height,
+                     float *slope_x, float *slope_y) {
+  if (threads <= 1) {
+    field.Evaluate(first_x, first_y, 1, width, length, height, slope_x,
+                   slope_y);
+    return;
+  }
+
+  const auto band = (length + threads - 1) / threads;
+  vector<thread> workers;
+  for (size_t row = 0; row < length; row += band) {
+    const auto rows = std::min(band, length - row);
+    const auto offset = row * width;
+    workers.emplace_back([&field, first_x, first_y, width, row, rows, offset,
+                          height, slope_x, slope_y] {
+      field.Evaluate(first_x, first_y + static_cast<int64_t>(row), 1, width,
+                     rows, height + offset,
+                     slope_x == nullptr ? nullptr : slope_x + offset,
+                     slope_y == nullptr ? nullptr : slope_y + offset);
+    });
+  }
+
+  // Wait for thread completion
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+// Erodes the tile along with a halo around it, wide enough that the cells of
+// the tile come out the same as in the tiles next to it
+static void Erode(const NoiseField &field, const int64_t first_x,
+                  const int64_t first_y, const size_t threads, float *height,
+                  float *slope_x, float *slope_y) {
+  const auto halo = std::max<size_t>(
+      Erosion::Halo(kThermalIterations, kHydraulicIterations), 1);
+  const auto width = kGeographyShort + 2 * halo;
+  const auto length = kGeographyLong + 2 * halo;
+  vector<float> region(width * length);
+  Evaluate(field, first_x - static_cast<int64_t>(halo),
+           first_y - static_cast<int64_t>(halo), width, length, threads,
+           region.data(), nullptr, nullptr);
+  Erosion(width, length, std::max<size_t>(threads, 1))
+      .Run(region.data(), kThermalIterations, kHydraulicIterations);
+
+  // The noise slopes no longer apply, the halo also gives every cell of the
+  // tile both neighbours for central differences
+  for (size_t y = 0; y < kGeographyLong; ++y) {
+    const auto row = region.data() + (y + halo) * width + halo;
+    copy(row, row + kGeographyShort, height + y * kGeographyShort);
+    if (slope_x == nullptr) {
+      continue;
+    }
+    for (size_t x = 0; x < kGeographyShort; ++x) {
+      const auto i = x + y * kGeographyShort;
+      slope_x[i] = (row[x + 1] - row[x - 1]) * 0.5f;
+      slope_y[i] = (row[x + width] - row[x - width]) * 0.5f;
+    }
+  }
+}
+
+// Tiles share their last row and column with the next tile over, which
+// samples the same world positions and so matches exactly
+void GenerateTile(const NoiseField &field, const int x, const int y,
+                  const size_t threads, float *height, float *slope_x,
+                  float *slope_y) {
+  const auto first_x = static_cast<int64_t>(x) * (kGeographyShort - 1);
+  const auto first_y = static_cast<int64_t>(y) * (kGeographyLong - 1);
+  if (kErosion) {
+    Erode(field, first_x, first_y, threads, height, slope_x, slope_y);
+  } else {
+    Evaluate(field, first_x, first_y, kGeographyShort, kGeographyLong, threads,
+             height, slope_x, slope_y);
+  }
+}
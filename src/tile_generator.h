@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+
+#include "noise_field.h"
+
+// Heights of tile (x, y) of the world, row-major kGeographyShort x
+// kGeographyLong and eroded when kErosion is set, along with their slopes
+// unless those are null. Work is split over up to the given number of threads.
+// Needs no GL, Geography and the exporter both generate tiles through this.
+void GenerateTile(const NoiseField &, int x, int y, std::size_t threads,
+                  float *height, float *slope_x = nullptr,
+                  float *slope_y = nullptr);
@@ -0,0 +1,194 @@
+#include "tile_store.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "constants.h"
+#include "grid.h"
+#include "tile_generator.h"
+
+using namespace std;
+
+// "PSTS" in little-endian
+constexpr uint32_t kStoreMagic{0x53545350};
+// Bump whenever the layout of TileStoreHeader changes
+constexpr uint32_t kStoreVersion{1};
+// Covers the page size of every platform we run on, so each slot can be
+// mapped on its own
+constexpr size_t kSlotAlignment{1 << 16};
+
+static_assert(sizeof(TileStoreHeader) <= kSlotAlignment,
+              "The header fits before the first slot");
+
+static size_t SlotSize() {
+  const auto size = sizeof(TileHeader) + kTotalVertices * sizeof(Vertex);
+  return (size + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+}
+
+static size_t SlotIndex(const TileStoreHeader &header, const int x,
+                        const int y) {
+  return static_cast<size_t>(y - header.y0) *
+             static_cast<size_t>(header.x1 - header.x0) +
+         static_cast<size_t>(x - header.x0);
+}
+
+static size_t FileSize(const TileStoreHeader &header) {
+  return kSlotAlignment +
+         static_cast<size_t>(header.x1 - header.x0) *
+             static_cast<size_t>(header.y1 - header.y0) * header.slotSize;
+}
+
+TileStore::~TileStore() { Close(); }
+
+bool TileStore::Open(const mt19937::result_type seed, const NoiseType noise,
+                     const int x0, const int y0, const int x1, const int y1) {
+  TileStoreHeader expected{};
+  expected.magic = kStoreMagic;
+  expected.version = kStoreVersion;
+  expected.x0 = x0;
+  expected.y0 = y0;
+  expected.x1 = x1;
+  expected.y1 = y1;
+  expected.slotSize = SlotSize();
+  expected.key = TileCache::ExpectedHeader(seed, noise, 0, 0);
+
+  const auto path = TileCache::StorePath(seed, noise);
+  if (Open(path) && memcmp(header_, &expected, sizeof(expected)) == 0) {
+    return true;
+  }
+  Close();
+
+  if (mkdir(kTileCacheDirectory, 0755) != 0 && errno != EEXIST) {
+    cerr << "Could not create tile cache directory " << kTileCacheDirectory
+         << endl;
+    return false;
+  }
+  // Sized up front and left sparse, every slot reads as an unfinished tile
+  // until it is generated
+  const auto temporaryPath = path + ".tmp";
+  const auto fd = open(temporaryPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    cerr << "Could not create tile store " << path << endl;
+    return false;
+  }
+  const auto written =
+      ftruncate(fd, static_cast<off_t>(FileSize(expected))) == 0 &&
+      pwrite(fd, &expected, sizeof(expected), 0) ==
+          static_cast<ssize_t>(sizeof(expected));
+  close(fd);
+  if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+    cerr << "Could not create tile store " << path << endl;
+    remove(temporaryPath.c_str());
+    return false;
+  }
+  return Open(path);
+}
+
+bool TileStore::Open(const string &path) {
+  Close();
+
+  const auto fd = open(path.c_str(), O_RDWR);
+  if (fd == -1) {
+    return false;
+  }
+  TileStoreHeader header{};
+  struct stat info {};
+  if (pread(fd, &header, sizeof(header), 0) !=
+          static_cast<ssize_t>(sizeof(header)) ||
+      header.magic != kStoreMagic || header.version != kStoreVersion ||
+      header.slotSize != SlotSize() || header.x1 <= header.x0 ||
+      header.y1 <= header.y0 || fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) != FileSize(header)) {
+    close(fd);
+    return false;
+  }
+
+  const auto size = FileSize(header);
+  auto mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  mapping_ = static_cast<char *>(mapping);
+  mappingSize_ = size;
+  header_ = reinterpret_cast<TileStoreHeader *>(mapping_);
+  return true;
+}
+
+void TileStore::Close() {
+  if (mapping_ == nullptr) {
+    return;
+  }
+  munmap(mapping_, mappingSize_);
+  mapping_ = nullptr;
+  mappingSize_ = 0;
+  header_ = nullptr;
+}
+
+bool TileStore::Complete(const int x, const int y) const {
+  const auto expected = TileCache::ExpectedHeader(seed(), noise(), x, y);
+  const auto actual = reinterpret_cast<const TileHeader *>(Slot(x, y));
+  return memcmp(&expected, actual, offsetof(TileHeader, min)) == 0 &&
+         actual->vertexCount == expected.vertexCount;
+}
+
+bool TileStore::Generate(const NoiseField &field, const int x, const int y) {
+  if (!Contains(x, y)) {
+    return false;
+  }
+  Grid height, slope_x, slope_y;
+  GenerateTile(field, x, y, 1, height.data(), slope_x.data(), slope_y.data());
+
+  // A slot being regenerated stops being a valid tile first
+  const auto slot = Slot(x, y);
+  memset(slot, 0, sizeof(TileHeader));
+  const auto vertices = reinterpret_cast<Vertex *>(slot + sizeof(TileHeader));
+  for (size_t row = 0; row < kGeographyLong; row += kMeshBlockRows) {
+    const auto rows = std::min(kMeshBlockRows, kGeographyLong - row);
+    height.WriteVertices(slope_x, slope_y, vertices + index(0, row), row,
+                         rows);
+  }
+  if (msync(slot, header_->slotSize, MS_SYNC) != 0) {
+    return false;
+  }
+
+  auto header = TileCache::ExpectedHeader(seed(), noise(), x, y);
+  header.min = height.min();
+  header.max = height.max();
+  memcpy(slot, &header, sizeof(header));
+  return msync(slot, kSlotAlignment, MS_SYNC) == 0;
+}
+
+int TileStore::Find(const mt19937::result_type seed, const NoiseType noise,
+                    const int x, const int y, off_t *offset) {
+  const auto fd = open(TileCache::StorePath(seed, noise).c_str(), O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  TileStoreHeader header{};
+  if (pread(fd, &header, sizeof(header), 0) !=
+          static_cast<ssize_t>(sizeof(header)) ||
+      header.magic != kStoreMagic || header.version != kStoreVersion ||
+      header.slotSize != SlotSize() || x < header.x0 || x >= header.x1 ||
+      y < header.y0 || y >= header.y1) {
+    close(fd);
+    return -1;
+  }
+  *offset = static_cast<off_t>(kSlotAlignment +
+                               SlotIndex(header, x, y) * header.slotSize);
+  return fd;
+}
+
+char *TileStore::Slot(const int x, const int y) const {
+  return mapping_ + kSlotAlignment + SlotIndex(*header_, x, y) *
+                                         header_->slotSize;
+}
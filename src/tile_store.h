@@ -0,0 +1,74 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+#include "noise_engine.h"
+#include "noise_field.h"
+#include "tile_cache.h"
+
+// Header at the start of a store, followed by one slot per tile of the region
+// in row-major order, each slot laid out exactly like a cached tile file
+struct TileStoreHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::int32_t x0;
+  std::int32_t y0;
+  std::int32_t x1;
+  std::int32_t y1;
+  std::uint64_t slotSize;
+  // Header of tile (0, 0), the key every slot of the store shares
+  TileHeader key;
+};
+
+// A single file holding every tile of a rectangular region [x0, x1) x
+// [y0, y1) for one seed and noise type, which any number of processes map
+// shared and fill in at the same time. Slots start on 64 KiB boundaries so
+// TileCache can map a single tile out of the store. A tile's header is written
+// after its vertices, so readers never take an unfinished slot for a tile.
+class TileStore {
+ public:
+  TileStore() = default;
+  ~TileStore();
+
+  TileStore(const TileStore &) = delete;
+  TileStore &operator=(const TileStore &) = delete;
+
+  // Reuses the store for the seed and noise if it covers the same region with
+  // the same parameters, otherwise replaces it with an empty one
+  bool Open(std::mt19937::result_type, NoiseType, int x0, int y0, int x1,
+            int y1);
+  // Maps an existing store whatever its region
+  bool Open(const std::string &path);
+  void Close();
+
+  inline bool Contains(const int x, const int y) const {
+    return x >= header_->x0 && x < header_->x1 && y >= header_->y0 &&
+           y < header_->y1;
+  }
+  bool Complete(int x, int y) const;
+  // Generates tile (x, y) of the region straight into its slot on the calling
+  // thread, and flushes it to the file
+  bool Generate(const NoiseField &, int x, int y);
+
+  inline std::mt19937::result_type seed() const { return header_->key.seed; }
+  inline NoiseType noise() const {
+    return static_cast<NoiseType>(header_->key.noise);
+  }
+  inline const TileStoreHeader &header() const { return *header_; }
+
+  // Opens the store for the seed and noise read-only if it contains tile
+  // (x, y) and sets the offset of its slot, returns the descriptor or -1
+  static int Find(std::mt19937::result_type, NoiseType, int x, int y,
+                  off_t *offset);
+
+ private:
+  char *Slot(int x, int y) const;
+
+  char *mapping_{nullptr};
+  std::size_t mappingSize_{0};
+  TileStoreHeader *header_{nullptr};
+};
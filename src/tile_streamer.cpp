@@ -0,0 +1,217 @@
+#include "tile_streamer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "constants.h"
+#include "memory_accounting.h"
+
+using namespace std;
+
+static int DistanceSquared(const pair<int, int> &a, const pair<int, int> &b) {
+  const auto x = a.first - b.first;
+  const auto y = a.second - b.second;
+  return x * x + y * y;
+}
+
+TileStreamer::TileStreamer() : pool_(new ThreadPool(kBackgroundThreads)) {}
+
+TileStreamer::~TileStreamer() {
+  for (auto &pending : pending_) {
+    *pending.second = true;
+  }
+  // Joins the workers so nothing is added to ready_ past this point
+  pool_.reset();
+
+  for (const auto &ready : ready_) {
+    delete ready.geography;
+  }
+  for (const auto &tile : resident_) {
+    delete tile.second;
+  }
+  for (auto &buffers : freeBuffers_) {
+    Renderable::DeleteBuffer(&buffers.first);
+    Renderable::DeleteBuffer(&buffers.second);
+  }
+}
+
+bool TileStreamer::Update(const glm::vec3 &camera) {
+  const Coordinate centre{
+      static_cast<int>(floor(camera.x / (kGeographyShort - 1))),
+      static_cast<int>(floor(camera.y / (kGeographyLong - 1)))};
+  // Tiles are only let go one ring further out than they are requested, so
+  // hovering over a tile boundary doesn't repeatedly stream the same tiles
+  const auto keepDistance = (kStreamRadius + 1) * (kStreamRadius + 1);
+  auto changed = false;
+
+  for (auto it = resident_.begin(); it != resident_.end();) {
+    if (DistanceSquared(it->first, centre) > keepDistance) {
+      Evict(it->second);
+      it = resident_.erase(it);
+      changed = true;
+    } else {
+      ++it;
+    }
+  }
+  // What went out of range may leave room for the tiles that didn't fit
+  if (changed) {
+    refused_.clear();
+  }
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (DistanceSquared(it->first, centre) > keepDistance) {
+      *it->second = true;
+      it = pending_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  vector<Coordinate> missing;
+  for (auto x = -kStreamRadius; x <= kStreamRadius; ++x) {
+    for (auto y = -kStreamRadius; y <= kStreamRadius; ++y) {
+      const Coordinate tile{centre.first + x, centre.second + y};
+      if (x * x + y * y <= kStreamRadius * kStreamRadius &&
+          resident_.find(tile) == resident_.end() &&
+          pending_.find(tile) == pending_.end() &&
+          refused_.find(tile) == refused_.end()) {
+        missing.push_back(tile);
+      }
+    }
+  }
+  // Nearest tiles are queued first so the area around the camera fills in
+  // before the horizon does
+  sort(missing.begin(), missing.end(),
+       [&centre](const Coordinate &a, const Coordinate &b) {
+         return DistanceSquared(a, centre) < DistanceSquared(b, centre);
+       });
+  for (const auto &tile : missing) {
+    Request(tile);
+  }
+
+  changed = UploadReady(centre) || changed;
+  if (changed) {
+    objects_.clear();
+    for (const auto &tile : resident_) {
+      objects_.push_back(tile.second);
+    }
+  }
+  return changed;
+}
+
+void TileStreamer::Reset() {
+  ++epoch_;
+  pool_->Clear();
+  for (auto &pending : pending_) {
+    *pending.second = true;
+  }
+  pending_.clear();
+  refused_.clear();
+  for (const auto &tile : resident_) {
+    Evict(tile.second);
+  }
+  resident_.clear();
+  objects_.clear();
+}
+
+void TileStreamer::Request(const Coordinate &tile) {
+  auto cancelled = make_shared<atomic<bool>>(false);
+  pending_[tile] = cancelled;
+  const auto epoch = epoch_;
+  const auto seed = Grid::seed();
+  const auto noise = Grid::noise();
+  pool_->Submit([this, tile, cancelled, epoch, seed, noise] {
+    if (*cancelled) {
+      return;
+    }
+    auto geography = new Geography(tile.first, tile.second, seed, noise);
+    geography->PrepareGeom();
+    lock_guard<mutex> lock(readyMutex_);
+    ready_.push_back({epoch, tile, geography});
+  });
+}
+
+// Keeps the buffers of the evicted tile around for the next upload
+void TileStreamer::Evict(Geography *geography) {
+  pair<GLuint, GLuint> buffers;
+  geography->ReleaseBuffers(&buffers.first, &buffers.second);
+  if (buffers.first != 0) {
+    freeBuffers_.push_back(buffers);
+  }
+  delete geography;
+}
+
+// Drops spare buffers first and then the resident tiles farthest from the
+// camera, as long as they are farther than the tile that needs the room
+bool TileStreamer::MakeRoom(const Coordinate &tile, const Coordinate &centre,
+                            const GLsizeiptr bytes) {
+  while (!MemoryAccounting::Fits(MemoryPool::kGeometry, bytes)) {
+    if (!freeBuffers_.empty()) {
+      Renderable::DeleteBuffer(&freeBuffers_.back().first);
+      Renderable::DeleteBuffer(&freeBuffers_.back().second);
+      freeBuffers_.pop_back();
+      continue;
+    }
+    const auto farthest = max_element(
+        resident_.begin(), resident_.end(),
+        [&centre](const pair<const Coordinate, Geography *> &a,
+                  const pair<const Coordinate, Geography *> &b) {
+          return DistanceSquared(a.first, centre) <
+                 DistanceSquared(b.first, centre);
+        });
+    if (farthest == resident_.end() ||
+        DistanceSquared(farthest->first, centre) <=
+            DistanceSquared(tile, centre)) {
+      return false;
+    }
+    refused_.insert(farthest->first);
+    delete farthest->second;
+    resident_.erase(farthest);
+  }
+  return true;
+}
+
+bool TileStreamer::UploadReady(const Coordinate &centre) {
+  GLsizeiptr uploaded = 0;
+  auto changed = false;
+  while (uploaded < kUploadBudget) {
+    Ready ready{};
+    {
+      lock_guard<mutex> lock(readyMutex_);
+      if (ready_.empty()) {
+        break;
+      }
+      ready = ready_.front();
+      ready_.pop_front();
+    }
+
+    // Generated for an old seed, or no longer wanted since being requested
+    const auto pending = pending_.find(ready.coordinate);
+    if (ready.epoch != epoch_ || pending == pending_.end()) {
+      delete ready.geography;
+      continue;
+    }
+    pending_.erase(pending);
+
+    const auto bytes =
+        ready.geography->vertexBytes() + ready.geography->indexBytes();
+    const auto before = resident_.size();
+    const auto room = MakeRoom(ready.coordinate, centre, bytes);
+    changed = changed || resident_.size() != before;
+    if (!room) {
+      refused_.insert(ready.coordinate);
+      delete ready.geography;
+      continue;
+    }
+
+    if (!freeBuffers_.empty()) {
+      ready.geography->AdoptBuffers(freeBuffers_.back().first,
+                                    freeBuffers_.back().second);
+      freeBuffers_.pop_back();
+    }
+    uploaded += bytes;
+    ready.geography->UploadGeom();
+    resident_[ready.coordinate] = ready.geography;
+    changed = true;
+  }
+  return changed;
+}
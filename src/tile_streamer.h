@@ -0,0 +1,61 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <deque>
+#include <glm/glm.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "geography.h"
+#include "thread_pool.h"
+
+// Keeps every tile within kStreamRadius of the camera resident. Missing tiles
+// are generated on background threads, uploaded within kUploadBudget
+// bytes per tick, and take over the GL buffers of tiles that were evicted.
+// Past kGeometryBudget a tile only goes in if dropping spare buffers and
+// farther tiles makes room, tiles left out aren't requested again until some
+// tile has gone out of range.
+class TileStreamer {
+ public:
+  TileStreamer();
+  ~TileStreamer();
+
+  // Returns whether the set of resident tiles changed
+  bool Update(const glm::vec3 &);
+  // Throws away every tile, e.g. after the seed has changed
+  void Reset();
+
+  inline const std::vector<Renderable *> &objects() const { return objects_; }
+
+ private:
+  using Coordinate = std::pair<int, int>;
+
+  struct Ready {
+    unsigned int epoch;
+    Coordinate coordinate;
+    Geography *geography;
+  };
+
+  void Request(const Coordinate &);
+  void Evict(Geography *);
+  bool UploadReady(const Coordinate &);
+  bool MakeRoom(const Coordinate &, const Coordinate &, GLsizeiptr);
+
+  std::map<Coordinate, Geography *> resident_;
+  std::map<Coordinate, std::shared_ptr<std::atomic<bool>>> pending_;
+  std::set<Coordinate> refused_;
+  std::vector<std::pair<GLuint, GLuint>> freeBuffers_;
+  std::vector<Renderable *> objects_;
+  unsigned int epoch_{0};
+
+  std::mutex readyMutex_;
+  std::deque<Ready> ready_;
+
+  std::unique_ptr<ThreadPool> pool_;
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Layout of every vertex uploaded to the GPU and stored in the tile cache
+struct Vertex {
+  glm::vec3 position;
+  glm::vec3 normal;
+};